@@ -2,7 +2,22 @@
 #include <string>
 #include <chrono>
 #include <ctime>
+#include <cmath>
 #include <iomanip>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 #include <camera/camera.h>
 #include <camera/device_discovery.h>
 #include <camera/photography_settings.h>
@@ -16,11 +31,31 @@
 #else
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <poll.h>
 #define ACCESS_FUNC access
 #define STAT_FUNC stat
 #endif
 
+// CRC instructions for the checksum helpers, vector compares for the start code scan
+#if defined(__aarch64__) && defined(__GNUC__)
+#include <arm_acle.h>
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#endif
+
 std::string getCurrentTime() {
     const auto now = std::chrono::system_clock::now();
     const std::time_t t = std::chrono::system_clock::to_time_t(now);
@@ -57,6 +92,29 @@ int64_t getFileSize(const std::string& file_path) {
     return -1;
 }
 
+// bytes an unprivileged process can still write to the filesystem holding path, -1 if unknown
+int64_t availableBytes(const std::string& path) {
+    const size_t slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    struct statvfs fs;
+    if (statvfs(directory.c_str(), &fs) != 0) {
+        return -1;
+    }
+    return static_cast<int64_t>(fs.f_bavail) * static_cast<int64_t>(fs.f_frsize);
+}
+
+// left free on a download destination, so the OS and its logs keep working on a full SD card
+const int64_t DISK_SPACE_RESERVE = 64LL * 1024LL * 1024LL;
+
+// what downloads into path's directory may still use, -1 if unknown
+int64_t spaceForDownloads(const std::string& path) {
+    const int64_t available = availableBytes(path);
+    if (available < 0) {
+        return -1;
+    }
+    return std::max<int64_t>(0, available - DISK_SPACE_RESERVE);
+}
+
 std::string formatBytes(int64_t bytes) {
     const int64_t GB = 1024LL * 1024LL * 1024LL;
     const int64_t MB = 1024LL * 1024LL;
@@ -82,788 +140,7122 @@ std::string formatBytes(int64_t bytes) {
     }
 }
 
-class CameraController {
-private:
-    std::shared_ptr<ins_camera::Camera> camera_;
-    bool is_connected_;
+// milliseconds elapsed since start, for latency reporting
+double elapsedMs(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-public:
-    CameraController() : is_connected_(false) {}
+bool makeDirectories(const std::string& path) {
+    for (size_t pos = 1; pos <= path.size(); pos++) {
+        if (pos == path.size() || path[pos] == '/') {
+            std::string part = path.substr(0, pos);
+            if (!fileExists(part) && mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
 
-    ~CameraController() {
-        disconnect();
+// directory for state that survives between invocations (discovery cache etc.)
+// $CAMERA_CONTROL_CACHE_DIR, else $XDG_CACHE_HOME/camera_control, else ~/.cache/camera_control
+std::string getCacheDir() {
+    std::string dir;
+    const char* env = getenv("CAMERA_CONTROL_CACHE_DIR");
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (env && *env) {
+        dir = env;
+    } else if (xdg && *xdg) {
+        dir = std::string(xdg) + "/camera_control";
+    } else if (home && *home) {
+        dir = std::string(home) + "/.cache/camera_control";
+    } else {
+        dir = "/tmp/camera_control";
     }
+    makeDirectories(dir);
+    return dir;
+}
 
-    bool discoverAndConnect() {
-        std::cout << "Discovering Insta360 cameras..." << std::endl;
-        
-        ins_camera::SetLogLevel(ins_camera::LogLevel::ERR);
-        ins_camera::DeviceDiscovery discovery;
-        auto device_list = discovery.GetAvailableDevices();
-        
-        if (device_list.empty()) {
-            std::cerr << "Error: No Insta360 camera found." << std::endl;
-            std::cerr << "Please ensure:" << std::endl;
-            std::cerr << "  1. Camera is powered on" << std::endl;
-            std::cerr << "  2. Camera is connected via USB or WiFi" << std::endl;
-            return false;
-        }
+// CRC-32C (Castagnoli), used to fingerprint copied files. uses the CPU's CRC
+// instructions (ARMv8 CRC32 on the Pi, SSE4.2 on x86) when present, otherwise
+// a slicing-by-8 table. all variants work on the inverted register.
+const uint32_t CRC32C_POLY = 0x82F63B78u;
 
-        std::cout << "Found " << device_list.size() << " camera(s):" << std::endl;
-        for (size_t i = 0; i < device_list.size(); i++) {
-            const auto& device = device_list[i];
-            std::cout << "  [" << i << "] " << device.camera_name 
-                      << " (SN: " << device.serial_number 
-                      << ", FW: " << device.fw_version << ")" << std::endl;
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char* p, size_t length) {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(8 * 256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+            }
+            t[i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                t[k * 256 + i] = (t[(k - 1) * 256 + i] >> 8) ^ t[t[(k - 1) * 256 + i] & 0xFF];
+            }
         }
+        return t;
+    }();
+    const uint32_t* t = table.data();
+    while (length >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;  // little endian
+        crc = t[7 * 256 + (lo & 0xFF)] ^ t[6 * 256 + ((lo >> 8) & 0xFF)] ^
+              t[5 * 256 + ((lo >> 16) & 0xFF)] ^ t[4 * 256 + (lo >> 24)] ^
+              t[3 * 256 + (hi & 0xFF)] ^ t[2 * 256 + ((hi >> 8) & 0xFF)] ^
+              t[1 * 256 + ((hi >> 16) & 0xFF)] ^ t[hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
 
-        // use the first available camera
-        const auto& selected_device = device_list[0];
-        std::cout << "\nConnecting to: " << selected_device.camera_name 
-                  << " (SN: " << selected_device.serial_number << ")..." << std::endl;
+#if defined(__aarch64__) && defined(__GNUC__)
+__attribute__((target("+crc")))
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t length) {
+    while (length >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
 
-        camera_ = std::make_shared<ins_camera::Camera>(selected_device.info);
-        
-        if (!camera_->Open()) {
-            std::cerr << "Error: Failed to open camera connection." << std::endl;
-            discovery.FreeDeviceDescriptors(device_list);
-            return false;
-        }
+bool crc32cHardwareSupported() {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#elif defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t length) {
+    uint64_t c = crc;
+    while (length >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(c);
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
 
-        // sync time to camera
-        time_t now = time(nullptr);
-        std::tm tm{};
-#ifdef WIN32
-        localtime_s(&tm, &now);
-        time_t time_seconds = _mkgmtime(&tm);
+bool crc32cHardwareSupported() {
+    return __builtin_cpu_supports("sse4.2");
+}
 #else
-        localtime_r(&now, &tm);
-        time_t time_seconds = timegm(&tm);
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t length) {
+    return crc32cSoftware(crc, p, length);
+}
+
+bool crc32cHardwareSupported() {
+    return false;
+}
 #endif
-        camera_->SyncLocalTimeToCamera(time_seconds);
 
-        is_connected_ = true;
-        std::cout << "Successfully connected to camera!" << std::endl;
-        
-        discovery.FreeDeviceDescriptors(device_list);
+bool crc32cUsesHardware() {
+    static const bool supported = crc32cHardwareSupported();
+    return supported;
+}
+
+uint32_t crc32cUpdate(uint32_t crc, const void* data, size_t length) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    crc = crc32cUsesHardware() ? crc32cHardware(crc, p, length) : crc32cSoftware(crc, p, length);
+    return ~crc;
+}
+
+// CRC of A followed by B from crc(A), crc(B) and len(B), so ranges hashed
+// by separate connections can be joined without reading the data again.
+// GF(2) matrix method, as in zlib's crc32_combine.
+uint32_t gf2MatrixTimes(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+void gf2MatrixSquare(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2MatrixTimes(mat, mat[n]);
+    }
+}
+
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, int64_t length2) {
+    if (length2 <= 0) {
+        return crc1;
+    }
+    uint32_t even[32];
+    uint32_t odd[32];
+    odd[0] = CRC32C_POLY;  // operator for one zero bit
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2MatrixSquare(even, odd);  // two zero bits
+    gf2MatrixSquare(odd, even);  // four zero bits
+    do {
+        gf2MatrixSquare(even, odd);
+        if (length2 & 1) {
+            crc1 = gf2MatrixTimes(even, crc1);
+        }
+        length2 >>= 1;
+        if (length2 == 0) {
+            break;
+        }
+        gf2MatrixSquare(odd, even);
+        if (length2 & 1) {
+            crc1 = gf2MatrixTimes(odd, crc1);
+        }
+        length2 >>= 1;
+    } while (length2 != 0);
+    return crc1 ^ crc2;
+}
+
+// extends crc over [offset, offset + length) of an open file
+bool crc32cRange(int fd, int64_t offset, int64_t length, uint32_t& crc) {
+    std::vector<char> buffer(1 << 20);
+    while (length > 0) {
+        ssize_t n = pread(fd, buffer.data(), static_cast<size_t>(std::min<int64_t>(length, static_cast<int64_t>(buffer.size()))), offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        crc = crc32cUpdate(crc, buffer.data(), static_cast<size_t>(n));
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+// hashes a whole file by mapping it, i.e. a second read of what is on disk
+bool crc32cFile(const std::string& path, uint32_t& crc) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    crc = 0;
+    if (st.st_size == 0) {
+        close(fd);
         return true;
     }
+    void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    crc = crc32cUpdate(0, map, static_cast<size_t>(st.st_size));
+    munmap(map, static_cast<size_t>(st.st_size));
+    return true;
+}
 
-    void disconnect() {
-        if (camera_ && is_connected_) {
-            camera_->Close();
-            is_connected_ = false;
-            std::cout << "Disconnected from camera." << std::endl;
+// one remembered camera from a previous successful connect
+struct DeviceCacheEntry {
+    std::string serial_number;
+    std::string camera_name;
+    ins_camera::ConnectionType connection_type;
+    int64_t last_good;  // unix time of the last successful Open()
+};
+
+const char* connectionTypeName(ins_camera::ConnectionType type) {
+    switch (type) {
+        case ins_camera::ConnectionType::USB:
+            return "usb";
+        case ins_camera::ConnectionType::Wifi:
+            return "wifi";
+        case ins_camera::ConnectionType::Bluetooth:
+            return "bluetooth";
+    }
+    return "unknown";
+}
+
+// cache format: one tab separated line per device
+//   serial  camera_name  connection_type  last_good
+std::vector<DeviceCacheEntry> loadDeviceCache() {
+    std::vector<DeviceCacheEntry> entries;
+    std::ifstream in(getCacheDir() + "/devices");
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, '\t')) {
+            fields.push_back(field);
         }
+        if (fields.size() != 4 || fields[0].empty()) {
+            continue;
+        }
+        DeviceCacheEntry entry;
+        entry.serial_number = fields[0];
+        entry.camera_name = fields[1];
+        entry.connection_type = fields[2] == "wifi" ? ins_camera::ConnectionType::Wifi
+                              : fields[2] == "bluetooth" ? ins_camera::ConnectionType::Bluetooth
+                              : ins_camera::ConnectionType::USB;
+        entry.last_good = atoll(fields[3].c_str());
+        entries.push_back(entry);
     }
+    return entries;
+}
 
-    bool takePhoto(const std::string& save_directory = "./") {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
-            return false;
+void saveDeviceCache(const std::vector<DeviceCacheEntry>& entries) {
+    const std::string path = getCacheDir() + "/devices";
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out) {
+            return;
+        }
+        for (size_t i = 0; i < entries.size(); i++) {
+            out << entries[i].serial_number << '\t' << entries[i].camera_name << '\t'
+                << connectionTypeName(entries[i].connection_type) << '\t' << entries[i].last_good << '\n';
         }
+    }
+    rename(tmp_path.c_str(), path.c_str());
+}
 
-        // check if camera is still connected
-        if (!camera_->IsConnected()) {
-            std::cerr << "Error: Camera connection lost." << std::endl;
-            is_connected_ = false;
-            return false;
+// records a successful connect so the next run tries this camera first
+void rememberDevice(const ins_camera::DeviceDescriptor& device) {
+    std::vector<DeviceCacheEntry> entries = loadDeviceCache();
+    DeviceCacheEntry* entry = nullptr;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].serial_number == device.serial_number) {
+            entry = &entries[i];
         }
+    }
+    if (!entry) {
+        entries.push_back(DeviceCacheEntry());
+        entry = &entries.back();
+        entry->serial_number = device.serial_number;
+    }
+    entry->camera_name = device.camera_name;
+    entry->connection_type = device.info.connection_type;
+    entry->last_good = static_cast<int64_t>(time(nullptr));
+    saveDeviceCache(entries);
+}
 
-        std::cout << "Setting photo mode..." << std::endl;
-        bool ret = camera_->SetPhotoSubMode(ins_camera::SubPhotoMode::PHOTO_SINGLE);
-        if (!ret) {
-            std::cerr << "Warning: Failed to set photo mode, continuing anyway..." << std::endl;
+// a cached file listing is served as long as GetCameraFilesCount() still matches,
+// but never for longer than this: a delete plus a capture on the camera itself
+// leaves the count unchanged
+const int64_t LISTING_CACHE_MAX_AGE_SEC = 600;
+
+// the camera's file list as of the last GetCameraFilesList() call
+struct ListingCache {
+    int count;           // GetCameraFilesCount() right before the list was fetched
+    int64_t fetched_at;  // unix time
+    std::vector<std::string> files;
+};
+
+std::string listingCachePath(const std::string& serial) {
+    return getCacheDir() + "/listing-" + serial;
+}
+
+// cache format: a "count  fetched_at" header line, then one camera path per line
+bool loadListingCache(const std::string& serial, ListingCache& cache) {
+    std::ifstream in(listingCachePath(serial));
+    std::string line;
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    const size_t tab = line.find('\t');
+    if (tab == std::string::npos) {
+        return false;
+    }
+    cache.count = atoi(line.substr(0, tab).c_str());
+    cache.fetched_at = atoll(line.substr(tab + 1).c_str());
+    cache.files.clear();
+    while (std::getline(in, line)) {
+        if (!line.empty()) {
+            cache.files.push_back(line);
         }
+    }
+    return true;
+}
 
-        std::cout << "Taking photo..." << std::endl;
-        const auto url = camera_->TakePhoto();
-        
-        if (url.Empty() || !url.IsSingleOrigin()) {
-            std::cerr << "Error: Failed to take photo." << std::endl;
-            return false;
+void saveListingCache(const std::string& serial, const ListingCache& cache) {
+    const std::string path = listingCachePath(serial);
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out) {
+            return;
         }
+        out << cache.count << '\t' << cache.fetched_at << '\n';
+        for (size_t i = 0; i < cache.files.size(); i++) {
+            out << cache.files[i] << '\n';
+        }
+    }
+    rename(tmp_path.c_str(), path.c_str());
+}
 
-        const std::string photo_url = url.GetSingleOrigin();
-        std::cout << "Photo captured! URL: " << photo_url << std::endl;
+// one file copy-storage has already copied and verified
+struct ManifestEntry {
+    std::string serial_number;
+    std::string remote_path;
+    int64_t size;
+    uint32_t checksum;  // CRC-32C of the local copy
+    int64_t copied_at;  // unix time
+};
 
-        // download the photo if save directory is provided
-        if (!save_directory.empty()) {
-            std::string save_path = save_directory;
-            if (save_path.back() != '/' && save_path.back() != '\\') {
-                save_path += "/";
-            }
-            
-            // check if directory exists
-            if (!fileExists(save_path)) {
-                std::cerr << "Warning: Save directory does not exist: " << save_path << std::endl;
-                std::cerr << "Photo URL saved on camera: " << photo_url << std::endl;
-                return true;
-            }
+// per destination directory record of what copy-storage has copied, so an
+// --incremental run can skip files that are already on disk. the file is
+// append-only; a later line for the same camera file replaces an earlier one.
+//   serial  remote_path  size  crc32c  copied_at
+class CopyManifest {
+private:
+    std::string path_;
+    std::map<std::string, ManifestEntry> entries_;
+    std::mutex mutex_;
 
-            std::string file_name = getFileName(photo_url);
-            if (file_name.empty()) {
-                file_name = "photo_" + getCurrentTime() + ".jpg";
-            }
-            
-            std::string full_path = save_path + file_name;
-            std::cout << "Downloading photo to: " << full_path << std::endl;
+    static std::string key(const std::string& serial, const std::string& remote_path) {
+        return serial + '\t' + remote_path;
+    }
 
-            int64_t last_progress = -1;
-            int64_t last_current = -1;
-            auto last_update_time = std::chrono::steady_clock::now();
-            int64_t total_size_known = 0;
-            
-            bool download_success = camera_->DownloadCameraFile(photo_url, full_path,
-                [&](int64_t current, int64_t total_size) {
-                    total_size_known = total_size;
-                    auto now = std::chrono::steady_clock::now();
-                    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_update_time).count();
-                    
-                    // Use floating-point for more accurate progress calculation
-                    double progress_double = total_size > 0 ? (static_cast<double>(current) * 100.0 / static_cast<double>(total_size)) : 0.0;
-                    int64_t progress = static_cast<int64_t>(progress_double);
-                    
-                    // Force 100% when current equals total_size (handle edge case)
-                    if (current >= total_size && total_size > 0) {
-                        progress = 100;
-                    }
-                    
-                    // Show progress if it changed, or if we're near completion
-                    if (progress != last_progress || (current != last_current && total_size > 0 && current >= total_size * 0.97)) {
-                        if (total_size > 0) {
-                            std::cout << "\rDownload progress: " << progress << "% (" 
-                                     << formatBytes(current) << " / " << formatBytes(total_size) << ")" << std::flush;
-                        } else {
-                            std::cout << "\rDownload progress: " << formatBytes(current) << " downloaded" << std::flush;
-                        }
-                        last_progress = progress;
-                        last_current = current;
-                        last_update_time = now;
-                    }
-                    
-                    // Timeout detection: if no progress for 30 seconds, warn
-                    if (elapsed > 30 && current == last_current && current < total_size) {
-                        std::cout << "\nWarning: Download appears stalled at " << progress << "%" << std::endl;
-                        std::cout << "Continuing to wait..." << std::flush;
-                    }
-                });
-            
-            // Explicitly show 100% if download succeeded (handles case where SDK doesn't call callback at 100%)
-            if (download_success) {
-                if (total_size_known > 0) {
-                    std::cout << "\rDownload progress: 100% (" << formatBytes(total_size_known) 
-                             << " / " << formatBytes(total_size_known) << ")" << std::flush;
-                } else {
-                    std::cout << "\rDownload progress: 100%" << std::flush;
-                }
+public:
+    explicit CopyManifest(const std::string& directory) : path_(directory + ".camera_control_manifest") {
+        std::ifstream in(path_);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields;
+            std::stringstream ss(line);
+            std::string field;
+            while (std::getline(ss, field, '\t')) {
+                fields.push_back(field);
             }
-            std::cout << std::endl;
-            
-            if (download_success) {
-                // Verify file was actually written
-                int64_t file_size = getFileSize(full_path);
-                if (file_size < 0) {
-                    std::cerr << "Error: Download reported success but file does not exist: " << full_path << std::endl;
-                    return false;
-                }
-                if (file_size == 0) {
-                    std::cerr << "Error: Download reported success but file is empty: " << full_path << std::endl;
-                    return false;
-                }
-                if (total_size_known > 0 && file_size != total_size_known) {
-                    std::cerr << "Warning: File size mismatch. Expected: " << formatBytes(total_size_known) 
-                             << ", Got: " << formatBytes(file_size) << std::endl;
-                    // Still consider it success if file exists and has data
-                }
-                std::cout << "Photo successfully downloaded to: " << full_path 
-                         << " (" << formatBytes(file_size) << ")" << std::endl;
-                return true;
-            } else {
-                std::cerr << "Error: Failed to download photo." << std::endl;
-                std::cerr << "Photo URL on camera: " << photo_url << std::endl;
-                return false;
+            if (fields.size() != 5 || fields[1].empty()) {
+                continue;
             }
+            ManifestEntry entry;
+            entry.serial_number = fields[0];
+            entry.remote_path = fields[1];
+            entry.size = atoll(fields[2].c_str());
+            entry.checksum = static_cast<uint32_t>(strtoul(fields[3].c_str(), nullptr, 16));
+            entry.copied_at = atoll(fields[4].c_str());
+            entries_[key(entry.serial_number, entry.remote_path)] = entry;
         }
-
-        return true;
     }
 
-    bool shutdownCamera() {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
+    bool lookup(const std::string& serial, const std::string& remote_path, ManifestEntry& entry) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<std::string, ManifestEntry>::const_iterator it = entries_.find(key(serial, remote_path));
+        if (it == entries_.end()) {
             return false;
         }
+        entry = it->second;
+        return true;
+    }
 
-        std::cout << "Shutting down camera..." << std::endl;
-        bool ret = camera_->ShutdownCamera();
-        
-        if (ret) {
-            std::cout << "Camera shutdown command sent successfully." << std::endl;
-            is_connected_ = false;
-            return true;
-        } else {
-            std::cerr << "Error: Failed to shutdown camera." << std::endl;
+    bool record(const ManifestEntry& entry) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[key(entry.serial_number, entry.remote_path)] = entry;
+        std::ofstream out(path_, std::ios::app);
+        char checksum[9];
+        snprintf(checksum, sizeof(checksum), "%08x", entry.checksum);
+        out << entry.serial_number << '\t' << entry.remote_path << '\t' << entry.size << '\t'
+            << checksum << '\t' << entry.copied_at << '\n';
+        out.flush();
+        return static_cast<bool>(out);
+    }
+};
+
+// flushes a file's data to the storage device. the file may be opened read-only for this
+bool syncFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = fdatasync(fd) == 0;
+    const int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return ok;
+}
+
+// makes renames and new files in a directory durable
+bool syncDirectory(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = fsync(fd) == 0;
+    const int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return ok;
+}
+
+// a copied file whose local copy is on stable storage, so the camera copy may go
+struct JournalEntry {
+    std::string serial_number;
+    std::string remote_path;
+    std::string local_path;
+    int64_t size;
+};
+
+// write-ahead journal of copy-storage, next to the manifest. a file is only deleted
+// from the camera once its "durable" line is synced, and that line is only written
+// after the file itself was synced. a run that dies (power loss) between the two
+// leaves the journal behind; the next run into the directory finishes its deletes.
+//   durable  serial  remote_path  local_path  size
+//   deleted  serial  remote_path
+class CopyJournal {
+private:
+    std::string path_;
+    std::mutex mutex_;
+
+    static std::string durableLine(const JournalEntry& entry) {
+        return "durable\t" + entry.serial_number + '\t' + entry.remote_path + '\t' + entry.local_path + '\t' +
+               std::to_string(entry.size) + '\n';
+    }
+
+    static bool append(const std::string& path, const std::string& lines, bool sync) {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
             return false;
         }
+        bool ok = write(fd, lines.data(), lines.size()) == static_cast<ssize_t>(lines.size());
+        if (ok && sync) {
+            ok = fdatasync(fd) == 0;
+        }
+        close(fd);
+        return ok;
     }
 
-    bool getBatteryStatus() {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
-            return false;
+public:
+    explicit CopyJournal(const std::string& directory) : path_(directory + ".camera_control_journal") {}
+
+    const std::string& path() const {
+        return path_;
+    }
+
+    // files journaled as durable that have no "deleted" line yet, in journal order
+    std::vector<JournalEntry> pending() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<JournalEntry> entries;
+        std::ifstream in(path_);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields;
+            std::stringstream ss(line);
+            std::string field;
+            while (std::getline(ss, field, '\t')) {
+                fields.push_back(field);
+            }
+            if (fields.size() == 5 && fields[0] == "durable") {
+                JournalEntry entry;
+                entry.serial_number = fields[1];
+                entry.remote_path = fields[2];
+                entry.local_path = fields[3];
+                entry.size = atoll(fields[4].c_str());
+                entries.push_back(entry);
+            } else if (fields.size() == 3 && fields[0] == "deleted") {
+                for (size_t i = 0; i < entries.size(); i++) {
+                    if (entries[i].serial_number == fields[1] && entries[i].remote_path == fields[2]) {
+                        entries.erase(entries.begin() + i);
+                        break;
+                    }
+                }
+            }
         }
+        return entries;
+    }
 
-        ins_camera::BatteryStatus status{};
-        bool ret = camera_->GetBatteryStatus(status);
-        
-        if (!ret) {
-            std::cerr << "Error: Failed to get battery status." << std::endl;
-            return false;
+    // one group commit: returns once every entry is on stable storage
+    bool commitDurable(const std::vector<JournalEntry>& entries) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string lines;
+        for (size_t i = 0; i < entries.size(); i++) {
+            lines += durableLine(entries[i]);
         }
+        return append(path_, lines, true);
+    }
 
-        std::cout << "Battery Status:" << std::endl;
-        std::cout << "  Power Type: " << (status.power_type == ins_camera::PowerType::BATTERY ? "Battery" : "Adapter") << std::endl;
-        std::cout << "  Battery Level: " << status.battery_level << "%" << std::endl;
-        std::cout << "  Battery Scale: " << status.battery_scale << std::endl;
-        
-        return true;
+    // not synced: if it is lost, the next run tries the delete again
+    void recordDeleted(const std::string& serial, const std::string& remote_path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        append(path_, "deleted\t" + serial + '\t' + remote_path + '\n', false);
     }
 
-    bool getStorageStatus() {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
-            return false;
+    // replaces the journal with just these entries (removes it if there are none)
+    void reset(const std::vector<JournalEntry>& keep) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (keep.empty()) {
+            unlink(path_.c_str());
+            return;
         }
-
-        ins_camera::StorageStatus status{};
-        bool ret = camera_->GetStorageState(status);
-        
-        if (!ret) {
-            std::cerr << "Error: Failed to get storage status." << std::endl;
-            return false;
+        const std::string tmp_path = path_ + ".tmp";
+        std::string lines;
+        for (size_t i = 0; i < keep.size(); i++) {
+            lines += durableLine(keep[i]);
         }
+        unlink(tmp_path.c_str());
+        if (append(tmp_path, lines, true)) {
+            rename(tmp_path.c_str(), path_.c_str());
+        }
+    }
+};
 
-        // convert bytes to GB or MB
-        auto formatBytes = [](uint64_t bytes) -> std::string {
-            const uint64_t GB = 1024ULL * 1024ULL * 1024ULL;
-            const uint64_t MB = 1024ULL * 1024ULL;
-            
-            if (bytes >= GB) {
-                double gb = static_cast<double>(bytes) / GB;
-                char buffer[32];
-                snprintf(buffer, sizeof(buffer), "%.2f GB", gb);
-                return std::string(buffer);
-            } else if (bytes >= MB) {
-                double mb = static_cast<double>(bytes) / MB;
-                char buffer[32];
-                snprintf(buffer, sizeof(buffer), "%.2f MB", mb);
-                return std::string(buffer);
+// records how long each SDK call of a command takes. every command gets a
+// phase breakdown (printed with --trace, appended as a JSON line to --trace-file)
+// and all samples are kept for the session min/p50/p99/max summary.
+class PhaseTracer {
+private:
+    struct PhaseSample {
+        std::string name;
+        double start_ms;  // relative to the start of the command
+        double duration_ms;
+    };
+
+    mutable std::mutex mutex_;
+    std::string command_;
+    std::chrono::steady_clock::time_point command_start_;
+    std::vector<PhaseSample> phases_;
+    std::map<std::string, std::vector<double> > session_samples_;
+    bool print_table_;
+    std::string trace_file_;
+
+    static std::string jsonEscape(const std::string& text) {
+        std::string out;
+        for (size_t i = 0; i < text.size(); i++) {
+            const char c = text[i];
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buffer[8];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                out += buffer;
             } else {
-                return std::to_string(bytes) + " bytes";
+                out += c;
             }
-        };
+        }
+        return out;
+    }
 
-        // convert CardState enum to readable text
-        std::string state_text;
-        switch (status.state) {
-            case ins_camera::STOR_CS_PASS:
-                state_text = "OK";
-                break;
-            case ins_camera::STOR_CS_NOCARD:
-                state_text = "No Card";
-                break;
-            case ins_camera::STOR_CS_NOSPACE:
-                state_text = "No Space";
-                break;
-            case ins_camera::STOR_CS_INVALID_FORMAT:
-                state_text = "Invalid Format";
-                break;
-            case ins_camera::STOR_CS_WPCARD:
-                state_text = "Write Protected";
-                break;
-            case ins_camera::STOR_CS_OTHER_ERROR:
-                state_text = "Other Error";
-                break;
-            default:
-                state_text = "Unknown";
-                break;
+    static double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) {
+            return 0.0;
         }
+        size_t rank = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size()) + 0.5);
+        rank = rank == 0 ? 0 : rank - 1;
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
 
-        uint64_t used_space = status.total_space - status.free_space;
-        double used_percentage = status.total_space > 0 
-            ? (static_cast<double>(used_space) / status.total_space) * 100.0 
-            : 0.0;
+public:
+    PhaseTracer() : print_table_(false) {}
 
-        std::cout << "Storage Status:" << std::endl;
-        std::cout << "  State: " << state_text << std::endl;
-        std::cout << "  Total Space: " << formatBytes(status.total_space) << std::endl;
-        std::cout << "  Free Space: " << formatBytes(status.free_space) << std::endl;
-        std::cout << "  Used Space: " << formatBytes(used_space) << " (" 
-                  << std::fixed << std::setprecision(1) << used_percentage << "%)" << std::endl;
-        
-        return true;
+    void setPrintTable(bool enabled) {
+        print_table_ = enabled;
     }
 
-    bool setVideoMode() {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
-            return false;
+    void setTraceFile(const std::string& path) {
+        trace_file_ = path;
+    }
+
+    const std::string& traceFile() const {
+        return trace_file_;
+    }
+
+    void beginCommand(const std::string& command) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        command_ = command;
+        command_start_ = std::chrono::steady_clock::now();
+        phases_.clear();
+    }
+
+    // session_only samples (from background threads) don't belong to the command currently running
+    void record(const std::string& name, const std::chrono::steady_clock::time_point& start, double duration_ms,
+                bool session_only = false) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (session_only) {
+            session_samples_[name].push_back(duration_ms);
+            return;
         }
+        PhaseSample sample;
+        sample.name = name;
+        sample.start_ms = std::chrono::duration<double, std::milli>(start - command_start_).count();
+        sample.duration_ms = duration_ms;
+        phases_.push_back(sample);
+        session_samples_[name].push_back(duration_ms);
+    }
 
-        std::cout << "Setting video mode..." << std::endl;
-        bool ret = camera_->SetVideoSubMode(ins_camera::SubVideoMode::VIDEO_NORMAL);
-        
-        if (!ret) {
-            std::cerr << "Error: Failed to set video mode." << std::endl;
-            return false;
+    // prints/writes the breakdown of the current command
+    void endCommand(bool success) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (command_.empty()) {
+            return;
         }
+        const double total_ms = elapsedMs(command_start_);
+        session_samples_["command:" + command_].push_back(total_ms);
 
-        std::cout << "Video mode set successfully." << std::endl;
-        return true;
+        // group repeated calls (e.g. one download per file) by phase name, in first-seen order
+        std::vector<std::string> order;
+        std::map<std::string, int> calls;
+        std::map<std::string, double> sum_ms;
+        std::map<std::string, double> max_ms;
+        for (size_t i = 0; i < phases_.size(); i++) {
+            const PhaseSample& phase = phases_[i];
+            if (calls[phase.name]++ == 0) {
+                order.push_back(phase.name);
+            }
+            sum_ms[phase.name] += phase.duration_ms;
+            max_ms[phase.name] = std::max(max_ms[phase.name], phase.duration_ms);
+        }
+
+        if (print_table_) {
+            std::ostringstream table;
+            table << std::fixed << std::setprecision(1);
+            table << "\n=== Trace: " << command_ << " (" << total_ms << " ms, " << (success ? "ok" : "failed") << ") ===" << std::endl;
+            table << "  " << std::left << std::setw(24) << "phase" << std::right << std::setw(7) << "calls"
+                  << std::setw(12) << "total ms" << std::setw(12) << "max ms" << std::setw(8) << "%" << std::endl;
+            for (size_t i = 0; i < order.size(); i++) {
+                const std::string& name = order[i];
+                table << "  " << std::left << std::setw(24) << name << std::right << std::setw(7) << calls[name]
+                      << std::setw(12) << sum_ms[name] << std::setw(12) << max_ms[name]
+                      << std::setw(8) << (total_ms > 0 ? sum_ms[name] * 100.0 / total_ms : 0.0) << std::endl;
+            }
+            std::cout << table.str();
+        }
+
+        if (!trace_file_.empty()) {
+            std::ofstream out(trace_file_, std::ios::app);
+            if (out) {
+                out << std::fixed << std::setprecision(3);
+                out << "{\"command\":\"" << jsonEscape(command_) << "\",\"time\":\"" << getCurrentTime()
+                    << "\",\"ok\":" << (success ? "true" : "false") << ",\"total_ms\":" << total_ms << ",\"phases\":[";
+                for (size_t i = 0; i < order.size(); i++) {
+                    const std::string& name = order[i];
+                    out << (i ? "," : "") << "{\"name\":\"" << jsonEscape(name) << "\",\"calls\":" << calls[name]
+                        << ",\"ms\":" << sum_ms[name] << ",\"max_ms\":" << max_ms[name] << "}";
+                }
+                out << "]}\n";
+            } else {
+                std::cerr << "Warning: Cannot write trace file: " << trace_file_ << std::endl;
+            }
+        }
+
+        command_.clear();
+        phases_.clear();
     }
 
-    bool startRecording() {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
+    // session-wide latency distribution per phase
+    void printSessionSummary() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (session_samples_.empty()) {
+            return;
+        }
+        std::ostringstream table;
+        table << std::fixed << std::setprecision(1);
+        table << "  Latency (ms):" << std::endl;
+        table << "    " << std::left << std::setw(24) << "phase" << std::right << std::setw(7) << "n"
+              << std::setw(10) << "min" << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+        for (std::map<std::string, std::vector<double> >::const_iterator it = session_samples_.begin();
+             it != session_samples_.end(); ++it) {
+            std::vector<double> sorted = it->second;
+            std::sort(sorted.begin(), sorted.end());
+            table << "    " << std::left << std::setw(24) << it->first << std::right << std::setw(7) << sorted.size()
+                  << std::setw(10) << sorted.front() << std::setw(10) << percentile(sorted, 50.0)
+                  << std::setw(10) << percentile(sorted, 99.0) << std::setw(10) << sorted.back() << std::endl;
+        }
+        std::cout << table.str();
+    }
+};
+
+// times the enclosing scope (or until end()) as one phase of the current command
+class ScopedPhase {
+private:
+    PhaseTracer& tracer_;
+    const char* name_;
+    std::chrono::steady_clock::time_point start_;
+    bool session_only_;
+    bool ended_;
+
+public:
+    ScopedPhase(PhaseTracer& tracer, const char* name, bool session_only = false)
+        : tracer_(tracer), name_(name), start_(std::chrono::steady_clock::now()),
+          session_only_(session_only), ended_(false) {}
+
+    ~ScopedPhase() {
+        end();
+    }
+
+    void end() {
+        if (!ended_) {
+            tracer_.record(name_, start_, elapsedMs(start_), session_only_);
+            ended_ = true;
+        }
+    }
+};
+
+// output from background threads goes straight to the process' stdout, since
+// std::cout may be redirected to a daemon client at the time
+void backgroundLog(const std::string& line) {
+    static std::mutex log_mutex;
+    std::lock_guard<std::mutex> lock(log_mutex);
+    fprintf(stdout, "%s\n", line.c_str());
+    fflush(stdout);
+}
+
+// fixed-capacity FIFO between pipeline stages. push() blocks while full,
+// pop() blocks while empty and returns false once closed and drained.
+template <typename T>
+class BoundedQueue {
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity < 1 ? 1 : capacity), closed_(false) {}
+
+    void push(const T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return items_.size() < capacity_ || closed_; });
+        items_.push_back(item);
+        not_empty_.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+        if (items_.empty()) {
             return false;
         }
+        item = items_.front();
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
 
-        // check if camera is still connected
-        if (!camera_->IsConnected()) {
-            std::cerr << "Error: Camera connection lost." << std::endl;
-            is_connected_ = false;
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+};
+
+// calls cancel() from its own thread if kick() isn't called for timeout_ms.
+// fires at most once; timeout_ms <= 0 disables it.
+class StallWatchdog {
+private:
+    std::function<void()> cancel_;
+    int64_t timeout_ms_;
+    std::atomic<int64_t> last_kick_ms_;
+    std::atomic<bool> fired_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+
+    static int64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            cv_.wait_for(lock, std::chrono::milliseconds(std::min<int64_t>(timeout_ms_, 500)));
+            if (!stop_ && nowMs() - last_kick_ms_ > timeout_ms_) {
+                fired_ = true;
+                cancel_();
+                break;
+            }
+        }
+    }
+
+public:
+    StallWatchdog(int64_t timeout_ms, const std::function<void()>& cancel)
+        : cancel_(cancel), timeout_ms_(timeout_ms), last_kick_ms_(nowMs()), fired_(false), stop_(false) {
+        if (timeout_ms_ > 0) {
+            thread_ = std::thread(&StallWatchdog::run, this);
+        }
+    }
+
+    ~StallWatchdog() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void kick() {
+        last_kick_ms_ = nowMs();
+    }
+
+    bool fired() const {
+        return fired_;
+    }
+};
+
+std::string absolutePath(const std::string& path) {
+    if (path.empty() || path[0] == '/') {
+        return path;
+    }
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return path;
+    }
+    std::string relative = path;
+    while (relative.compare(0, 2, "./") == 0) {
+        relative.erase(0, 2);
+    }
+    return std::string(cwd) + "/" + relative;
+}
+
+bool writeAll(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             return false;
         }
+        offset += static_cast<size_t>(n);
+    }
+    return true;
+}
 
-        // set video mode first
-        std::cout << "Setting video mode..." << std::endl;
-        bool ret = camera_->SetVideoSubMode(ins_camera::SubVideoMode::VIDEO_NORMAL);
-        if (!ret) {
-            std::cerr << "Warning: Failed to set video mode, continuing anyway..." << std::endl;
+// files smaller than this are fetched over a single connection
+const int64_t HTTP_CHUNK_SIZE = 8LL * 1024LL * 1024LL;
+// a download that makes no progress for this long is cancelled and retried (--stall-timeout)
+const int DEFAULT_STALL_TIMEOUT_SEC = 30;
+
+// minimal HTTP/1.1 client for the camera's built-in file server (Camera::GetHttpBaseUrl()).
+// large files are split into HTTP_CHUNK_SIZE range requests fetched over several
+// connections at once, which keeps a WiFi link busier than the single stream of
+// Camera::DownloadCameraFile().
+class HttpDownloader {
+private:
+    std::string host_;
+    std::string port_;
+    std::string prefix_;
+    int connections_;
+    int io_timeout_sec_;  // a connection that receives nothing for this long is treated as dead, 0 = never
+
+    static std::string urlEncodePath(const std::string& path) {
+        static const char* hex = "0123456789ABCDEF";
+        std::string out;
+        for (size_t i = 0; i < path.size(); i++) {
+            const unsigned char c = static_cast<unsigned char>(path[i]);
+            if (isalnum(c) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~') {
+                out += static_cast<char>(c);
+            } else {
+                out += '%';
+                out += hex[c >> 4];
+                out += hex[c & 0xf];
+            }
         }
+        return out;
+    }
 
-        // set video capture parameters (not sure yet exactly what to set the parameters to)
-        // ins_camera::RecordParams record_params;
-        // record_params.resolution = ins_camera::VideoResolution::RES_3840_3840P30;
-        // record_params.bitrate = 1024 * 1024 * 10; // 10 Mbps default
-        // ret = camera_->SetVideoCaptureParams(record_params, ins_camera::CameraFunctionMode::FUNCTION_MODE_NORMAL_VIDEO);
-        // if (!ret) {
-        //     std::cerr << "Warning: Failed to set video capture params, continuing anyway..." << std::endl;
-        // }
+    int openConnection() const {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &result) != 0) {
+            return -1;
+        }
+        int fd = -1;
+        for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            timeval timeout{};
+            timeout.tv_sec = io_timeout_sec_;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(result);
+        return fd;
+    }
 
-        std::cout << "Starting recording..." << std::endl;
-        ret = camera_->StartRecording();
-        
-        if (!ret) {
-            std::cerr << "Error: Failed to start recording." << std::endl;
+    // sends a GET (optionally for a byte range) and parses the response head.
+    // any body bytes that arrived with the headers are returned in body_prefix.
+    bool request(int fd, const std::string& remote_path, const std::string& range, int& status,
+                 std::map<std::string, std::string>& headers, std::string& body_prefix) const {
+        std::string req = "GET " + prefix_ + urlEncodePath(remote_path) + " HTTP/1.1\r\n";
+        req += "Host: " + host_ + "\r\n";
+        if (!range.empty()) {
+            req += "Range: bytes=" + range + "\r\n";
+        }
+        req += "Connection: close\r\n\r\n";
+        if (!writeAll(fd, req)) {
             return false;
         }
 
-        std::cout << "Recording started successfully!" << std::endl;
+        std::string data;
+        char buffer[4096];
+        size_t header_end;
+        while ((header_end = data.find("\r\n\r\n")) == std::string::npos) {
+            if (data.size() > 65536) {
+                return false;
+            }
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            data.append(buffer, static_cast<size_t>(n));
+        }
+        body_prefix = data.substr(header_end + 4);
+
+        std::istringstream head(data.substr(0, header_end));
+        std::string line;
+        std::getline(head, line);
+        if (line.compare(0, 5, "HTTP/") != 0 || line.find(' ') == std::string::npos) {
+            return false;
+        }
+        status = atoi(line.c_str() + line.find(' ') + 1);
+        while (std::getline(head, line)) {
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string key = line.substr(0, colon);
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+            size_t value_start = line.find_first_not_of(' ', colon + 1);
+            std::string value = value_start == std::string::npos ? "" : line.substr(value_start);
+            if (!value.empty() && value[value.size() - 1] == '\r') {
+                value.erase(value.size() - 1);
+            }
+            headers[key] = value;
+        }
         return true;
     }
 
-    bool stopRecording(const std::string& save_directory = "./") {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
+    // learns the file size and whether the server honours ranges by asking for the first byte
+    bool probe(const std::string& remote_path, int64_t& size, bool& ranges, std::string& error) const {
+        int fd = openConnection();
+        if (fd < 0) {
+            error = "cannot connect to " + host_ + ":" + port_;
             return false;
         }
-
-        // check if camera is still connected
-        if (!camera_->IsConnected()) {
-            std::cerr << "Error: Camera connection lost." << std::endl;
-            is_connected_ = false;
+        int status = 0;
+        std::map<std::string, std::string> headers;
+        std::string body;
+        bool ok = request(fd, remote_path, "0-0", status, headers, body);
+        close(fd);
+        if (!ok) {
+            error = "no valid HTTP response";
             return false;
         }
 
-        std::cout << "Stopping recording..." << std::endl;
-        const auto url = camera_->StopRecording();
-        
-        if (url.Empty()) {
-            std::cerr << "Error: Failed to stop recording or no video was recorded." << std::endl;
+        if (status == 206 && headers.count("content-range")) {
+            // Content-Range: bytes 0-0/12345
+            const std::string& content_range = headers["content-range"];
+            size_t slash = content_range.find('/');
+            size = slash == std::string::npos ? -1 : atoll(content_range.c_str() + slash + 1);
+            ranges = true;
+        } else if (status == 200 && headers.count("content-length")) {
+            size = atoll(headers["content-length"].c_str());
+            ranges = false;
+        } else {
+            error = "HTTP status " + std::to_string(status);
+            return false;
+        }
+        if (headers.count("transfer-encoding") || size < 0) {
+            error = "unsupported response encoding";
             return false;
         }
+        return true;
+    }
 
-        std::cout << "Recording stopped successfully!" << std::endl;
-        
-        // Prepare save directory
-        std::string save_path = save_directory;
-        if (!save_path.empty() && save_path.back() != '/' && save_path.back() != '\\') {
-            save_path += "/";
+    // fetches [start, start + length) into out_fd at the same offset. length < 0 means the whole file.
+    // committed counts the bytes of this range written so far and crc is extended over them
+    // as they are written (hash_ns accumulates the time that takes).
+    bool fetch(const std::string& remote_path, int out_fd, int64_t start, int64_t length,
+               std::atomic<int64_t>& committed, uint32_t& crc, std::atomic<int64_t>& hash_ns,
+               std::atomic<int64_t>& received, const std::atomic<bool>& abort, std::string& error) const {
+        int fd = openConnection();
+        if (fd < 0) {
+            error = "cannot connect to " + host_ + ":" + port_;
+            return false;
         }
-        
-        // Check if directory exists (if save directory is provided)
-        if (!save_directory.empty() && !fileExists(save_path)) {
-            std::cerr << "Warning: Save directory does not exist: " << save_path << std::endl;
-            std::cerr << "Video URL(s) saved on camera:" << std::endl;
-            if (url.IsSingleOrigin()) {
-                std::cout << "  " << url.GetSingleOrigin() << std::endl;
+        std::string range;
+        if (length >= 0) {
+            range = std::to_string(start) + "-" + std::to_string(start + length - 1);
+        }
+        int status = 0;
+        std::map<std::string, std::string> headers;
+        std::string body;
+        if (!request(fd, remote_path, range, status, headers, body)) {
+            close(fd);
+            error = "no valid HTTP response";
+            return false;
+        }
+        if (status != (range.empty() ? 200 : 206)) {
+            close(fd);
+            error = "HTTP status " + std::to_string(status);
+            return false;
+        }
+        int64_t expected = length >= 0 ? length : atoll(headers["content-length"].c_str());
+
+        int64_t offset = start;
+        int64_t remaining = expected;
+        std::vector<char> buffer(64 * 1024);
+        bool ok = true;
+        while (remaining > 0 && !abort) {
+            const char* data;
+            ssize_t n;
+            if (!body.empty()) {
+                data = body.data();
+                n = static_cast<ssize_t>(std::min<int64_t>(remaining, static_cast<int64_t>(body.size())));
             } else {
-                const auto& origins = url.OriginUrls();
-                for (size_t i = 0; i < origins.size(); i++) {
-                    std::cout << "  [" << i << "] " << origins[i] << std::endl;
+                n = recv(fd, buffer.data(), static_cast<size_t>(std::min<int64_t>(remaining, static_cast<int64_t>(buffer.size()))), 0);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    error = "stalled, nothing received for " + std::to_string(io_timeout_sec_) + " s";
+                    ok = false;
+                    break;
                 }
+                if (n <= 0) {
+                    error = n == 0 ? "connection closed early" : std::string("receive failed: ") + strerror(errno);
+                    ok = false;
+                    break;
+                }
+                data = buffer.data();
             }
-            return true;
+            if (pwrite(out_fd, data, static_cast<size_t>(n), offset) != n) {
+                error = std::string("write failed: ") + strerror(errno);
+                ok = false;
+                break;
+            }
+            const auto hash_start = std::chrono::steady_clock::now();
+            crc = crc32cUpdate(crc, data, static_cast<size_t>(n));
+            hash_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - hash_start).count();
+            if (!body.empty()) {
+                body.clear();
+            }
+            offset += n;
+            remaining -= n;
+            committed += n;
+            received += n;
         }
+        close(fd);
+        return ok && remaining == 0;
+    }
 
-        // Download video file(s) if save directory is provided
-        if (!save_directory.empty()) {
-            bool all_success = true;
-            
-            if (url.IsSingleOrigin()) {
-                const std::string video_url = url.GetSingleOrigin();
-                std::cout << "Video URL: " << video_url << std::endl;
-                
-                std::string file_name = getFileName(video_url);
-                if (file_name.empty()) {
-                    file_name = "video_" + getCurrentTime() + ".mp4";
+    // one range of the file and how much of it is safely on disk
+    struct Chunk {
+        int64_t start;
+        int64_t length;  // -1: whole file without a range request
+        int64_t done;
+    };
+
+    // sidecar format, rewritten atomically:
+    //   size <total bytes>
+    //   url <remote path>
+    //   chunk <start> <length> <bytes committed>   (one line per chunk)
+    static bool loadState(const std::string& state_path, const std::string& remote_path, int64_t size,
+                          std::vector<Chunk>& chunks) {
+        std::ifstream in(state_path);
+        if (!in) {
+            return false;
+        }
+        std::string key;
+        int64_t state_size = -1;
+        std::string state_url;
+        std::vector<Chunk> loaded;
+        while (in >> key) {
+            if (key == "size") {
+                in >> state_size;
+            } else if (key == "url") {
+                in >> state_url;
+            } else if (key == "chunk") {
+                Chunk chunk;
+                in >> chunk.start >> chunk.length >> chunk.done;
+                loaded.push_back(chunk);
+            } else {
+                return false;
+            }
+        }
+        // a different or rewritten file on the camera invalidates the partial download
+        if (state_size != size || state_url != remote_path || loaded.empty()) {
+            return false;
+        }
+        for (size_t i = 0; i < loaded.size(); i++) {
+            if (loaded[i].length < 0 || loaded[i].done < 0 || loaded[i].done > loaded[i].length) {
+                return false;
+            }
+        }
+        chunks = loaded;
+        return true;
+    }
+
+    static void saveState(const std::string& state_path, const std::string& remote_path, int64_t size,
+                          const std::vector<Chunk>& chunks) {
+        const std::string tmp_path = state_path + ".tmp";
+        {
+            std::ofstream out(tmp_path, std::ios::trunc);
+            if (!out) {
+                return;
+            }
+            out << "size " << size << "\nurl " << remote_path << "\n";
+            for (size_t i = 0; i < chunks.size(); i++) {
+                out << "chunk " << chunks[i].start << " " << chunks[i].length << " " << chunks[i].done << "\n";
+            }
+        }
+        rename(tmp_path.c_str(), state_path.c_str());
+    }
+
+public:
+    // base_url as returned by Camera::GetHttpBaseUrl(), e.g. "http://192.168.42.1:80"
+    HttpDownloader(const std::string& base_url, int connections, int io_timeout_sec)
+        : connections_(connections < 1 ? 1 : connections), io_timeout_sec_(io_timeout_sec < 0 ? 0 : io_timeout_sec) {
+        std::string rest = base_url;
+        if (rest.compare(0, 7, "http://") != 0) {
+            return;
+        }
+        rest = rest.substr(7);
+        size_t slash = rest.find('/');
+        std::string authority = rest.substr(0, slash);
+        prefix_ = slash == std::string::npos ? "" : rest.substr(slash);
+        while (!prefix_.empty() && prefix_[prefix_.size() - 1] == '/') {
+            prefix_.erase(prefix_.size() - 1);
+        }
+        size_t colon = authority.rfind(':');
+        host_ = authority.substr(0, colon);
+        port_ = colon == std::string::npos ? "80" : authority.substr(colon + 1);
+    }
+
+    bool valid() const {
+        return !host_.empty();
+    }
+
+    // size of a camera file without downloading it
+    bool remoteSize(const std::string& remote_path, int64_t& size) const {
+        bool ranges = false;
+        std::string error;
+        return probe(remote_path, size, ranges, error);
+    }
+
+    static std::string partPath(const std::string& local_path) {
+        return local_path + ".part";
+    }
+
+    static std::string statePath(const std::string& local_path) {
+        return local_path + ".part.state";
+    }
+
+    // downloads remote_path (as listed by the camera, e.g. "/DCIM/Camera01/VID_x.insv")
+    // to local_path. data lands in <local_path>.part and is renamed into place once
+    // complete; a sidecar records committed bytes so an interrupted transfer resumes
+    // where it stopped (resumed_from reports how much was reused). progress is called
+    // from this thread only. checksum is the CRC-32C of the bytes as they were written
+    // (reused bytes are read back once), checksum_ms the time spent hashing.
+    bool download(const std::string& remote_path, const std::string& local_path,
+                  const ins_camera::DownloadProgressCallBack& progress, int64_t& resumed_from,
+                  uint32_t& checksum, double& checksum_ms, std::string& error) const {
+        resumed_from = 0;
+        checksum = 0;
+        checksum_ms = 0.0;
+        int64_t size = 0;
+        bool ranges = false;
+        if (!probe(remote_path, size, ranges, error)) {
+            return false;
+        }
+
+        const std::string part_path = partPath(local_path);
+        const std::string state_path = statePath(local_path);
+
+        std::vector<Chunk> chunks;
+        bool resuming = ranges && fileExists(part_path) && getFileSize(part_path) == size &&
+                        loadState(state_path, remote_path, size, chunks);
+        if (!resuming) {
+            chunks.clear();
+            // split into chunks handed out to the connection threads in order
+            if (ranges && connections_ > 1 && size > HTTP_CHUNK_SIZE) {
+                for (int64_t offset = 0; offset < size; offset += HTTP_CHUNK_SIZE) {
+                    Chunk chunk = { offset, std::min(HTTP_CHUNK_SIZE, size - offset), 0 };
+                    chunks.push_back(chunk);
                 }
-                
-                std::string full_path = save_path + file_name;
-                std::cout << "Downloading video to: " << full_path << std::endl;
+            } else {
+                Chunk chunk = { 0, ranges ? size : static_cast<int64_t>(-1), 0 };
+                chunks.push_back(chunk);
+            }
+        }
 
-                int64_t last_progress = -1;
-                int64_t last_current = -1;
-                auto last_update_time = std::chrono::steady_clock::now();
-                int64_t total_size_known = 0;
-                
-                bool download_success = camera_->DownloadCameraFile(video_url, full_path,
-                    [&](int64_t current, int64_t total_size) {
-                        total_size_known = total_size;
-                        auto now = std::chrono::steady_clock::now();
-                        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_update_time).count();
-                        
-                        // Use floating-point for more accurate progress calculation
-                        double progress_double = total_size > 0 ? (static_cast<double>(current) * 100.0 / static_cast<double>(total_size)) : 0.0;
-                        int64_t progress = static_cast<int64_t>(progress_double);
-                        
-                        // Force 100% when current equals total_size (handle edge case)
-                        if (current >= total_size && total_size > 0) {
-                            progress = 100;
-                        }
-                        
-                        // Show progress if it changed, or if we're near completion
-                        if (progress != last_progress || (current != last_current && total_size > 0 && current >= total_size * 0.97)) {
-                            if (total_size > 0) {
-                                std::cout << "\rDownload progress: " << progress << "% (" 
-                                         << formatBytes(current) << " / " << formatBytes(total_size) << ")" << std::flush;
-                            } else {
-                                std::cout << "\rDownload progress: " << formatBytes(current) << " downloaded" << std::flush;
-                            }
-                            last_progress = progress;
-                            last_current = current;
-                            last_update_time = now;
-                        }
-                        
-                        // Timeout detection: if no progress for 30 seconds, warn
-                        if (elapsed > 30 && current == last_current && current < total_size) {
-                            std::cout << "\nWarning: Download appears stalled at " << progress << "%" << std::endl;
-                            std::cout << "Continuing to wait..." << std::flush;
+        if (!resuming && size > 0) {
+            const int64_t space = spaceForDownloads(part_path);
+            if (space >= 0 && size > space) {
+                error = "out of space: " + formatBytes(size) + " needed, " + formatBytes(space) + " free";
+                return false;
+            }
+        }
+
+        int out_fd = open(part_path.c_str(), O_RDWR | O_CREAT | (resuming ? 0 : O_TRUNC), 0644);
+        if (out_fd < 0) {
+            error = "cannot create " + part_path + ": " + strerror(errno);
+            return false;
+        }
+        // allocate the whole file up front: the range writers don't fragment it on an
+        // SD card, and a full disk fails here rather than part way through
+        if (!resuming && size > 0) {
+            const int rc = posix_fallocate(out_fd, 0, size);
+            if (rc == ENOSPC) {
+                error = "out of space: cannot allocate " + formatBytes(size);
+                close(out_fd);
+                unlink(part_path.c_str());
+                return false;
+            }
+            if (rc != 0 && ftruncate(out_fd, size) != 0) {
+                error = std::string("cannot size file: ") + strerror(errno);
+                close(out_fd);
+                return false;
+            }
+        }
+
+        std::unique_ptr<std::atomic<int64_t>[]> done(new std::atomic<int64_t>[chunks.size()]);
+        std::vector<uint32_t> crcs(chunks.size(), 0);
+        std::atomic<int64_t> hash_ns(0);
+        int64_t already = 0;
+        const auto rehash_start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < chunks.size(); i++) {
+            done[i] = chunks[i].done;
+            already += chunks[i].done;
+            // bytes from an earlier attempt were hashed by a process we no longer have
+            if (chunks[i].done > 0 && !crc32cRange(out_fd, chunks[i].start, chunks[i].done, crcs[i])) {
+                error = "cannot read back " + part_path + ": " + strerror(errno);
+                close(out_fd);
+                return false;
+            }
+        }
+        hash_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - rehash_start).count();
+        resumed_from = resuming ? already : 0;
+        if (ranges) {
+            saveState(state_path, remote_path, size, chunks);
+        }
+
+        std::atomic<int64_t> received(already);
+        std::atomic<bool> abort(false);
+        std::atomic<size_t> next_chunk(0);
+        std::mutex error_mutex;
+        std::vector<std::thread> workers;
+        const size_t thread_count = std::min(chunks.size(), static_cast<size_t>(connections_));
+        for (size_t t = 0; t < thread_count; t++) {
+            workers.push_back(std::thread([&] {
+                size_t index;
+                while (!abort && (index = next_chunk++) < chunks.size()) {
+                    const Chunk& chunk = chunks[index];
+                    if (chunk.length >= 0 && done[index] >= chunk.length) {
+                        continue;
+                    }
+                    std::string chunk_error;
+                    const int64_t resume_at = chunk.start + done[index];
+                    const int64_t length = chunk.length < 0 ? -1 : chunk.length - done[index];
+                    if (!fetch(remote_path, out_fd, resume_at, length, done[index], crcs[index], hash_ns,
+                               received, abort, chunk_error)) {
+                        std::lock_guard<std::mutex> lock(error_mutex);
+                        if (!abort) {
+                            error = chunk_error;
                         }
-                    });
-                
-                // Explicitly show 100% if download succeeded (handles case where SDK doesn't call callback at 100%)
-                if (download_success) {
-                    if (total_size_known > 0) {
-                        std::cout << "\rDownload progress: 100% (" << formatBytes(total_size_known) 
-                                 << " / " << formatBytes(total_size_known) << ")" << std::flush;
-                    } else {
-                        std::cout << "\rDownload progress: 100%" << std::flush;
+                        abort = true;
                     }
                 }
-                std::cout << std::endl;
-                
-                if (download_success) {
-                    // Verify file was actually written
-                    int64_t file_size = getFileSize(full_path);
-                    if (file_size < 0) {
-                        std::cerr << "Error: Download reported success but file does not exist: " << full_path << std::endl;
-                        all_success = false;
-                    } else if (file_size == 0) {
-                        std::cerr << "Error: Download reported success but file is empty: " << full_path << std::endl;
-                        all_success = false;
-                    } else {
-                        if (total_size_known > 0 && file_size != total_size_known) {
-                            std::cerr << "Warning: File size mismatch. Expected: " << formatBytes(total_size_known) 
-                                     << ", Got: " << formatBytes(file_size) << std::endl;
-                        }
-                        std::cout << "Video successfully downloaded to: " << full_path 
-                                 << " (" << formatBytes(file_size) << ")" << std::endl;
-                    }
-                } else {
-                    std::cerr << "Error: Failed to download video." << std::endl;
-                    std::cerr << "Video URL on camera: " << video_url << std::endl;
-                    all_success = false;
+            }));
+        }
+
+        // report progress from the calling thread like the SDK does, and
+        // checkpoint committed bytes (data first, then the sidecar) now and then
+        std::atomic<bool> finished(false);
+        std::thread joiner([&] {
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
+            }
+            finished = true;
+        });
+        int64_t last_reported = -1;
+        auto last_checkpoint = std::chrono::steady_clock::now();
+        while (true) {
+            const bool is_done = finished;
+            const int64_t current = received;
+            if (progress && current != last_reported) {
+                progress(current, size);
+                last_reported = current;
+            }
+            if (ranges && (is_done || elapsedMs(last_checkpoint) > 2000)) {
+                // snapshot the counters before syncing so the sidecar never claims unsynced data
+                std::vector<Chunk> snapshot = chunks;
+                for (size_t i = 0; i < snapshot.size(); i++) {
+                    snapshot[i].done = done[i];
+                }
+                if (fdatasync(out_fd) == 0) {
+                    saveState(state_path, remote_path, size, snapshot);
+                }
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
+            if (is_done) {
+                break;
+            }
+            usleep(100 * 1000);
+        }
+        joiner.join();
+        if (progress && received != last_reported) {
+            progress(received, size);
+        }
+
+        const bool ok = !abort && received == size;
+        if (close(out_fd) != 0 && ok) {
+            error = std::string("close failed: ") + strerror(errno);
+            return false;
+        }
+        if (!ok) {
+            if (error.empty()) {
+                error = "incomplete transfer";
+            }
+            if (!ranges) {
+                // nothing to resume from without range support
+                unlink(part_path.c_str());
+            }
+            return false;
+        }
+        if (rename(part_path.c_str(), local_path.c_str()) != 0) {
+            error = "cannot rename " + part_path + ": " + strerror(errno);
+            return false;
+        }
+        unlink(state_path.c_str());
+
+        const auto combine_start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < chunks.size(); i++) {
+            checksum = i == 0 ? crcs[0] : crc32cCombine(checksum, crcs[i], done[i]);
+        }
+        checksum_ms = hash_ns / 1e6 + elapsedMs(combine_start);
+        return true;
+    }
+
+    // bytes of a previous interrupted download that a retry would not need to fetch again
+    static int64_t resumableBytes(const std::string& local_path) {
+        std::ifstream in(statePath(local_path));
+        std::string key;
+        int64_t total = 0;
+        while (in >> key) {
+            if (key == "chunk") {
+                int64_t start, length, done;
+                in >> start >> length >> done;
+                total += done;
+            } else {
+                std::string value;
+                in >> value;
+            }
+        }
+        return total;
+    }
+};
+
+// outcome of downloading and verifying one camera file
+struct DownloadResult {
+    bool success;
+    int64_t expected_size;  // size the transfer reported, 0 if unknown
+    int64_t file_size;
+    std::string error;    // why it failed
+    std::string warning;  // non-fatal problems, e.g. a size mismatch
+    bool has_checksum;    // checksum is known (streamed during the transfer or read back)
+    uint32_t checksum;    // CRC-32C of the file
+    double checksum_ms;   // time spent hashing
+    int retries;          // attempts after the first one
+};
+
+const int DEFAULT_HTTP_CONNECTIONS = 4;
+// immediate resume attempts after an HTTP transfer drops, as long as each one makes progress
+const int HTTP_RESUME_ATTEMPTS = 3;
+// retries after a stalled or interrupted download, waiting 1 s, 2 s, 4 s ... in between
+const int DOWNLOAD_RETRIES = 3;
+const int DOWNLOAD_RETRY_BACKOFF_MS = 1000;
+
+// files that may sit between download, verification and deletion in copy-storage
+const size_t COPY_PIPELINE_WINDOW = 2;
+// copy-storage syncs verified files to disk in groups of this many files or bytes,
+// whichever comes first, so the SD card sees one journal and directory flush per group
+const size_t JOURNAL_GROUP_FILES = 8;
+const int64_t JOURNAL_GROUP_BYTES = 256LL * 1024LL * 1024LL;
+
+// photos waiting for the background downloader; captures block once this many are queued
+const size_t MAX_PENDING_DOWNLOADS = 8;
+// suffix of group members that are on disk while the rest of their group isn't
+const char* const INCOMPLETE_SUFFIX = ".incomplete";
+
+// background priority of full-resolution video behind a preview, so photos queued later still go first
+const int ORIGIN_DOWNLOAD_PRIORITY = -1;
+
+// the camera keeps time in whole seconds, so anything tighter than this just adds sync round-trips
+const int64_t DEFAULT_TIME_SYNC_THRESHOLD_MS = 2000;
+
+// turns download progress callbacks into a progress line with throughput and ETA.
+// a callback only updates counters unless the percentage changed and the line is
+// due for a redraw, so chatty SDK callbacks (one per 64 KB) stay cheap.
+class ProgressReporter {
+private:
+    std::ostream* out_;  // nullptr: count only, draw nothing
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point last_draw_;
+    std::atomic<int64_t> current_;
+    std::atomic<int64_t> total_;
+    int64_t first_;  // bytes already there when this attempt started (resumed transfers)
+    int64_t last_percent_;
+
+    static const int REDRAW_INTERVAL_MS = 200;
+
+    void draw() {
+        const int64_t current = current_;
+        const int64_t total = total_;
+        std::ostream& out = *out_;
+        out << "\rDownload progress: ";
+        if (total > 0) {
+            out << (current >= total ? 100 : current * 100 / total) << "% ("
+                << formatBytes(current) << " / " << formatBytes(total);
+        } else {
+            out << "(" << formatBytes(current) << " downloaded";
+        }
+        const double rate = bytesPerSecond();
+        if (rate > 0) {
+            out << ", " << formatBytes(static_cast<int64_t>(rate)) << "/s";
+            const double eta = etaSeconds();
+            if (eta >= 0 && current < total) {
+                out << ", ETA " << static_cast<int64_t>(eta + 0.5) << " s";
+            }
+        }
+        out << ")   " << std::flush;
+        last_draw_ = std::chrono::steady_clock::now();
+    }
+
+public:
+    explicit ProgressReporter(std::ostream* out) : out_(out) {
+        reset();
+    }
+
+    // starts a new attempt: throughput is measured from here on
+    void reset() {
+        start_ = std::chrono::steady_clock::now();
+        last_draw_ = std::chrono::steady_clock::time_point();
+        current_ = 0;
+        total_ = 0;
+        first_ = -1;
+        last_percent_ = -1;
+    }
+
+    void update(int64_t current, int64_t total) {
+        current_ = current;
+        total_ = total;
+        if (first_ < 0) {
+            first_ = current;
+        }
+        if (!out_ || (current <= 0 && total <= 0)) {
+            return;
+        }
+        const int64_t percent = total > 0 ? (current >= total ? 100 : current * 100 / total) : current >> 20;
+        if (percent == last_percent_) {
+            return;
+        }
+        if (percent < 100 && elapsedMs(last_draw_) < REDRAW_INTERVAL_MS) {
+            return;
+        }
+        last_percent_ = percent;
+        draw();
+    }
+
+    // ends the line; a successful transfer is shown at 100% even if the last callback wasn't
+    void finish(bool success) {
+        if (!out_) {
+            return;
+        }
+        if (success && last_percent_ != 100) {
+            if (total_ > 0) {
+                current_ = static_cast<int64_t>(total_);
+            }
+            draw();
+        }
+        *out_ << std::endl;
+    }
+
+    int64_t current() const {
+        return current_;
+    }
+
+    int64_t total() const {
+        return total_;
+    }
+
+    // average rate of this attempt, 0 until there is something to measure
+    double bytesPerSecond() const {
+        const double seconds = elapsedMs(start_) / 1000.0;
+        const int64_t moved = current_ - (first_ < 0 ? 0 : first_);
+        return seconds > 0.05 && moved > 0 ? moved / seconds : 0.0;
+    }
+
+    // seconds left at the current rate, -1 if unknown
+    double etaSeconds() const {
+        const double rate = bytesPerSecond();
+        if (rate <= 0 || total_ <= 0) {
+            return -1;
+        }
+        return static_cast<double>(total_ - current_) / rate;
+    }
+};
+
+// what kind of camera file a path is, judged by its extension
+enum FileKind {
+    FILE_PHOTO,  // .insp, .jpg, .dng
+    FILE_PROXY,  // .lrv low-resolution preview of a video
+    FILE_VIDEO,  // .insv, .mp4
+    FILE_OTHER
+};
+
+// lower-case extension without the dot, empty if there is none
+std::string fileExtension(const std::string& path) {
+    const std::string name = getFileName(path);
+    const size_t dot = name.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+FileKind fileKind(const std::string& path) {
+    const std::string ext = fileExtension(path);
+    if (ext == "insp" || ext == "jpg" || ext == "jpeg" || ext == "dng") {
+        return FILE_PHOTO;
+    }
+    if (ext == "lrv") {
+        return FILE_PROXY;
+    }
+    if (ext == "insv" || ext == "mp4") {
+        return FILE_VIDEO;
+    }
+    return FILE_OTHER;
+}
+
+// capture time from a camera file name such as VID_20250101_120000_00_001.insv,
+// as a sortable "YYYYMMDDHHMMSS" string (empty if the name has none)
+std::string captureTimeKey(const std::string& path) {
+    const std::string name = getFileName(path);
+    for (size_t i = 0; i + 15 <= name.size(); i++) {
+        bool match = name[i + 8] == '_';
+        for (size_t k = 0; k < 15 && match; k++) {
+            match = k == 8 || isdigit(static_cast<unsigned char>(name[i + k]));
+        }
+        if (match) {
+            return name.substr(i, 8) + name.substr(i + 9, 6);
+        }
+    }
+    return std::string();
+}
+
+// order in which copy-storage fetches files. all policies are stable, so files
+// they consider equal stay in the camera's listing order.
+enum SchedulePolicy {
+    SCHEDULE_LISTING,         // as GetCameraFilesList() returns them
+    SCHEDULE_PHOTOS_FIRST,    // photos, then everything else
+    SCHEDULE_SMALLEST_FIRST,  // by size (HTTP server), else photos, proxies, videos
+    SCHEDULE_NEWEST_FIRST,    // by capture time in the file name
+    SCHEDULE_LRV_FIRST        // .lrv proxies before everything else
+};
+
+const SchedulePolicy DEFAULT_SCHEDULE_POLICY = SCHEDULE_PHOTOS_FIRST;
+
+const char* const SCHEDULE_POLICY_NAMES[] = { "listing", "photos-first", "smallest-first", "newest-first", "lrv-first" };
+
+bool parseSchedulePolicy(const std::string& name, SchedulePolicy& policy) {
+    for (size_t i = 0; i < sizeof(SCHEDULE_POLICY_NAMES) / sizeof(SCHEDULE_POLICY_NAMES[0]); i++) {
+        if (name == SCHEDULE_POLICY_NAMES[i]) {
+            policy = static_cast<SchedulePolicy>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// reorders urls by policy. sizes (remote url -> bytes) is only used by smallest-first
+// and may be incomplete; files without a size go after those with one.
+void scheduleTransfers(std::vector<std::string>& urls, SchedulePolicy policy,
+                       const std::map<std::string, int64_t>& sizes) {
+    std::function<bool(const std::string&, const std::string&)> before;
+    switch (policy) {
+        case SCHEDULE_LISTING:
+            return;
+        case SCHEDULE_PHOTOS_FIRST:
+            before = [](const std::string& a, const std::string& b) {
+                return fileKind(a) == FILE_PHOTO && fileKind(b) != FILE_PHOTO;
+            };
+            break;
+        case SCHEDULE_LRV_FIRST:
+            before = [](const std::string& a, const std::string& b) {
+                return fileKind(a) == FILE_PROXY && fileKind(b) != FILE_PROXY;
+            };
+            break;
+        case SCHEDULE_NEWEST_FIRST:
+            before = [](const std::string& a, const std::string& b) {
+                return captureTimeKey(a) > captureTimeKey(b);
+            };
+            break;
+        case SCHEDULE_SMALLEST_FIRST:
+            before = [&sizes](const std::string& a, const std::string& b) {
+                std::map<std::string, int64_t>::const_iterator size_a = sizes.find(a);
+                std::map<std::string, int64_t>::const_iterator size_b = sizes.find(b);
+                if (size_a != sizes.end() && size_b != sizes.end()) {
+                    return size_a->second < size_b->second;
+                }
+                if (size_a != sizes.end() || size_b != sizes.end()) {
+                    return size_a != sizes.end();
+                }
+                return fileKind(a) < fileKind(b);
+            };
+            break;
+    }
+    std::stable_sort(urls.begin(), urls.end(), before);
+}
+
+// which camera files copy-storage takes. applied to the listing before anything
+// is transferred; an empty/negative field does not filter.
+struct TransferFilter {
+    std::set<std::string> extensions;  // lower-case, without the dot
+    std::string since;                 // capture time bounds as "YYYYMMDDHHMMSS", inclusive
+    std::string until;
+    int64_t max_size;                  // bytes
+
+    TransferFilter() : max_size(-1) {}
+
+    bool active() const {
+        return !extensions.empty() || !since.empty() || !until.empty() || max_size >= 0;
+    }
+
+    // the filters that only need the file name (extension and capture time).
+    // a file without a capture time in its name never passes --since/--until.
+    bool matchesName(const std::string& url) const {
+        if (!extensions.empty() && !extensions.count(fileExtension(url))) {
+            return false;
+        }
+        if (!since.empty() || !until.empty()) {
+            const std::string key = captureTimeKey(url);
+            if (key.empty() || (!since.empty() && key < since) || (!until.empty() && key > until)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // all filters; a file without a known size never passes --max-size
+    bool matches(const std::string& url, const std::map<std::string, int64_t>& sizes) const {
+        if (!matchesName(url)) {
+            return false;
+        }
+        if (max_size >= 0) {
+            std::map<std::string, int64_t>::const_iterator size = sizes.find(url);
+            if (size == sizes.end() || size->second > max_size) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string describe() const {
+        std::string text;
+        if (!extensions.empty()) {
+            text += " ext=";
+            for (std::set<std::string>::const_iterator it = extensions.begin(); it != extensions.end(); ++it) {
+                text += (it == extensions.begin() ? "" : ",") + *it;
+            }
+        }
+        if (!since.empty()) {
+            text += " since=" + since;
+        }
+        if (!until.empty()) {
+            text += " until=" + until;
+        }
+        if (max_size >= 0) {
+            text += " max-size=" + formatBytes(max_size);
+        }
+        return text.empty() ? text : text.substr(1);
+    }
+};
+
+// "insp,.INSV" -> {insp, insv}
+bool parseExtensionList(const std::string& text, std::set<std::string>& extensions) {
+    std::stringstream ss(text);
+    std::string ext;
+    while (std::getline(ss, ext, ',')) {
+        if (!ext.empty() && ext[0] == '.') {
+            ext.erase(0, 1);
+        }
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (!ext.empty()) {
+            extensions.insert(ext);
+        }
+    }
+    return !extensions.empty();
+}
+
+// a --since/--until value as a "YYYYMMDDHHMMSS" key comparable with captureTimeKey().
+// takes an absolute local time (20250101, 20250101_1200, 2025-01-01T12:00:00, ...;
+// missing fields are the start of the period for --since and its end for --until)
+// or an age relative to now (90s, 30m, 1h, 2d).
+bool parseTimeBound(const std::string& text, bool upper, std::string& key) {
+    if (text.size() >= 2 && isdigit(static_cast<unsigned char>(text[0])) &&
+        std::string("smhd").find(text.back()) != std::string::npos) {
+        char* end = nullptr;
+        const long long amount = strtoll(text.c_str(), &end, 10);
+        if (end != text.c_str() + text.size() - 1) {
+            return false;
+        }
+        const long long unit = text.back() == 's' ? 1 : text.back() == 'm' ? 60 : text.back() == 'h' ? 3600 : 86400;
+        const time_t when = time(nullptr) - static_cast<time_t>(amount * unit);
+        std::tm tm{};
+        localtime_r(&when, &tm);
+        char buffer[16];
+        strftime(buffer, sizeof(buffer), "%Y%m%d%H%M%S", &tm);
+        key = buffer;
+        return true;
+    }
+    std::string digits;
+    for (size_t i = 0; i < text.size(); i++) {
+        const char c = text[i];
+        if (isdigit(static_cast<unsigned char>(c))) {
+            digits += c;
+        } else if (c != '_' && c != '-' && c != ':' && c != 'T') {
+            return false;
+        }
+    }
+    if (digits.size() != 8 && digits.size() != 10 && digits.size() != 12 && digits.size() != 14) {
+        return false;
+    }
+    key = digits + std::string(upper ? "235959" : "000000").substr(digits.size() - 8);
+    return true;
+}
+
+// "500M", "2G", "1.5G", "4096" (binary units) -> bytes
+bool parseByteSize(const std::string& text, int64_t& bytes) {
+    char* end = nullptr;
+    const double value = strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0) {
+        return false;
+    }
+    const std::string suffix = end;
+    double scale = 1.0;
+    if (suffix == "K" || suffix == "k" || suffix == "KB") {
+        scale = 1024.0;
+    } else if (suffix == "M" || suffix == "MB") {
+        scale = 1024.0 * 1024.0;
+    } else if (suffix == "G" || suffix == "GB") {
+        scale = 1024.0 * 1024.0 * 1024.0;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    bytes = static_cast<int64_t>(value * scale);
+    return true;
+}
+
+// one file to fetch from the camera
+struct TransferJob {
+    std::string remote_url;
+    std::string local_path;
+    int priority;  // higher runs first, equal priorities keep their order
+};
+
+// every download from the camera goes through here: the HTTP/SDK transfer with
+// stall retries, progress and throughput accounting, verification, and the
+// background queue used for photos in interactive and daemon mode.
+class TransferEngine {
+private:
+    PhaseTracer& tracer_;
+    std::shared_ptr<ins_camera::Camera> camera_;
+    // parallel HTTP downloads from the camera's file server, 0 = always use the SDK
+    std::string http_base_url_;
+    std::atomic<int> http_connections_;  // a daemon changes these per command while the worker runs
+    std::atomic<int> stall_timeout_sec_;
+    std::mutex sdk_download_mutex_;
+
+    // background queue: enqueue() returns at once, a worker thread drains it
+    std::mutex mutex_;
+    std::condition_variable work_cv_;  // signals the worker: work queued or stop
+    std::condition_variable done_cv_;  // signals producers: queue space freed or job finished
+    std::deque<TransferJob> queue_;
+    bool active_;
+    bool stop_;
+    std::thread worker_;
+    int completed_;
+    std::vector<std::string> failed_;
+    ProgressReporter background_progress_;  // the background job in flight
+
+    // session totals for stats
+    std::atomic<int64_t> files_transferred_;
+    std::atomic<int64_t> bytes_transferred_;
+    std::atomic<int64_t> transfer_us_;
+
+    void worker() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;
+            }
+            TransferJob job = queue_.front();
+            queue_.pop_front();
+            active_ = true;
+            done_cv_.notify_all();
+            lock.unlock();
+
+            const auto start = std::chrono::steady_clock::now();
+            DownloadResult result = download(job.remote_url, job.local_path, false);
+            const double ms = elapsedMs(start);
+
+            lock.lock();
+            active_ = false;
+            std::ostringstream line;
+            line << std::fixed << std::setprecision(1);
+            if (result.success) {
+                completed_++;
+                line << "[download] Saved " << job.local_path << " (" << formatBytes(result.file_size)
+                     << ", " << ms << " ms)";
+                if (!result.warning.empty()) {
+                    line << " - " << result.warning;
+                }
+            } else {
+                failed_.push_back(job.remote_url);
+                line << "[download] Error: " << result.error << " (file remains on camera)";
+            }
+            line << ", " << queue_.size() << " pending";
+            backgroundLog(line.str());
+            done_cv_.notify_all();
+        }
+    }
+
+public:
+    explicit TransferEngine(PhaseTracer& tracer)
+        : tracer_(tracer), http_connections_(DEFAULT_HTTP_CONNECTIONS), stall_timeout_sec_(DEFAULT_STALL_TIMEOUT_SEC),
+          active_(false), stop_(false), completed_(0), background_progress_(nullptr), files_transferred_(0),
+          bytes_transferred_(0), transfer_us_(0) {}
+
+    ~TransferEngine() {
+        detach();
+    }
+
+    // called after Open(): downloads go to this camera
+    void attach(const std::shared_ptr<ins_camera::Camera>& camera, const std::string& http_base_url) {
+        camera_ = camera;
+        http_base_url_ = http_base_url;
+    }
+
+    // finishes queued downloads and stops the worker before the camera goes away
+    void detach() {
+        waitIdle();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+        camera_.reset();
+    }
+
+    // connections per file for HTTP downloads, 0 disables the HTTP path
+    void setHttpConnections(int connections) {
+        http_connections_ = connections < 0 ? 0 : connections;
+    }
+
+    int httpConnections() const {
+        return http_connections_;
+    }
+
+    // 0 never gives up on a download that stopped making progress
+    void setStallTimeout(int seconds) {
+        stall_timeout_sec_ = seconds < 0 ? 0 : seconds;
+    }
+
+    int stallTimeout() const {
+        return stall_timeout_sec_;
+    }
+
+    // moves one file from the camera to full_path without verifying it. foreground
+    // transfers print progress and are traced as part of the current command,
+    // background ones are silent and only count towards session stats.
+    DownloadResult transfer(const std::string& remote_url, const std::string& full_path, bool foreground) {
+        ProgressReporter foreground_progress(&std::cout);
+        return transferWith(remote_url, full_path, foreground ? foreground_progress : background_progress_,
+                            foreground ? &std::cout : nullptr, foreground, http_connections_);
+    }
+
+    // the transfer itself. progress gets the callbacks, log (if set) retry and resume
+    // notes; traced phases count towards the current command when foreground is set.
+    DownloadResult transferWith(const std::string& remote_url, const std::string& full_path, ProgressReporter& progress,
+                                std::ostream* log, bool foreground, int connections) {
+        DownloadResult result;
+        result.success = false;
+        result.expected_size = 0;
+        result.file_size = -1;
+        result.has_checksum = false;
+        result.checksum = 0;
+        result.checksum_ms = 0.0;
+        result.retries = 0;
+
+        progress.reset();
+        const auto start = std::chrono::steady_clock::now();
+
+        // set while an SDK download runs, so progress callbacks keep it from firing
+        StallWatchdog* watchdog = nullptr;
+        int64_t bytes_seen = 0;
+        // the SDK only tells the size in its first callback, so free space is checked
+        // there (the HTTP path checks before it allocates the file)
+        bool check_space = false;
+        std::string space_error;
+
+        ins_camera::DownloadProgressCallBack on_progress =
+            [&](int64_t current, int64_t total_size) {
+                if (check_space && total_size > 0) {
+                    check_space = false;
+                    const int64_t space = spaceForDownloads(full_path);
+                    if (space >= 0 && total_size - current > space) {
+                        space_error = "out of space: " + formatBytes(total_size) + " needed, " +
+                                      formatBytes(space) + " free";
+                        camera_->CancelDownload();
+                    }
+                }
+                if (current > bytes_seen) {
+                    bytes_seen = current;
+                    if (watchdog) {
+                        watchdog->kick();
+                    }
+                }
+                progress.update(current, total_size);
+            };
+
+        // a stalled or interrupted attempt is retried with backoff; the HTTP path picks up
+        // its .part file where it stopped, the SDK has to start over
+        bool download_success = false;
+        for (int attempt = 0; ; attempt++) {
+            bytes_seen = 0;
+            bool stalled = false;
+            // the HTTP transfer stalled with a checkpoint to resume from: skip the SDK this time
+            bool resume_http = false;
+            // prefer the camera's HTTP server (parallel range requests, resumable), fall back to the SDK
+            if (connections > 0 && !http_base_url_.empty()) {
+                HttpDownloader http(http_base_url_, connections, stall_timeout_sec_);
+                if (http.valid()) {
+                    std::string http_error;
+                    ScopedPhase http_phase(tracer_, "HttpDownload", !foreground);
+                    // a dropped connection leaves a resumable .part, so retry straight away while each attempt gets further
+                    for (int resume = 0; resume < HTTP_RESUME_ATTEMPTS && !download_success; resume++) {
+                        const int64_t committed_before = HttpDownloader::resumableBytes(full_path);
+                        int64_t resumed_from = 0;
+                        http_error.clear();
+                        download_success = http.download(remote_url, full_path, on_progress, resumed_from,
+                                                         result.checksum, result.checksum_ms, http_error);
+                        result.has_checksum = download_success;
+                        if (resumed_from > 0 && log) {
+                            *log << "\nResumed partial download at " << formatBytes(resumed_from) << std::endl;
+                        }
+                        if (download_success || HttpDownloader::resumableBytes(full_path) <= committed_before) {
+                            break;
+                        }
+                    }
+                    http_phase.end();
+                    if (!download_success && http_error.compare(0, 12, "out of space") == 0) {
+                        // the SDK would run into the same full disk
+                        space_error = http_error;
+                        break;
+                    }
+                    if (!download_success) {
+                        stalled = http_error.compare(0, 7, "stalled") == 0;
+                        // the SDK would start over from the first byte, so it only takes over when the
+                        // server can't resume (no ranges, no checkpoint) or the retries are used up
+                        resume_http = stalled && attempt < DOWNLOAD_RETRIES &&
+                                      fileExists(HttpDownloader::statePath(full_path));
+                        if (!resume_http) {
+                            result.warning = "HTTP download failed (" + http_error + "), used camera SDK instead";
+                            if (log) {
+                                *log << std::endl;
+                            }
+                            progress.reset();
+                        }
+                    }
+                }
+            }
+            if (!download_success && !resume_http) {
+                // the SDK can't resume, so it gets its own scratch file and leaves any HTTP .part alone
+                const std::string sdk_part_path = full_path + ".sdk.part";
+                ScopedPhase download_phase(tracer_, "DownloadCameraFile", !foreground);
+                {
+                    // one SDK download at a time: CancelDownload() can't say which one it means
+                    std::lock_guard<std::mutex> sdk_lock(sdk_download_mutex_);
+                    StallWatchdog sdk_watchdog(stall_timeout_sec_ * 1000LL, [this] { camera_->CancelDownload(); });
+                    watchdog = &sdk_watchdog;
+                    check_space = true;
+                    download_success = camera_->DownloadCameraFile(remote_url, sdk_part_path, on_progress);
+                    check_space = false;
+                    watchdog = nullptr;
+                    stalled = stalled || sdk_watchdog.fired();
+                }
+                download_phase.end();
+                if (download_success && rename(sdk_part_path.c_str(), full_path.c_str()) == 0) {
+                    unlink(HttpDownloader::partPath(full_path).c_str());
+                    unlink(HttpDownloader::statePath(full_path).c_str());
+                } else {
+                    download_success = false;
+                    unlink(sdk_part_path.c_str());
+                }
+            }
+
+            if (download_success || !space_error.empty() || attempt >= DOWNLOAD_RETRIES ||
+                !(stalled || bytes_seen > 0)) {
+                break;
+            }
+            // back off before trying again, the camera or the link may need a moment
+            const int backoff_ms = DOWNLOAD_RETRY_BACKOFF_MS << attempt;
+            if (log) {
+                *log << std::endl << (stalled ? "Download stalled" : "Download interrupted")
+                     << ", retrying in " << backoff_ms / 1000.0 << " s (retry " << (attempt + 1)
+                     << "/" << DOWNLOAD_RETRIES << ")" << std::endl;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+            result.retries++;
+            progress.reset();
+        }
+        if (result.retries > 0) {
+            result.warning += std::string(result.warning.empty() ? "" : "; ") + "needed " +
+                              std::to_string(result.retries) + " retr" + (result.retries == 1 ? "y" : "ies");
+        }
+
+        progress.finish(download_success);
+
+        if (!space_error.empty()) {
+            result.error = "Not enough space for " + remote_url + " (" + space_error + ")";
+            return result;
+        }
+        if (!download_success) {
+            result.error = "Failed to download: " + remote_url;
+            return result;
+        }
+        result.expected_size = progress.total();
+        result.success = true;
+        files_transferred_++;
+        bytes_transferred_ += progress.total();
+        transfer_us_ += static_cast<int64_t>(elapsedMs(start) * 1000.0);
+        return result;
+    }
+
+    // checks that a transferred file actually landed on disk. a checksum taken while the
+    // file was written is compared against a second read of the file. strict (used before
+    // deleting from the camera) also fails on a size mismatch and always reads the checksum.
+    // safe to call from a pipeline thread.
+    void verify(const std::string& full_path, DownloadResult& result, bool foreground, bool strict = false) {
+        result.success = false;
+
+        // Verify file was actually written
+        ScopedPhase verify_phase(tracer_, "verify", !foreground);
+        result.file_size = getFileSize(full_path);
+        verify_phase.end();
+        if (result.file_size < 0) {
+            result.error = "Download reported success but file does not exist: " + full_path;
+            return;
+        }
+        if (result.file_size == 0) {
+            result.error = "Download reported success but file is empty: " + full_path;
+            return;
+        }
+        if (result.expected_size > 0 && result.file_size != result.expected_size) {
+            const std::string mismatch = "File size mismatch. Expected: " + formatBytes(result.expected_size) +
+                                         ", Got: " + formatBytes(result.file_size);
+            if (strict) {
+                result.error = mismatch + " (" + full_path + ")";
+                return;
+            }
+            // Still consider it success if file exists and has data
+            result.warning += std::string(result.warning.empty() ? "" : "; ") + mismatch;
+        }
+        if (result.has_checksum || strict) {
+            ScopedPhase checksum_phase(tracer_, "checksum", !foreground);
+            const auto start = std::chrono::steady_clock::now();
+            uint32_t on_disk = 0;
+            const bool read_ok = crc32cFile(full_path, on_disk);
+            result.checksum_ms += elapsedMs(start);
+            checksum_phase.end();
+            if (!read_ok) {
+                result.error = "Cannot read back " + full_path + ": " + strerror(errno);
+                return;
+            }
+            if (result.has_checksum && on_disk != result.checksum) {
+                char detail[64];
+                snprintf(detail, sizeof(detail), " (written %08x, on disk %08x)", result.checksum, on_disk);
+                result.error = "Checksum mismatch: " + full_path + detail;
+                return;
+            }
+            result.has_checksum = true;
+            result.checksum = on_disk;
+        }
+        result.success = true;
+    }
+
+    DownloadResult download(const std::string& remote_url, const std::string& full_path, bool foreground) {
+        DownloadResult result = transfer(remote_url, full_path, foreground);
+        if (result.success) {
+            verify(full_path, result, foreground);
+        }
+        return result;
+    }
+
+    // hands a file to the background worker. blocks while MAX_PENDING_DOWNLOADS are queued
+    void enqueue(const TransferJob& job) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.size() >= MAX_PENDING_DOWNLOADS) {
+            std::cout << "Download queue full (" << queue_.size() << "), waiting..." << std::endl;
+            done_cv_.wait(lock, [this] { return queue_.size() < MAX_PENDING_DOWNLOADS; });
+        }
+        TransferJob queued = job;
+        queued.local_path = absolutePath(job.local_path);
+        std::deque<TransferJob>::iterator pos = queue_.begin();
+        while (pos != queue_.end() && pos->priority >= queued.priority) {
+            ++pos;
+        }
+        queue_.insert(pos, queued);
+        if (!worker_.joinable()) {
+            stop_ = false;
+            worker_ = std::thread(&TransferEngine::worker, this);
+        }
+        work_cv_.notify_one();
+        std::cout << "Queued download to: " << queued.local_path << " (" << queue_.size()
+                  << " queued" << (active_ ? ", 1 in progress" : "") << ")" << std::endl;
+    }
+
+    // downloads files that belong together (the lens files of one recording) at the
+    // same time, all-or-nothing: each lands as <name>.incomplete and they are only
+    // renamed into place once every one of them verified. HTTP transfers run in
+    // parallel and share the connection budget, SDK transfers take turns. prints
+    // one combined progress line.
+    bool downloadGroup(const std::vector<std::string>& remote_urls, const std::vector<std::string>& full_paths,
+                       std::vector<DownloadResult>& results) {
+        const size_t count = remote_urls.size();
+        results.assign(count, DownloadResult());
+        const int connections = http_connections_ > 0
+                              ? std::max(1, (http_connections_ + static_cast<int>(count) - 1) / static_cast<int>(count))
+                              : 0;
+        std::vector<std::unique_ptr<ProgressReporter> > progress;
+        for (size_t i = 0; i < count; i++) {
+            progress.push_back(std::unique_ptr<ProgressReporter>(new ProgressReporter(nullptr)));
+        }
+
+        std::atomic<size_t> finished(0);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < count; i++) {
+            workers.push_back(std::thread([&, i] {
+                const std::string staging_path = full_paths[i] + INCOMPLETE_SUFFIX;
+                results[i] = transferWith(remote_urls[i], staging_path, *progress[i], nullptr, true, connections);
+                if (results[i].success) {
+                    verify(staging_path, results[i], true);
+                }
+                finished++;
+            }));
+        }
+
+        ProgressReporter combined(&std::cout);
+        auto showProgress = [&] {
+            int64_t current = 0;
+            int64_t total = 0;
+            for (size_t i = 0; i < count; i++) {
+                current += progress[i]->current();
+                total += progress[i]->total();
+            }
+            combined.update(current, total);
+        };
+        while (finished < count) {
+            showProgress();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        showProgress();
+
+        bool all_success = true;
+        for (size_t i = 0; i < count; i++) {
+            all_success = all_success && results[i].success;
+        }
+        combined.finish(all_success);
+        if (!all_success) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            const std::string staging_path = full_paths[i] + INCOMPLETE_SUFFIX;
+            if (rename(staging_path.c_str(), full_paths[i].c_str()) != 0) {
+                results[i].success = false;
+                results[i].error = "cannot rename " + staging_path + ": " + strerror(errno);
+                all_success = false;
+            }
+        }
+        return all_success;
+    }
+
+    // sizes of camera files from the HTTP server, one probe per file. returns how many
+    // of urls got a size: 0 if the server isn't in use, fewer than urls.size() if probes failed.
+    size_t remoteSizes(const std::vector<std::string>& urls, std::map<std::string, int64_t>& sizes) {
+        if (urls.empty() || http_connections_ <= 0 || http_base_url_.empty()) {
+            return 0;
+        }
+        HttpDownloader http(http_base_url_, 1, stall_timeout_sec_);
+        if (!http.valid()) {
+            return 0;
+        }
+        ScopedPhase phase(tracer_, "HttpSizes");
+        size_t known = 0;
+        for (size_t i = 0; i < urls.size(); i++) {
+            int64_t size = 0;
+            if (http.remoteSize(urls[i], size)) {
+                sizes[urls[i]] = size;
+                known++;
+            }
+        }
+        return known;
+    }
+
+    // blocks until every queued background download has finished
+    void waitIdle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty() && !active_) {
+            return;
+        }
+        std::cout << "Waiting for " << queue_.size() + (active_ ? 1 : 0)
+                  << " pending download(s)..." << std::endl;
+        done_cv_.wait(lock, [this] { return queue_.empty() && !active_; });
+    }
+
+    void printPending() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::cout << "Pending downloads: " << queue_.size() << " queued, "
+                  << (active_ ? 1 : 0) << " in progress" << std::endl;
+        if (active_ && background_progress_.total() > 0) {
+            std::cout << "  in progress: " << formatBytes(background_progress_.current()) << " / "
+                      << formatBytes(background_progress_.total()) << std::endl;
+        }
+        for (size_t i = 0; i < queue_.size(); i++) {
+            std::cout << "  " << queue_[i].local_path << std::endl;
+        }
+        std::cout << "Completed: " << completed_ << ", Failed: " << failed_.size() << std::endl;
+        for (size_t i = 0; i < failed_.size(); i++) {
+            std::cout << "  failed (still on camera): " << failed_[i] << std::endl;
+        }
+    }
+
+    void printStats() const {
+        const int64_t bytes = bytes_transferred_;
+        const double seconds = transfer_us_ / 1e6;
+        std::cout << "  Files downloaded: " << files_transferred_ << " (" << formatBytes(bytes);
+        if (seconds > 0) {
+            std::cout << ", " << formatBytes(static_cast<int64_t>(bytes / seconds)) << "/s average";
+        }
+        std::cout << ")" << std::endl;
+    }
+};
+
+// H.264/H.265 Annex-B byte streams: NAL units follow a 00 00 01 (or 00 00 00 01)
+// start code. emulation prevention keeps 00 00 0x (x <= 3) out of the payload, so
+// two zero bytes in a row are rare and a scan can test 16 bytes at a time for them.
+
+enum VideoCodec {
+    CODEC_H264,
+    CODEC_H265
+};
+
+// first start code (its 00 00 01) in [p, end), or end. the reference version
+const uint8_t* findStartCodeScalar(const uint8_t* p, const uint8_t* end) {
+    for (; end - p >= 3; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p;
+        }
+    }
+    return end;
+}
+
+// libc's memchr() (vectorised) for the 01, then a look at the two bytes before it
+const uint8_t* findStartCodeMemchr(const uint8_t* begin, const uint8_t* end) {
+    const uint8_t* p = begin + 2;
+    while (p < end) {
+        p = static_cast<const uint8_t*>(memchr(p, 1, static_cast<size_t>(end - p)));
+        if (!p) {
+            return end;
+        }
+        if (p[-1] == 0 && p[-2] == 0) {
+            return p - 2;
+        }
+        p++;
+    }
+    return end;
+}
+
+// 16 positions per step: a mask of "this byte and the next are zero", then only
+// the (rare) hits are checked for the 01. NEON on the Pi, SSE2 on x86.
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end) {
+#if defined(__aarch64__) && defined(__GNUC__)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    for (; end - p >= 18; p += 16) {
+        const uint8x16_t pairs = vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero));
+        // narrow to 4 bits per byte to get a scalar mask
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(pairs), 4)), 0);
+        while (mask) {
+            const int i = __builtin_ctzll(mask) / 4;
+            if (p[i + 2] == 1) {
+                return p + i;
+            }
+            mask &= ~(0xFULL << (i * 4));
+        }
+    }
+#elif defined(__x86_64__) && defined(__GNUC__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; end - p >= 18; p += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero))));
+        while (mask) {
+            const int i = __builtin_ctz(mask);
+            if (p[i + 2] == 1) {
+                return p + i;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return findStartCodeScalar(p, end);
+}
+
+const char* startCodeScanName() {
+#if defined(__aarch64__) && defined(__GNUC__)
+    return "NEON";
+#elif defined(__x86_64__) && defined(__GNUC__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+// NAL unit types a decoder can start from: IDR for H.264, IRAP (BLA/IDR/CRA) for H.265
+bool isRandomAccessNal(VideoCodec codec, uint8_t header) {
+    if (codec == CODEC_H264) {
+        return (header & 0x1F) == 5;
+    }
+    const int type = (header >> 1) & 0x3F;
+    return type >= 16 && type <= 23;
+}
+
+// finds NAL units in a byte stream that arrives in pieces of any size. the last
+// bytes of each piece are kept, so a start code split between two pieces is found.
+class AnnexBScanner {
+private:
+    uint64_t offset_;     // stream bytes seen so far
+    uint8_t carry_[2];    // the last (up to) two bytes of the stream
+    size_t carry_len_;
+    bool pending_;        // a start code ended the last piece, its header byte comes next
+    uint64_t pending_offset_;
+
+public:
+    AnnexBScanner() : offset_(0), carry_len_(0), pending_(false), pending_offset_(0) {}
+
+    // calls on_nal(stream offset of the 00 00 01, NAL header byte) for every NAL unit
+    template <typename F>
+    void scan(const uint8_t* data, size_t size, F on_nal) {
+        if (size == 0) {
+            return;
+        }
+        if (pending_) {
+            on_nal(pending_offset_, data[0]);
+            pending_ = false;
+        }
+        // start codes beginning in the carried bytes
+        if (carry_len_ > 0) {
+            uint8_t joined[5];
+            memcpy(joined, carry_, carry_len_);
+            const size_t take = std::min<size_t>(3, size);
+            memcpy(joined + carry_len_, data, take);
+            const size_t joined_len = carry_len_ + take;
+            for (size_t j = 0; j < carry_len_ && j + 3 <= joined_len; j++) {
+                if (joined[j] == 0 && joined[j + 1] == 0 && joined[j + 2] == 1) {
+                    const uint64_t at = offset_ - carry_len_ + j;
+                    if (j + 3 < joined_len) {
+                        on_nal(at, joined[j + 3]);
+                    } else {
+                        pending_ = true;
+                        pending_offset_ = at;
+                    }
+                }
+            }
+        }
+        const uint8_t* end = data + size;
+        for (const uint8_t* p = data; (p = findStartCode(p, end)) != end; p += 3) {
+            const uint64_t at = offset_ + static_cast<uint64_t>(p - data);
+            if (p + 3 < end) {
+                on_nal(at, p[3]);
+            } else {
+                pending_ = true;
+                pending_offset_ = at;
+            }
+        }
+        // keep the stream's last two bytes
+        if (size >= 2) {
+            carry_[0] = end[-2];
+            carry_[1] = end[-1];
+            carry_len_ = 2;
+        } else if (carry_len_ == 2) {
+            carry_[0] = carry_[1];
+            carry_[1] = data[0];
+        } else {
+            carry_[carry_len_++] = data[0];
+        }
+        offset_ += size;
+    }
+};
+
+// sidecar index of a stream capture (<capture>.idx): every access unit a decoder
+// can start from, so seeking or cutting doesn't rescan the capture. fixed-size
+// little-endian records, so readers can binary search or mmap it.
+//   header:   "CCKI"  u8 version (1)  u8 codec (0 H.264, 1 H.265)  u16 reserved
+//   keyframe: u64 byte offset of the frame in the capture  i64 SDK timestamp
+struct KeyframeEntry {
+    uint64_t offset;
+    int64_t timestamp;
+};
+
+class KeyframeIndexWriter {
+private:
+    int fd_;
+
+public:
+    KeyframeIndexWriter() : fd_(-1) {}
+
+    ~KeyframeIndexWriter() {
+        close();
+    }
+
+    bool open(const std::string& path, VideoCodec codec) {
+        close();
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+        const uint8_t header[8] = { 'C', 'C', 'K', 'I', 1, static_cast<uint8_t>(codec), 0, 0 };
+        return write(fd_, header, sizeof(header)) == static_cast<ssize_t>(sizeof(header));
+    }
+
+    bool add(const KeyframeEntry& entry) {
+        return fd_ >= 0 && write(fd_, &entry, sizeof(entry)) == static_cast<ssize_t>(sizeof(entry));
+    }
+
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+};
+
+// ring buffer size for stream-record, about 13 s of the default 10 Mbit/s stream
+const size_t DEFAULT_STREAM_BUFFER_BYTES = 16u << 20;
+// frames the stream writer hands to one writev()
+const size_t STREAM_WRITE_BATCH = 64;
+// the stream writer waits for this much data, or this long, so the card sees large sequential writes
+const size_t STREAM_WRITE_MIN_BYTES = 256u << 10;
+const int STREAM_WRITE_MAX_DELAY_MS = 250;
+// how long the stream writer sleeps between looks at the ring
+const int STREAM_WRITER_IDLE_MS = 2;
+// gyro batches have their own ring; at about 30 KB/s this covers seconds of writer stalls
+const size_t STREAM_GYRO_RING_BYTES = 1u << 20;
+
+// what a stream ring record carries
+enum StreamKind {
+    STREAM_VIDEO,
+    STREAM_AUDIO,
+    STREAM_GYRO  // payload: GyroData samples back to back
+};
+
+// latency distribution with about 12% resolution: exact below 16 ns, then eight
+// buckets per power of two. recording is a couple of instructions and never allocates.
+class LatencyHistogram {
+private:
+    static const size_t BUCKETS = 62 * 8;
+    uint64_t counts_[BUCKETS];
+    uint64_t count_;
+    uint64_t sum_ns_;
+    uint64_t max_ns_;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < 16) {
+            return static_cast<size_t>(ns);
+        }
+        const int msb = 63 - __builtin_clzll(ns);
+        return static_cast<size_t>(msb - 2) * 8 + ((ns >> (msb - 3)) & 7);
+    }
+
+    // largest value that lands in bucket
+    static uint64_t upperBound(size_t bucket) {
+        if (bucket < 16) {
+            return bucket;
+        }
+        const int shift = static_cast<int>(bucket / 8) - 1;
+        return ((8 + bucket % 8 + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void reset() {
+        memset(counts_, 0, sizeof(counts_));
+        count_ = 0;
+        sum_ns_ = 0;
+        max_ns_ = 0;
+    }
+
+    void record(uint64_t ns) {
+        counts_[std::min(bucketOf(ns), BUCKETS - 1)]++;
+        count_++;
+        sum_ns_ += ns;
+        max_ns_ = std::max(max_ns_, ns);
+    }
+
+    uint64_t count() const {
+        return count_;
+    }
+
+    uint64_t maxNs() const {
+        return max_ns_;
+    }
+
+    double meanNs() const {
+        return count_ > 0 ? static_cast<double>(sum_ns_) / count_ : 0.0;
+    }
+
+    // upper bound of the bucket holding the given fraction (0.5 = median)
+    uint64_t percentileNs(double fraction) const {
+        const uint64_t rank = static_cast<uint64_t>(fraction * count_);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            seen += counts_[b];
+            if (seen > rank) {
+                return std::min(upperBound(b), max_ns_);
+            }
+        }
+        return max_ns_;
+    }
+
+    // "p50 3.1 us, p99 12.4 us, max 80.2 us"
+    std::string summary() const {
+        char text[96];
+        snprintf(text, sizeof(text), "p50 %.1f us, p99 %.1f us, max %.1f us", percentileNs(0.5) / 1000.0,
+                 percentileNs(0.99) / 1000.0, max_ns_ / 1000.0);
+        return text;
+    }
+};
+
+// single-producer/single-consumer byte ring for stream frames, allocated and
+// touched once up front. the SDK callback thread copies each frame in and never
+// waits: a frame that doesn't fit is refused. one writer thread reads records in
+// place and releases them after writing. records are 8-byte aligned and never
+// wrap; one that doesn't fit before the end of the buffer starts again at 0 and
+// the gap is skipped.
+class FrameRing {
+public:
+    struct Record {
+        uint32_t size;       // payload bytes, SKIP_RECORD for the gap before a wrap
+        uint16_t kind;       // StreamKind
+        uint16_t stream;     // SDK stream_index
+        int64_t timestamp;   // as delivered by the SDK
+        int64_t queued_ns;   // steady clock when the frame was copied in
+
+        const unsigned char* payload() const {
+            return reinterpret_cast<const unsigned char*>(this + 1);
+        }
+    };
+
+    static const uint32_t SKIP_RECORD = 0xFFFFFFFFu;
+
+private:
+    std::unique_ptr<unsigned char[]> buffer_;
+    size_t capacity_;  // power of two
+    // producer side, consumer side and the shared counters on separate cache lines
+    char pad0_[64];
+    std::atomic<uint64_t> head_;  // bytes ever published by the producer
+    char pad1_[64];
+    std::atomic<uint64_t> tail_;  // bytes ever released by the consumer
+    char pad2_[64];
+    uint64_t cached_tail_;  // producer's last look at tail_
+    char pad3_[64];
+    uint64_t read_pos_;     // consumer: end of the records handed out by acquire()
+
+    static size_t recordBytes(size_t payload) {
+        return (sizeof(Record) + payload + 7) & ~static_cast<size_t>(7);
+    }
+
+public:
+    explicit FrameRing(size_t capacity) : head_(0), tail_(0), cached_tail_(0), read_pos_(0) {
+        capacity_ = 4096;
+        while (capacity_ < capacity) {
+            capacity_ <<= 1;
+        }
+        buffer_.reset(new unsigned char[capacity_]);
+        // fault the pages in now rather than on the callback thread
+        memset(buffer_.get(), 0, capacity_);
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    // producer: copies one frame in. false if it doesn't fit right now.
+    bool push(StreamKind kind, int stream, int64_t timestamp, const uint8_t* data, size_t size) {
+        const size_t need = recordBytes(size);
+        if (need > capacity_ / 2) {
+            return false;
+        }
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        size_t offset = static_cast<size_t>(head & (capacity_ - 1));
+        const size_t skip = capacity_ - offset < need ? capacity_ - offset : 0;
+        if (head + skip + need - cached_tail_ > capacity_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head + skip + need - cached_tail_ > capacity_) {
+                return false;
+            }
+        }
+        if (skip > 0) {
+            if (skip >= sizeof(Record)) {
+                reinterpret_cast<Record*>(buffer_.get() + offset)->size = SKIP_RECORD;
+            }
+            head += skip;
+            offset = 0;
+        }
+        Record* record = reinterpret_cast<Record*>(buffer_.get() + offset);
+        record->size = static_cast<uint32_t>(size);
+        record->kind = static_cast<uint16_t>(kind);
+        record->stream = static_cast<uint16_t>(stream);
+        record->timestamp = timestamp;
+        record->queued_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        memcpy(record + 1, data, size);
+        head_.store(head + need, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: up to max published records, oldest first. they stay valid until release().
+    size_t acquire(const Record** records, size_t max) {
+        const uint64_t head = head_.load(std::memory_order_acquire);
+        size_t count = 0;
+        while (count < max && read_pos_ < head) {
+            const size_t offset = static_cast<size_t>(read_pos_ & (capacity_ - 1));
+            const size_t remaining = capacity_ - offset;
+            const Record* record = reinterpret_cast<const Record*>(buffer_.get() + offset);
+            if (remaining < sizeof(Record) || record->size == SKIP_RECORD) {
+                read_pos_ += remaining;
+                continue;
+            }
+            records[count++] = record;
+            read_pos_ += recordBytes(record->size);
+        }
+        return count;
+    }
+
+    // consumer: hands everything acquire() returned back to the producer
+    void release() {
+        tail_.store(read_pos_, std::memory_order_release);
+    }
+
+    // bytes queued and not yet released
+    size_t used() const {
+        return static_cast<size_t>(head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire));
+    }
+};
+
+// writes all of iov to fd, continuing after short writes. false on error.
+bool writeAll(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        const ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        size_t left = static_cast<size_t>(written);
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// gyro log (.gyro): the live stream's GyroData samples (an int64 timestamp and six
+// doubles, 56 bytes) in columns, so similar numbers sit together and deltas are small:
+//   header:  "CCGY"  u8 version (1)  3 reserved  u32 samples per block  u32 reserved
+//            f64 accelerometer step  f64 gyroscope step
+//   blocks:  "GYBK"  u32 samples  u32 payload bytes  u32 reserved  i64 first and last timestamp,
+//            then the payload: zigzag varints, column by column. timestamps as the change
+//            in the interval (0 for a steady rate), the axes rounded to a multiple of their
+//            step and stored as the difference to the previous sample
+//   index:   per block i64 first and last timestamp, u64 file offset, u32 samples, u32 reserved
+//   footer:  u64 index offset  u32 blocks  "CCGI"
+// all little-endian. a log cut short (no index) is read by walking the blocks.
+const uint32_t GYRO_BLOCK_SAMPLES = 4096;
+// rounding: 0.1 mm/s^2 for the accelerometer, 0.00001 rad/s for the gyroscope
+const double GYRO_ACCEL_STEP = 1e-4;
+const double GYRO_RATE_STEP = 1e-5;
+const size_t GYRO_HEADER_BYTES = 32;
+const size_t GYRO_BLOCK_HEADER_BYTES = 32;
+const size_t GYRO_INDEX_ENTRY_BYTES = 32;
+const size_t GYRO_FOOTER_BYTES = 16;
+
+void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// false if the varint runs past end
+bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const uint8_t byte = *p++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+template <typename T>
+void putLittle(uint8_t* out, T value) {
+    memcpy(out, &value, sizeof(value));
+}
+
+template <typename T>
+T getLittle(const uint8_t* in) {
+    T value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+// value as a multiple of step; out-of-range and non-finite values are clamped
+int64_t quantize(double value, double step) {
+    const double steps = value / step;
+    if (steps != steps) {
+        return 0;
+    }
+    return std::llround(std::max(-4e15, std::min(4e15, steps)));
+}
+
+struct GyroBlockInfo {
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+    uint64_t offset;
+    uint32_t samples;
+};
+
+// encodes count samples as one block (header and payload) onto out
+void encodeGyroBlock(const ins_camera::GyroData* samples, size_t count, double accel_step, double gyro_step,
+                     std::vector<uint8_t>& out) {
+    const size_t start = out.size();
+    out.resize(start + GYRO_BLOCK_HEADER_BYTES);
+    int64_t previous_interval = 0;
+    for (size_t i = 1; i < count; i++) {
+        const int64_t interval = samples[i].timestamp - samples[i - 1].timestamp;
+        putVarint(out, zigzag(interval - previous_interval));
+        previous_interval = interval;
+    }
+    const double ins_camera::GyroData::* const axes[6] = {
+        &ins_camera::GyroData::ax, &ins_camera::GyroData::ay, &ins_camera::GyroData::az,
+        &ins_camera::GyroData::gx, &ins_camera::GyroData::gy, &ins_camera::GyroData::gz
+    };
+    for (int axis = 0; axis < 6; axis++) {
+        const double step = axis < 3 ? accel_step : gyro_step;
+        int64_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            const int64_t value = quantize(samples[i].*axes[axis], step);
+            putVarint(out, zigzag(value - previous));
+            previous = value;
+        }
+    }
+    uint8_t* header = &out[start];
+    memcpy(header, "GYBK", 4);
+    putLittle<uint32_t>(header + 4, static_cast<uint32_t>(count));
+    putLittle<uint32_t>(header + 8, static_cast<uint32_t>(out.size() - start - GYRO_BLOCK_HEADER_BYTES));
+    putLittle<uint32_t>(header + 12, 0);
+    putLittle<int64_t>(header + 16, count > 0 ? samples[0].timestamp : 0);
+    putLittle<int64_t>(header + 24, count > 0 ? samples[count - 1].timestamp : 0);
+}
+
+// decodes the block at block (its header) and appends its samples to out. false if
+// the block is malformed or runs past end
+bool decodeGyroBlock(const uint8_t* block, const uint8_t* end, double accel_step, double gyro_step,
+                     std::vector<ins_camera::GyroData>& out) {
+    if (end - block < static_cast<ptrdiff_t>(GYRO_BLOCK_HEADER_BYTES) || memcmp(block, "GYBK", 4) != 0) {
+        return false;
+    }
+    const uint32_t count = getLittle<uint32_t>(block + 4);
+    const uint32_t bytes = getLittle<uint32_t>(block + 8);
+    const uint8_t* p = block + GYRO_BLOCK_HEADER_BYTES;
+    if (static_cast<uint64_t>(end - p) < bytes || count > GYRO_BLOCK_SAMPLES * 16) {
+        return false;
+    }
+    end = p + bytes;
+    const size_t base = out.size();
+    out.resize(base + count);
+    ins_camera::GyroData* samples = out.data() + base;
+    uint64_t raw;
+    int64_t timestamp = getLittle<int64_t>(block + 16);
+    int64_t interval = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0) {
+            if (!getVarint(p, end, raw)) {
+                out.resize(base);
+                return false;
+            }
+            interval += unzigzag(raw);
+            timestamp += interval;
+        }
+        samples[i].timestamp = timestamp;
+    }
+    double ins_camera::GyroData::* const axes[6] = {
+        &ins_camera::GyroData::ax, &ins_camera::GyroData::ay, &ins_camera::GyroData::az,
+        &ins_camera::GyroData::gx, &ins_camera::GyroData::gy, &ins_camera::GyroData::gz
+    };
+    for (int axis = 0; axis < 6; axis++) {
+        const double step = axis < 3 ? accel_step : gyro_step;
+        int64_t value = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (!getVarint(p, end, raw)) {
+                out.resize(base);
+                return false;
+            }
+            value += unzigzag(raw);
+            samples[i].*axes[axis] = value * step;
+        }
+    }
+    return true;
+}
+
+// appends samples to a gyro log, a block at a time. close() writes the index
+class GyroLogWriter {
+private:
+    int fd_;
+    std::string path_;
+    double accel_step_;
+    double gyro_step_;
+    std::vector<ins_camera::GyroData> pending_;
+    std::vector<uint8_t> buffer_;
+    std::vector<GyroBlockInfo> blocks_;
+    uint64_t offset_;
+    int64_t samples_;
+    std::string error_;
+
+    bool writeBuffer() {
+        struct iovec iov;
+        iov.iov_base = buffer_.data();
+        iov.iov_len = buffer_.size();
+        const bool ok = buffer_.empty() || writeAll(fd_, &iov, 1);
+        if (!ok && error_.empty()) {
+            error_ = "write to " + path_ + " failed: " + strerror(errno);
+        }
+        offset_ += buffer_.size();
+        buffer_.clear();
+        return ok;
+    }
+
+    void flushBlock() {
+        if (pending_.empty() || fd_ < 0) {
+            return;
+        }
+        GyroBlockInfo info;
+        info.first_timestamp = pending_.front().timestamp;
+        info.last_timestamp = pending_.back().timestamp;
+        info.offset = offset_;
+        info.samples = static_cast<uint32_t>(pending_.size());
+        encodeGyroBlock(pending_.data(), pending_.size(), accel_step_, gyro_step_, buffer_);
+        pending_.clear();
+        if (writeBuffer()) {
+            blocks_.push_back(info);
+        }
+    }
+
+public:
+    GyroLogWriter() : fd_(-1), accel_step_(GYRO_ACCEL_STEP), gyro_step_(GYRO_RATE_STEP), offset_(0), samples_(0) {}
+
+    ~GyroLogWriter() {
+        close();
+    }
+
+    bool open(const std::string& path, double accel_step = GYRO_ACCEL_STEP, double gyro_step = GYRO_RATE_STEP) {
+        close();
+        path_ = path;
+        accel_step_ = accel_step;
+        gyro_step_ = gyro_step;
+        blocks_.clear();
+        offset_ = 0;
+        samples_ = 0;
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            error_ = "cannot create " + path + ": " + strerror(errno);
+            return false;
+        }
+        pending_.reserve(GYRO_BLOCK_SAMPLES);
+        buffer_.assign(GYRO_HEADER_BYTES, 0);
+        memcpy(&buffer_[0], "CCGY", 4);
+        buffer_[4] = 1;
+        putLittle<uint32_t>(&buffer_[8], GYRO_BLOCK_SAMPLES);
+        putLittle<double>(&buffer_[16], accel_step_);
+        putLittle<double>(&buffer_[24], gyro_step_);
+        return writeBuffer();
+    }
+
+    bool isOpen() const {
+        return fd_ >= 0;
+    }
+
+    void add(const ins_camera::GyroData* samples, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            pending_.push_back(samples[i]);
+            if (pending_.size() == GYRO_BLOCK_SAMPLES) {
+                flushBlock();
+            }
+        }
+        samples_ += static_cast<int64_t>(count);
+    }
+
+    // writes the last block, the index and the footer
+    void close() {
+        if (fd_ < 0) {
+            return;
+        }
+        flushBlock();
+        const uint64_t index_offset = offset_;
+        buffer_.resize(blocks_.size() * GYRO_INDEX_ENTRY_BYTES + GYRO_FOOTER_BYTES);
+        uint8_t* p = buffer_.data();
+        for (size_t i = 0; i < blocks_.size(); i++, p += GYRO_INDEX_ENTRY_BYTES) {
+            putLittle<int64_t>(p, blocks_[i].first_timestamp);
+            putLittle<int64_t>(p + 8, blocks_[i].last_timestamp);
+            putLittle<uint64_t>(p + 16, blocks_[i].offset);
+            putLittle<uint32_t>(p + 24, blocks_[i].samples);
+            putLittle<uint32_t>(p + 28, 0);
+        }
+        putLittle<uint64_t>(p, index_offset);
+        putLittle<uint32_t>(p + 8, static_cast<uint32_t>(blocks_.size()));
+        memcpy(p + 12, "CCGI", 4);
+        writeBuffer();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    int64_t samples() const {
+        return samples_;
+    }
+
+    // file size so far
+    uint64_t bytes() const {
+        return offset_;
+    }
+
+    const std::string& error() const {
+        return error_;
+    }
+};
+
+// reads a gyro log through mmap. queries decode only the blocks that overlap the
+// time range, found by binary search on the block index
+class GyroLogReader {
+private:
+    const uint8_t* data_;
+    size_t size_;
+    double accel_step_;
+    double gyro_step_;
+    std::vector<GyroBlockInfo> blocks_;
+    bool indexed_;  // had an index; otherwise it was rebuilt by walking the blocks
+
+public:
+    GyroLogReader() : data_(nullptr), size_(0), accel_step_(0), gyro_step_(0), indexed_(false) {}
+
+    ~GyroLogReader() {
+        if (data_) {
+            munmap(const_cast<uint8_t*>(data_), size_);
+        }
+    }
+
+    bool open(const std::string& path, std::string& error) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(GYRO_HEADER_BYTES)) {
+            ::close(fd);
+            error = path + " is not a gyro log";
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        void* mapped = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            error = "cannot map " + path + ": " + strerror(errno);
+            size_ = 0;
+            return false;
+        }
+        data_ = static_cast<const uint8_t*>(mapped);
+        if (memcmp(data_, "CCGY", 4) != 0 || data_[4] != 1) {
+            error = path + " is not a gyro log (or a newer version)";
+            return false;
+        }
+        accel_step_ = getLittle<double>(data_ + 16);
+        gyro_step_ = getLittle<double>(data_ + 24);
+
+        const uint8_t* footer = data_ + size_ - GYRO_FOOTER_BYTES;
+        if (size_ >= GYRO_HEADER_BYTES + GYRO_FOOTER_BYTES && memcmp(footer + 12, "CCGI", 4) == 0) {
+            const uint64_t index_offset = getLittle<uint64_t>(footer);
+            const uint32_t count = getLittle<uint32_t>(footer + 8);
+            if (index_offset + static_cast<uint64_t>(count) * GYRO_INDEX_ENTRY_BYTES + GYRO_FOOTER_BYTES == size_) {
+                const uint8_t* p = data_ + index_offset;
+                blocks_.resize(count);
+                for (uint32_t i = 0; i < count; i++, p += GYRO_INDEX_ENTRY_BYTES) {
+                    blocks_[i].first_timestamp = getLittle<int64_t>(p);
+                    blocks_[i].last_timestamp = getLittle<int64_t>(p + 8);
+                    blocks_[i].offset = getLittle<uint64_t>(p + 16);
+                    blocks_[i].samples = getLittle<uint32_t>(p + 24);
+                }
+                indexed_ = true;
+                return true;
+            }
+        }
+        // no index (the writer didn't get to close()): every complete block counts
+        uint64_t offset = GYRO_HEADER_BYTES;
+        while (size_ - offset >= GYRO_BLOCK_HEADER_BYTES && memcmp(data_ + offset, "GYBK", 4) == 0) {
+            const uint8_t* block = data_ + offset;
+            const uint64_t bytes = getLittle<uint32_t>(block + 8);
+            if (size_ - offset - GYRO_BLOCK_HEADER_BYTES < bytes) {
+                break;
+            }
+            GyroBlockInfo info;
+            info.samples = getLittle<uint32_t>(block + 4);
+            info.first_timestamp = getLittle<int64_t>(block + 16);
+            info.last_timestamp = getLittle<int64_t>(block + 24);
+            info.offset = offset;
+            blocks_.push_back(info);
+            offset += GYRO_BLOCK_HEADER_BYTES + bytes;
+        }
+        return true;
+    }
+
+    bool indexed() const {
+        return indexed_;
+    }
+
+    const std::vector<GyroBlockInfo>& blocks() const {
+        return blocks_;
+    }
+
+    // appends the samples with from <= timestamp <= to. false if a block is damaged
+    bool query(int64_t from, int64_t to, std::vector<ins_camera::GyroData>& out) const {
+        // blocks are in time order: the first that ends at or after from
+        size_t low = 0;
+        size_t high = blocks_.size();
+        while (low < high) {
+            const size_t middle = (low + high) / 2;
+            if (blocks_[middle].last_timestamp < from) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        std::vector<ins_camera::GyroData> block;
+        for (size_t i = low; i < blocks_.size() && blocks_[i].first_timestamp <= to; i++) {
+            block.clear();
+            if (!decodeGyroBlock(data_ + blocks_[i].offset, data_ + size_, accel_step_, gyro_step_, block)) {
+                return false;
+            }
+            for (size_t j = 0; j < block.size(); j++) {
+                if (block[j].timestamp >= from && block[j].timestamp <= to) {
+                    out.push_back(block[j]);
+                }
+            }
+        }
+        return true;
+    }
+};
+
+// one finished segment of a segmented stream capture
+struct StreamSegment {
+    std::string name;  // file name, next to the segment index
+    int64_t sequence;
+    double seconds;
+};
+
+// writes the segment index of a segmented capture: a comment header, then one
+// "<sequence> <seconds> <file>" line per finished segment still on disk, oldest
+// first, and "# ended" once the capture won't grow any more. the segments are raw
+// Annex-B, so this is deliberately not an HLS playlist. replaced with a rename,
+// so a reader never sees half an index.
+bool writeSegmentIndex(const std::string& path, const std::deque<StreamSegment>& segments, bool ended) {
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out << "# camera_control segments 1\n# sequence seconds file\n";
+        out << std::fixed << std::setprecision(3);
+        for (size_t i = 0; i < segments.size(); i++) {
+            out << segments[i].sequence << ' ' << segments[i].seconds << ' ' << segments[i].name << '\n';
+        }
+        if (ended) {
+            out << "# ended\n";
+        }
+        if (!out.flush()) {
+            return false;
+        }
+    }
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+// StreamDelegate that records the live stream to disk without doing I/O on the
+// SDK's callback thread: OnVideoData only copies the frame into a FrameRing, and
+// a writer thread drains the ring into one file per stream index with writev().
+// frames that arrive while the ring is full are dropped and counted. gyro batches
+// get a ring of their own: the SDK may deliver them on another thread, and a
+// FrameRing takes a single producer.
+//
+// with segments enabled each stream is cut into files of about segment seconds,
+// always at a keyframe so every segment decodes on its own, listed in a rolling
+// segment index. segments older than the retention window are deleted. cutting,
+// the index and the deletes all happen on the writer thread; the ring covers them.
+class StreamRecorder : public ins_camera::StreamDelegate {
+private:
+    // the open capture file of one stream index, and its keyframe index. writer thread only
+    struct StreamFile {
+        int fd;
+        uint64_t offset;      // bytes written to the open file so far
+        int64_t sequence;     // number of the open segment, -1 before the first frame
+        int64_t started_ns;   // arrival of the open file's first frame
+        int64_t last_ns;      // arrival of the last frame
+        int64_t interval_ns;  // time between the last two frames
+        AnnexBScanner scanner;
+        KeyframeIndexWriter index;
+        std::deque<StreamSegment> segments;  // finished, still on disk
+        double segment_seconds;              // sum over segments
+
+        StreamFile()
+            : fd(-1), offset(0), sequence(-1), started_ns(0), last_ns(0), interval_ns(0), segment_seconds(0) {}
+    };
+
+    FrameRing ring_;       // video, from OnVideoData
+    FrameRing gyro_ring_;  // gyro batches, from OnGyroData, which the SDK may call on another thread
+    std::string base_path_;  // stream n goes to <base_path>_<n><extension>
+    VideoCodec codec_;
+    int64_t segment_ns_;  // 0: one file per stream
+    int64_t retain_ns_;   // 0: keep every segment
+    std::atomic<bool> accepting_;
+    std::atomic<bool> stopping_;
+    std::thread writer_;
+    std::map<int, StreamFile> files_;
+    std::vector<std::string> paths_;  // capture files, or segment indexes when segmenting
+
+    // callback side, written by the SDK thread
+    LatencyHistogram callback_latency_;
+    std::atomic<int64_t> frames_;
+    std::atomic<int64_t> bytes_;
+    std::atomic<int64_t> dropped_frames_;
+    std::atomic<int64_t> dropped_bytes_;
+    std::atomic<int64_t> dropped_gyro_;  // gyro batches refused by a full gyro ring
+
+    // writer side
+    LatencyHistogram queue_delay_;  // frame copied in -> handed to writev()
+    int64_t writes_;
+    int64_t frames_written_;
+    int64_t bytes_written_;
+    size_t peak_used_;
+    std::string write_error_;
+    int64_t keyframes_;
+    int64_t scanned_bytes_;
+    int64_t scan_ns_;
+    int64_t segments_written_;
+    int64_t segments_removed_;
+    int64_t longest_cut_ns_;
+    GyroLogWriter gyro_;  // follows stream 0's segments
+    int64_t gyro_sequence_;
+    int64_t gyro_samples_;
+    int64_t gyro_bytes_;
+
+    std::string extension() const {
+        return codec_ == CODEC_H265 ? ".h265" : ".h264";
+    }
+
+    std::string segmentIndexPath(int stream) const {
+        return base_path_ + "_" + std::to_string(stream) + ".segments";
+    }
+
+    std::string gyroPath(int64_t sequence) const {
+        if (segment_ns_ <= 0) {
+            return base_path_ + ".gyro";
+        }
+        char number[32];
+        snprintf(number, sizeof(number), "_%05lld", static_cast<long long>(sequence));
+        return base_path_ + number + ".gyro";
+    }
+
+    void closeGyro() {
+        if (gyro_.isOpen()) {
+            gyro_.close();
+            gyro_samples_ += gyro_.samples();
+            gyro_bytes_ += static_cast<int64_t>(gyro_.bytes());
+            if (!gyro_.error().empty()) {
+                setError(gyro_.error());
+            }
+        }
+    }
+
+    // gyro samples go to the log of stream 0's open file; those from before its
+    // first frame are dropped
+    void logGyro(const FrameRing::Record& record) {
+        std::map<int, StreamFile>::const_iterator it = files_.find(0);
+        if (it == files_.end() || it->second.sequence < 0) {
+            return;
+        }
+        if (!gyro_.isOpen() || gyro_sequence_ != it->second.sequence) {
+            closeGyro();
+            gyro_sequence_ = it->second.sequence;
+            if (!gyro_.open(gyroPath(gyro_sequence_))) {
+                setError(gyro_.error());
+                return;
+            }
+            if (gyro_sequence_ == 0 && segment_ns_ <= 0) {
+                paths_.push_back(gyroPath(0));
+            }
+        }
+        // copied out: the ring only aligns payloads to 8 bytes
+        ins_camera::GyroData samples[64];
+        const size_t count = record.size / sizeof(ins_camera::GyroData);
+        for (size_t at = 0; at < count; at += 64) {
+            const size_t n = std::min<size_t>(64, count - at);
+            memcpy(samples, record.payload() + at * sizeof(ins_camera::GyroData), n * sizeof(ins_camera::GyroData));
+            gyro_.add(samples, n);
+        }
+    }
+
+    // logs every gyro batch queued so far, after the video frames that arrived with them
+    void drainGyro() {
+        const FrameRing::Record* records[STREAM_WRITE_BATCH];
+        while (size_t count = gyro_ring_.acquire(records, STREAM_WRITE_BATCH)) {
+            for (size_t i = 0; i < count; i++) {
+                logGyro(*records[i]);
+            }
+            gyro_ring_.release();
+        }
+    }
+
+    std::string capturePath(int stream, int64_t sequence) const {
+        if (segment_ns_ <= 0) {
+            return base_path_ + "_" + std::to_string(stream) + extension();
+        }
+        char number[32];
+        snprintf(number, sizeof(number), "_%05lld", static_cast<long long>(sequence));
+        return base_path_ + "_" + std::to_string(stream) + number + extension();
+    }
+
+    void setError(const std::string& error) {
+        if (write_error_.empty()) {
+            write_error_ = error;
+        }
+    }
+
+    // closes the open file. a finished segment goes in the segment index, and the
+    // oldest ones are deleted while the rest still cover the retention window
+    void finishFile(StreamFile& file, int stream, int64_t end_ns, bool ended) {
+        if (file.fd >= 0) {
+            close(file.fd);
+            file.fd = -1;
+        }
+        file.index.close();
+        if (segment_ns_ <= 0 || file.sequence < 0) {
+            return;
+        }
+        const std::string path = capturePath(stream, file.sequence);
+        StreamSegment segment;
+        segment.name = path.substr(path.find_last_of('/') + 1);
+        segment.sequence = file.sequence;
+        segment.seconds = std::max<int64_t>(0, end_ns - file.started_ns) / 1e9;
+        file.segments.push_back(segment);
+        file.segment_seconds += segment.seconds;
+        segments_written_++;
+        while (retain_ns_ > 0 && file.segments.size() > 1 &&
+               (file.segment_seconds - file.segments.front().seconds) * 1e9 >= retain_ns_) {
+            const std::string old_path = capturePath(stream, file.segments.front().sequence);
+            unlink(old_path.c_str());
+            unlink((old_path + ".idx").c_str());
+            if (stream == 0) {
+                unlink(gyroPath(file.segments.front().sequence).c_str());
+            }
+            file.segment_seconds -= file.segments.front().seconds;
+            file.segments.pop_front();
+            segments_removed_++;
+        }
+        if (!writeSegmentIndex(segmentIndexPath(stream), file.segments, ended)) {
+            setError("cannot write " + segmentIndexPath(stream) + ": " + strerror(errno));
+        }
+    }
+
+    // closes the open file (if any) and opens the next one, starting at now_ns
+    void openNextFile(StreamFile& file, int stream, int64_t now_ns) {
+        const auto start = std::chrono::steady_clock::now();
+        finishFile(file, stream, now_ns, false);
+        file.sequence++;
+        file.started_ns = now_ns;
+        file.offset = 0;
+        const std::string path = capturePath(stream, file.sequence);
+        file.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file.fd < 0) {
+            setError("cannot create " + path + ": " + strerror(errno));
+            return;
+        }
+        if (file.sequence == 0) {
+            paths_.push_back(segment_ns_ > 0 ? segmentIndexPath(stream) : path);
+        }
+        if (!file.index.open(path + ".idx", codec_)) {
+            setError("cannot create " + path + ".idx: " + strerror(errno));
+        }
+        longest_cut_ns_ = std::max<int64_t>(longest_cut_ns_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    void flushFrames(StreamFile& file, struct iovec* iov, int count) {
+        if (count == 0) {
+            return;
+        }
+        if (file.fd >= 0 && !writeAll(file.fd, iov, count)) {
+            setError(std::string("write failed: ") + strerror(errno));
+        }
+        writes_++;
+        frames_written_ += count;
+    }
+
+    // writes one stream's frames of a batch with one writev() per file. each frame
+    // is scanned for NAL units first: frames a decoder can start from go into the
+    // keyframe index, and when segmenting may start the next segment
+    void writeFrames(int stream, const FrameRing::Record* const* records, const int* which, int count, int64_t now_ns) {
+        StreamFile& file = files_[stream];
+        struct iovec iov[STREAM_WRITE_BATCH];
+        int queued = 0;
+        for (int i = 0; i < count; i++) {
+            const FrameRing::Record* record = records[which[i]];
+            const auto scan_start = std::chrono::steady_clock::now();
+            bool random_access = false;
+            file.scanner.scan(record->payload(), record->size, [&](uint64_t, uint8_t header) {
+                random_access = random_access || isRandomAccessNal(codec_, header);
+            });
+            scan_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - scan_start).count();
+            scanned_bytes_ += record->size;
+
+            if (file.sequence >= 0) {
+                file.interval_ns = record->queued_ns - file.last_ns;
+            }
+            file.last_ns = record->queued_ns;
+            // arrival times jitter, so a keyframe within a frame of the target length cuts too
+            if (file.sequence < 0 || (segment_ns_ > 0 && random_access &&
+                                      record->queued_ns - file.started_ns + file.interval_ns >= segment_ns_)) {
+                flushFrames(file, iov, queued);
+                queued = 0;
+                openNextFile(file, stream, record->queued_ns);
+            }
+            if (random_access) {
+                KeyframeEntry entry;
+                entry.offset = file.offset;
+                entry.timestamp = record->timestamp;
+                if (file.fd >= 0 && !file.index.add(entry)) {
+                    setError(std::string("keyframe index write failed: ") + strerror(errno));
+                }
+                keyframes_++;
+            }
+            queue_delay_.record(static_cast<uint64_t>(std::max<int64_t>(0, now_ns - record->queued_ns)));
+            iov[queued].iov_base = const_cast<unsigned char*>(record->payload());
+            iov[queued].iov_len = record->size;
+            queued++;
+            file.offset += record->size;
+            bytes_written_ += record->size;
+        }
+        flushFrames(file, iov, queued);
+    }
+
+    void writerLoop() {
+        const FrameRing::Record* records[STREAM_WRITE_BATCH];
+        auto last_write = std::chrono::steady_clock::now();
+        while (true) {
+            const size_t used = ring_.used();
+            peak_used_ = std::max(peak_used_, used);
+            if (!stopping_ && used < STREAM_WRITE_MIN_BYTES && elapsedMs(last_write) < STREAM_WRITE_MAX_DELAY_MS) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(STREAM_WRITER_IDLE_MS));
+                continue;
+            }
+            const size_t count = ring_.acquire(records, STREAM_WRITE_BATCH);
+            if (count == 0) {
+                drainGyro();
+                if (stopping_) {
+                    break;
+                }
+                last_write = std::chrono::steady_clock::now();
+                continue;
+            }
+            last_write = std::chrono::steady_clock::now();
+            const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            // one writev per file: the lenses' frames arrive interleaved
+            bool written[STREAM_WRITE_BATCH] = {};
+            int which[STREAM_WRITE_BATCH];
+            for (size_t first = 0; first < count; first++) {
+                if (written[first]) {
+                    continue;
+                }
+                int frame_count = 0;
+                for (size_t i = first; i < count; i++) {
+                    if (written[i] || records[i]->kind != STREAM_VIDEO || records[i]->stream != records[first]->stream) {
+                        continue;
+                    }
+                    which[frame_count++] = static_cast<int>(i);
+                    written[i] = true;
+                }
+                writeFrames(records[first]->stream, records, which, frame_count, now_ns);
+            }
+            ring_.release();
+            drainGyro();
+        }
+    }
+
+public:
+    StreamRecorder(size_t buffer_bytes, const std::string& base_path, VideoCodec codec)
+        : ring_(buffer_bytes), gyro_ring_(STREAM_GYRO_RING_BYTES), base_path_(base_path), codec_(codec), segment_ns_(0),
+          retain_ns_(0), accepting_(false), stopping_(false), frames_(0), bytes_(0), dropped_frames_(0),
+          dropped_bytes_(0), dropped_gyro_(0), writes_(0),
+          frames_written_(0), bytes_written_(0), peak_used_(0), keyframes_(0), scanned_bytes_(0), scan_ns_(0),
+          segments_written_(0), segments_removed_(0), longest_cut_ns_(0), gyro_sequence_(-1), gyro_samples_(0),
+          gyro_bytes_(0) {}
+
+    // before start(): cut each stream into segments of about seconds (cut at the first
+    // keyframe after that), keeping those within the last retain_seconds (0: all)
+    void setSegments(int seconds, int retain_seconds) {
+        segment_ns_ = static_cast<int64_t>(seconds) * 1000000000LL;
+        retain_ns_ = static_cast<int64_t>(retain_seconds) * 1000000000LL;
+    }
+
+    bool segmented() const {
+        return segment_ns_ > 0;
+    }
+
+    ~StreamRecorder() {
+        stop();
+    }
+
+    void start() {
+        stopping_ = false;
+        writer_ = std::thread(&StreamRecorder::writerLoop, this);
+        accepting_ = true;
+    }
+
+    // refuses further frames, writes out what is queued and closes the files
+    // (when segmenting, the last segment goes in the segment index, which is marked ended)
+    void stop() {
+        accepting_ = false;
+        stopping_ = true;
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        closeGyro();
+        for (std::map<int, StreamFile>::iterator it = files_.begin(); it != files_.end(); ++it) {
+            finishFile(it->second, it->first, it->second.last_ns + it->second.interval_ns, true);
+        }
+        files_.clear();
+    }
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t, int stream_index) override {
+        if (!accepting_) {
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        if (ring_.push(STREAM_VIDEO, stream_index, timestamp, data, size)) {
+            frames_.fetch_add(1, std::memory_order_relaxed);
+            bytes_.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+        } else {
+            dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+            dropped_bytes_.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+        }
+        callback_latency_.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+    }
+
+    void OnAudioData(const uint8_t*, size_t, int64_t) override {}
+
+    void OnGyroData(const std::vector<ins_camera::GyroData>& data) override {
+        if (accepting_ && !data.empty() &&
+            !gyro_ring_.push(STREAM_GYRO, 0, data.front().timestamp, reinterpret_cast<const uint8_t*>(data.data()),
+                             data.size() * sizeof(ins_camera::GyroData))) {
+            dropped_gyro_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void OnExposureData(const ins_camera::ExposureData&) override {}
+
+    int64_t frames() const {
+        return frames_;
+    }
+
+    int64_t bytes() const {
+        return bytes_;
+    }
+
+    int64_t droppedFrames() const {
+        return dropped_frames_;
+    }
+
+    const LatencyHistogram& callbackLatency() const {
+        return callback_latency_;
+    }
+
+    const std::vector<std::string>& paths() const {
+        return paths_;
+    }
+
+    const std::string& writeError() const {
+        return write_error_;
+    }
+
+    // after stop()
+    void printStats(std::ostream& out) const {
+        out << "Frames: " << frames_ << " recorded (" << formatBytes(bytes_) << "), " << dropped_frames_
+            << " dropped (" << formatBytes(dropped_bytes_) << ", ring full)" << std::endl;
+        out << "Callback time: " << callback_latency_.summary() << " over " << callback_latency_.count()
+            << " callbacks" << std::endl;
+        out << "Queued before write: " << queue_delay_.summary() << std::endl;
+        out << std::fixed << std::setprecision(1) << "Writer: " << writes_ << " writev() calls, "
+            << (writes_ > 0 ? static_cast<double>(frames_written_) / writes_ : 0.0) << " frames each, peak ring use "
+            << formatBytes(static_cast<int64_t>(peak_used_)) << " of " << formatBytes(static_cast<int64_t>(ring_.capacity()))
+            << std::endl;
+        out << "Keyframe index: " << keyframes_ << " keyframe(s), scanned at "
+            << (scan_ns_ > 0 ? scanned_bytes_ * 1000.0 / scan_ns_ : 0.0) << " MB/s (" << startCodeScanName() << ")"
+            << std::endl;
+        if (gyro_samples_ > 0 || dropped_gyro_ > 0) {
+            out << "Gyro log: " << gyro_samples_ << " samples, " << formatBytes(gyro_bytes_) << " ("
+                << (gyro_samples_ > 0 ? static_cast<double>(gyro_bytes_) / gyro_samples_ : 0.0) << " bytes each), "
+                << dropped_gyro_ << " batch(es) dropped (ring full)" << std::endl;
+        }
+        if (segmented()) {
+            out << "Segments: " << segments_written_ << " written, " << segments_removed_
+                << " deleted past the retention window, longest cut " << longest_cut_ns_ / 1e6 << " ms" << std::endl;
+        }
+    }
+};
+
+// set by SIGINT/SIGTERM while stream-record runs
+volatile sig_atomic_t g_stream_stop = 0;
+
+void handleStreamSignal(int) {
+    g_stream_stop = 1;
+}
+
+// set by SIGUSR1 while dashcam runs
+volatile sig_atomic_t g_dashcam_trigger = 0;
+
+void handleDashcamTrigger(int) {
+    g_dashcam_trigger = 1;
+}
+
+// dashcam keeps recent stream data in memory, split at keyframes. the ring in front
+// of it only has to absorb the keeper's copying, the pre-roll itself is in chunks
+const size_t DASHCAM_RING_BYTES = 8u << 20;
+const int DEFAULT_PREROLL_SEC = 10;
+const int DEFAULT_POSTROLL_SEC = 10;
+const int64_t DEFAULT_PREROLL_MEMORY = 64LL << 20;
+// chunks waiting for the event writer
+const size_t DASHCAM_WRITE_QUEUE = 1024;
+
+// the live stream from one keyframe of stream 0 up to the next: the video of every
+// stream plus the audio and gyro data that arrived in between. its memory is
+// counted in a shared total for as long as anyone (pre-roll, event writer) holds it.
+class PrerollChunk {
+public:
+    struct Item {
+        uint16_t kind;
+        uint16_t stream;
+        bool keyframe;      // video a decoder can start from
+        int64_t timestamp;  // SDK timestamp
+        int64_t arrived_ns; // when the callback delivered it
+        size_t offset;      // into bytes
+        size_t size;
+    };
+
+private:
+    std::atomic<int64_t>& memory_;
+    int64_t counted_;
+    int64_t started_ns_;
+    std::vector<Item> items_;
+    std::vector<uint8_t> bytes_;
+
+    void count() {
+        const int64_t now = static_cast<int64_t>(sizeof(*this) + bytes_.capacity() + items_.capacity() * sizeof(Item));
+        memory_.fetch_add(now - counted_);
+        counted_ = now;
+    }
+
+public:
+    // expected_bytes: a guess at the size (the last chunk's), to avoid regrowing
+    PrerollChunk(std::atomic<int64_t>& memory, int64_t started_ns, size_t expected_bytes)
+        : memory_(memory), counted_(0), started_ns_(started_ns) {
+        bytes_.reserve(expected_bytes);
+        items_.reserve(64);
+        count();
+    }
+
+    ~PrerollChunk() {
+        memory_.fetch_sub(counted_);
+    }
+
+    // memory add() would allocate for a record of size bytes. the buffer grows by a
+    // quarter at a time rather than doubling, so the cap isn't overshot by much
+    size_t growthFor(size_t size) const {
+        const size_t need = bytes_.size() + size;
+        if (need <= bytes_.capacity()) {
+            return 0;
+        }
+        return std::max(need, bytes_.capacity() + bytes_.capacity() / 4) - bytes_.capacity();
+    }
+
+    void add(const FrameRing::Record& record, bool keyframe) {
+        const size_t growth = growthFor(record.size);
+        if (growth > 0) {
+            bytes_.reserve(bytes_.capacity() + growth);
+        }
+        Item item;
+        item.kind = record.kind;
+        item.stream = record.stream;
+        item.keyframe = keyframe;
+        item.timestamp = record.timestamp;
+        item.arrived_ns = record.queued_ns;
+        item.offset = bytes_.size();
+        item.size = record.size;
+        bytes_.insert(bytes_.end(), record.payload(), record.payload() + record.size);
+        items_.push_back(item);
+        count();
+    }
+
+    int64_t startedNs() const {
+        return started_ns_;
+    }
+
+    size_t size() const {
+        return bytes_.size();
+    }
+
+    const std::vector<Item>& items() const {
+        return items_;
+    }
+
+    const uint8_t* data(const Item& item) const {
+        return bytes_.data() + item.offset;
+    }
+};
+
+// the files of one saved event, written by the event writer thread only
+struct DashcamEvent {
+    std::string base_path;  // files are <base_path>_<n>.h264, _audio.raw, .gyro
+    std::string source;     // what triggered it
+    double preroll_seconds;
+    int64_t triggered_ns;
+
+    struct VideoFile {
+        bool started;  // reached the stream's first keyframe
+        int fd;
+        uint64_t offset;
+        KeyframeIndexWriter index;
+
+        VideoFile() : started(false), fd(-1), offset(0) {}
+    };
+    std::map<int, VideoFile> video;
+    int audio_fd;
+    GyroLogWriter gyro;
+    int64_t frames;
+    int64_t bytes;
+    int64_t last_ns;
+    std::vector<std::string> paths;
+
+    DashcamEvent() : preroll_seconds(0), triggered_ns(0), audio_fd(-1), frames(0), bytes(0), last_ns(0) {}
+};
+
+// work for the event writer: write chunk's data up to end_ns into event, then
+// close the event's files if last
+struct DashcamWork {
+    std::shared_ptr<PrerollChunk> chunk;
+    std::shared_ptr<DashcamEvent> event;
+    int64_t end_ns;
+    bool last;
+};
+
+// dashcam recording: keeps the last pre seconds of the live stream in memory and,
+// on trigger(), saves them plus the post seconds that follow. like StreamRecorder
+// the SDK callbacks only copy into a FrameRing (one at a time); a keeper thread
+// sorts the ring into PrerollChunks, so a saved event always starts at a keyframe,
+// and an event writer thread puts triggered chunks on disk. memory is capped: the
+// oldest chunks go first, and when chunks still waiting for the writer fill the
+// cap, new frames are dropped up to the next keyframe.
+class DashcamRecorder : public ins_camera::StreamDelegate {
+private:
+    FrameRing ring_;
+    std::string directory_;
+    VideoCodec codec_;
+    int64_t pre_ns_;
+    int64_t post_ns_;
+    int64_t memory_cap_;
+    std::atomic<bool> accepting_;
+    std::atomic<bool> stopping_;
+    std::thread keeper_;
+    std::thread writer_;
+    BoundedQueue<DashcamWork> work_;
+
+    // keeper thread only
+    std::map<int, AnnexBScanner> scanners_;
+    std::deque<std::shared_ptr<PrerollChunk> > preroll_;  // closed chunks, oldest first
+    std::shared_ptr<PrerollChunk> open_;
+    std::shared_ptr<DashcamEvent> event_;                 // being recorded
+    int64_t event_end_ns_;
+    bool skipping_;
+    int64_t latest_ns_;
+
+    // trigger requests, from the control thread
+    std::mutex trigger_mutex_;
+    std::vector<std::pair<std::string, int64_t> > triggers_;  // (source, when)
+    // finished events and errors, for the control thread to print
+    std::mutex notice_mutex_;
+    std::vector<std::string> notices_;
+
+    std::atomic<int64_t> memory_;  // all chunks alive
+    std::atomic<int64_t> peak_memory_;
+    std::atomic<int64_t> preroll_ns_;
+    std::atomic<int64_t> frames_;
+    std::atomic<int64_t> dropped_frames_;
+    std::atomic<int64_t> events_;
+    std::atomic<int64_t> extended_;
+    // the SDK may deliver video, audio and gyro on different threads, but ring_ takes one
+    // producer and a chunk needs them in arrival order: the callbacks take turns
+    std::mutex producer_mutex_;
+    LatencyHistogram callback_latency_;  // under producer_mutex_
+
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void notice(const std::string& text) {
+        std::lock_guard<std::mutex> lock(notice_mutex_);
+        notices_.push_back(text);
+    }
+
+    void push(StreamKind kind, int stream, int64_t timestamp, const uint8_t* data, size_t size) {
+        if (!accepting_) {
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(producer_mutex_);
+        if (ring_.push(kind, stream, timestamp, data, size)) {
+            frames_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+        }
+        callback_latency_.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+    }
+
+    // a keyframe of stream 0 ends the open chunk: it joins the pre-roll and, while
+    // an event is recording, goes to the writer. the event ends with the chunk
+    // that reaches past its end
+    void closeChunk(int64_t next_started_ns) {
+        if (!open_) {
+            return;
+        }
+        preroll_.push_back(open_);
+        if (event_) {
+            DashcamWork work;
+            work.chunk = open_;
+            work.event = event_;
+            work.end_ns = event_end_ns_;
+            work.last = next_started_ns > event_end_ns_;
+            work_.push(work);
+            if (work.last) {
+                event_.reset();
+            }
+        }
+        open_.reset();
+    }
+
+    void startEvent(const std::string& source, int64_t when_ns) {
+        if (event_) {
+            event_end_ns_ = std::max(event_end_ns_, when_ns + post_ns_);
+            extended_++;
+            notice("Trigger (" + source + "): event extended.");
+            return;
+        }
+        event_ = std::make_shared<DashcamEvent>();
+        event_->base_path = directory_ + "EVENT_" + getCurrentTime();
+        event_->source = source;
+        event_->triggered_ns = when_ns;
+        event_end_ns_ = when_ns + post_ns_;
+        const int64_t first_ns = !preroll_.empty() ? preroll_.front()->startedNs() : open_ ? open_->startedNs() : when_ns;
+        event_->preroll_seconds = std::max<int64_t>(0, when_ns - first_ns) / 1e9;
+        for (size_t i = 0; i < preroll_.size(); i++) {
+            DashcamWork work;
+            work.chunk = preroll_[i];
+            work.event = event_;
+            work.end_ns = event_end_ns_;
+            work.last = false;
+            work_.push(work);
+        }
+        events_++;
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << "Trigger (" << source << "): saving " << event_->preroll_seconds
+             << " s before and " << post_ns_ / 1000000000LL << " s after to " << event_->base_path << "_*";
+        notice(text.str());
+    }
+
+    // drops the oldest chunks until bytes more fit under the memory cap. false if
+    // they don't even then (what is left is the open chunk and unwritten events)
+    bool makeRoom(size_t bytes) {
+        while (memory_ + static_cast<int64_t>(bytes) > memory_cap_ && !preroll_.empty()) {
+            preroll_.pop_front();
+        }
+        return memory_ + static_cast<int64_t>(bytes) <= memory_cap_;
+    }
+
+    // drops the oldest chunks while the rest still cover pre seconds, and while
+    // memory is over the cap. returns false if it is still over the cap
+    bool trimPreroll() {
+        while (preroll_.size() > 1 && preroll_[1]->startedNs() <= latest_ns_ - pre_ns_) {
+            preroll_.pop_front();
+        }
+        const bool fits = makeRoom(0);
+        const int64_t first_ns = !preroll_.empty() ? preroll_.front()->startedNs() : open_ ? open_->startedNs() : latest_ns_;
+        preroll_ns_ = latest_ns_ - first_ns;
+        return fits;
+    }
+
+    void keeperLoop() {
+        const FrameRing::Record* records[STREAM_WRITE_BATCH];
+        while (true) {
+            std::vector<std::pair<std::string, int64_t> > triggers;
+            {
+                std::lock_guard<std::mutex> lock(trigger_mutex_);
+                triggers.swap(triggers_);
+            }
+            for (size_t i = 0; i < triggers.size(); i++) {
+                startEvent(triggers[i].first, triggers[i].second);
+            }
+            const size_t count = ring_.acquire(records, STREAM_WRITE_BATCH);
+            if (count == 0) {
+                if (stopping_) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(STREAM_WRITER_IDLE_MS));
+                continue;
+            }
+            for (size_t i = 0; i < count; i++) {
+                const FrameRing::Record& record = *records[i];
+                latest_ns_ = std::max(latest_ns_, record.queued_ns);
+                bool keyframe = false;
+                if (record.kind == STREAM_VIDEO) {
+                    scanners_[record.stream].scan(record.payload(), record.size, [&](uint64_t, uint8_t header) {
+                        keyframe = keyframe || isRandomAccessNal(codec_, header);
+                    });
+                }
+                if (keyframe && record.stream == 0) {
+                    closeChunk(record.queued_ns);
+                    // sized like the last chunk, as far as the cap allows
+                    const int64_t room = trimPreroll() ? memory_cap_ - memory_ - 4096 : 0;
+                    skipping_ = room <= 0;
+                    if (!skipping_) {
+                        const size_t expected = preroll_.empty() ? 1 << 20 : preroll_.back()->size();
+                        open_ = std::make_shared<PrerollChunk>(memory_, record.queued_ns,
+                                                               std::min<size_t>(expected, static_cast<size_t>(room)));
+                    }
+                }
+                if (open_ && !skipping_) {
+                    skipping_ = !makeRoom(open_->growthFor(record.size));
+                }
+                // nothing before the first keyframe; nothing while over the memory cap
+                if (!open_ || skipping_) {
+                    if (record.kind == STREAM_VIDEO) {
+                        dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    continue;
+                }
+                open_->add(record, keyframe);
+            }
+            ring_.release();
+            skipping_ = skipping_ || !trimPreroll();
+            peak_memory_ = std::max<int64_t>(peak_memory_, memory_);
+        }
+        closeChunk(INT64_MAX);
+        if (event_) {
+            // the stream ended before the event did
+            DashcamWork work;
+            work.event = event_;
+            work.end_ns = event_end_ns_;
+            work.last = true;
+            work_.push(work);
+            event_.reset();
+        }
+        preroll_.clear();
+        work_.close();
+    }
+
+    void openVideo(DashcamEvent& event, int stream, DashcamEvent::VideoFile& file) {
+        const std::string path = event.base_path + "_" + std::to_string(stream) + (codec_ == CODEC_H265 ? ".h265" : ".h264");
+        file.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file.fd < 0) {
+            notice("Error: cannot create " + path + ": " + strerror(errno));
+            return;
+        }
+        file.index.open(path + ".idx", codec_);
+        event.paths.push_back(path);
+    }
+
+    void writeChunk(DashcamEvent& event, const PrerollChunk& chunk, int64_t end_ns) {
+        for (size_t i = 0; i < chunk.items().size(); i++) {
+            const PrerollChunk::Item& item = chunk.items()[i];
+            if (item.arrived_ns > end_ns) {
+                break;
+            }
+            const uint8_t* data = chunk.data(item);
+            if (item.kind == STREAM_VIDEO) {
+                DashcamEvent::VideoFile& file = event.video[item.stream];
+                // another lens' frames from before its first keyframe can't be decoded
+                if (!file.started) {
+                    if (!item.keyframe) {
+                        continue;
+                    }
+                    file.started = true;
+                    openVideo(event, item.stream, file);
+                }
+                if (file.fd < 0) {
+                    continue;
+                }
+                if (item.keyframe) {
+                    KeyframeEntry entry;
+                    entry.offset = file.offset;
+                    entry.timestamp = item.timestamp;
+                    file.index.add(entry);
+                }
+                struct iovec iov;
+                iov.iov_base = const_cast<uint8_t*>(data);
+                iov.iov_len = item.size;
+                if (!writeAll(file.fd, &iov, 1)) {
+                    notice(std::string("Error: event write failed: ") + strerror(errno));
+                }
+                file.offset += item.size;
+                event.frames++;
+            } else if (item.kind == STREAM_AUDIO) {
+                if (event.audio_fd < 0) {
+                    const std::string path = event.base_path + "_audio.raw";
+                    event.audio_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    if (event.audio_fd >= 0) {
+                        event.paths.push_back(path);
+                    }
+                }
+                struct iovec iov;
+                iov.iov_base = const_cast<uint8_t*>(data);
+                iov.iov_len = item.size;
+                if (event.audio_fd >= 0 && !writeAll(event.audio_fd, &iov, 1)) {
+                    notice(std::string("Error: event write failed: ") + strerror(errno));
+                }
+            } else if (item.kind == STREAM_GYRO) {
+                if (!event.gyro.isOpen()) {
+                    const std::string path = event.base_path + ".gyro";
+                    if (event.gyro.open(path)) {
+                        event.paths.push_back(path);
+                    } else {
+                        notice("Error: " + event.gyro.error());
+                    }
+                }
+                // chunk payloads are packed, so the samples are copied out one at a time
+                for (size_t at = 0; event.gyro.isOpen() && at + sizeof(ins_camera::GyroData) <= item.size;
+                     at += sizeof(ins_camera::GyroData)) {
+                    ins_camera::GyroData sample;
+                    memcpy(&sample, data + at, sizeof(sample));
+                    event.gyro.add(&sample, 1);
+                }
+            }
+            event.bytes += static_cast<int64_t>(item.size);
+            event.last_ns = item.arrived_ns;
+        }
+    }
+
+    // an event's files are synced before it is reported saved
+    void finishEvent(DashcamEvent& event) {
+        for (std::map<int, DashcamEvent::VideoFile>::iterator it = event.video.begin(); it != event.video.end(); ++it) {
+            if (it->second.fd >= 0) {
+                fdatasync(it->second.fd);
+                close(it->second.fd);
+            }
+            it->second.index.close();
+        }
+        if (event.audio_fd >= 0) {
+            fdatasync(event.audio_fd);
+            close(event.audio_fd);
+        }
+        if (event.gyro.isOpen()) {
+            event.gyro.close();
+            syncFile(event.base_path + ".gyro");
+        }
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << "Saved event " << event.base_path << "_* (" << event.preroll_seconds
+             << " s before, " << std::max<int64_t>(0, event.last_ns - event.triggered_ns) / 1e9 << " s after, "
+             << event.frames << " frames, " << formatBytes(event.bytes) << ")";
+        notice(text.str());
+    }
+
+    void writerLoop() {
+        DashcamWork work;
+        while (work_.pop(work)) {
+            if (work.chunk) {
+                writeChunk(*work.event, *work.chunk, work.end_ns);
+            }
+            if (work.last) {
+                finishEvent(*work.event);
+            }
+            work = DashcamWork();  // let go of the chunk
+        }
+    }
+
+public:
+    // directory ends with a separator
+    DashcamRecorder(const std::string& directory, VideoCodec codec, int pre_seconds, int post_seconds, int64_t memory_cap)
+        : ring_(DASHCAM_RING_BYTES), directory_(directory), codec_(codec),
+          pre_ns_(static_cast<int64_t>(pre_seconds) * 1000000000LL),
+          post_ns_(static_cast<int64_t>(post_seconds) * 1000000000LL), memory_cap_(memory_cap), accepting_(false),
+          stopping_(false), work_(DASHCAM_WRITE_QUEUE), event_end_ns_(0), skipping_(false), latest_ns_(0), memory_(0),
+          peak_memory_(0), preroll_ns_(0), frames_(0), dropped_frames_(0), events_(0), extended_(0) {}
+
+    ~DashcamRecorder() {
+        stop();
+    }
+
+    void start() {
+        stopping_ = false;
+        keeper_ = std::thread(&DashcamRecorder::keeperLoop, this);
+        writer_ = std::thread(&DashcamRecorder::writerLoop, this);
+        accepting_ = true;
+    }
+
+    // refuses further data; an event still recording is cut short and saved
+    void stop() {
+        accepting_ = false;
+        stopping_ = true;
+        if (keeper_.joinable()) {
+            keeper_.join();
+        }
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+    }
+
+    // saves the pre-roll and the next post seconds; extends an event already recording
+    void trigger(const std::string& source) {
+        std::lock_guard<std::mutex> lock(trigger_mutex_);
+        triggers_.push_back(std::make_pair(source, nowNs()));
+    }
+
+    std::vector<std::string> takeNotices() {
+        std::lock_guard<std::mutex> lock(notice_mutex_);
+        std::vector<std::string> notices;
+        notices.swap(notices_);
+        return notices;
+    }
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t, int stream_index) override {
+        push(STREAM_VIDEO, stream_index, timestamp, data, size);
+    }
+
+    void OnAudioData(const uint8_t* data, size_t size, int64_t timestamp) override {
+        push(STREAM_AUDIO, 0, timestamp, data, size);
+    }
+
+    void OnGyroData(const std::vector<ins_camera::GyroData>& data) override {
+        if (!data.empty()) {
+            push(STREAM_GYRO, 0, data.front().timestamp, reinterpret_cast<const uint8_t*>(data.data()),
+                 data.size() * sizeof(ins_camera::GyroData));
+        }
+    }
+
+    void OnExposureData(const ins_camera::ExposureData&) override {}
+
+    // one line: pre-roll held, memory against the cap, events
+    std::string status() const {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << "Pre-roll " << preroll_ns_ / 1e9 << " s, memory "
+             << formatBytes(memory_) << " of " << formatBytes(memory_cap_) << " (peak " << formatBytes(peak_memory_)
+             << ", plus a " << formatBytes(static_cast<int64_t>(ring_.capacity())) << " ring), " << events_
+             << " event(s), " << dropped_frames_ << " dropped";
+        return text.str();
+    }
+
+    // after stop()
+    void printStats(std::ostream& out) const {
+        out << "Data: " << frames_ << " callbacks kept, " << dropped_frames_ << " frames dropped (ring full, before the"
+            << " first keyframe or over the memory cap)" << std::endl;
+        out << "Callback time: " << callback_latency_.summary() << " over " << callback_latency_.count() << " callbacks"
+            << std::endl;
+        out << "Memory: peak " << formatBytes(peak_memory_) << " of " << formatBytes(memory_cap_) << " for the pre-roll, plus a "
+            << formatBytes(static_cast<int64_t>(ring_.capacity())) << " ring" << std::endl;
+        out << "Events: " << events_ << " triggered, " << extended_ << " extended by a later trigger" << std::endl;
+    }
+};
+
+// stream-record settings
+struct StreamOptions {
+    int seconds;            // 0: until SIGINT/SIGTERM
+    bool lrv;               // stream the low resolution preview
+    size_t buffer_bytes;    // ring between the SDK callback and the disk
+    int segment_seconds;    // 0: one file per stream
+    int retain_seconds;     // with segments: delete those older than this, 0 keeps all
+
+    StreamOptions()
+        : seconds(0), lrv(false), buffer_bytes(DEFAULT_STREAM_BUFFER_BYTES), segment_seconds(0), retain_seconds(0) {}
+};
+
+// dashcam settings
+struct DashcamOptions {
+    int pre_seconds;       // kept in memory before a trigger
+    int post_seconds;      // saved after it
+    int64_t memory_bytes;  // cap on the pre-roll (and events waiting to be written)
+    std::string fifo_path; // each line written to it is a trigger
+    int seconds;           // 0: until SIGINT/SIGTERM or quit
+    bool lrv;
+
+    DashcamOptions()
+        : pre_seconds(DEFAULT_PREROLL_SEC), post_seconds(DEFAULT_POSTROLL_SEC), memory_bytes(DEFAULT_PREROLL_MEMORY),
+          seconds(0), lrv(false) {}
+};
+
+// copy-storage settings
+struct CopyOptions {
+    bool incremental;      // skip files the destination's manifest already has
+    SchedulePolicy order;  // which files to fetch first
+    TransferFilter filter; // which files to fetch at all
+    bool fit;              // if the destination is short of space, copy what fits instead of refusing
+
+    CopyOptions() : incremental(false), order(DEFAULT_SCHEDULE_POLICY), fit(false) {}
+};
+
+class CameraController {
+private:
+    std::shared_ptr<ins_camera::Camera> camera_;
+    bool is_connected_;
+    std::string preferred_serial_;
+    PhaseTracer tracer_;
+
+    // runs one SDK call as a traced phase
+    template <typename F>
+    auto traced(const char* phase, F call) -> decltype(call()) {
+        ScopedPhase scope(tracer_, phase);
+        return call();
+    }
+
+    // last sub-mode we successfully put the camera into. lets takePhoto() and
+    // startRecording() skip SetPhotoSubMode/SetVideoSubMode round-trips when the
+    // camera is already there. reset on reconnect, failed calls and capture-stopped
+    // notifications (written from the SDK callback thread, hence atomic).
+    enum ModeState {
+        MODE_UNKNOWN = 0,
+        MODE_PHOTO_SINGLE,
+        MODE_VIDEO_NORMAL
+    };
+    std::atomic<int> mode_state_;
+    int mode_switches_sent_;
+    int mode_switches_saved_;
+
+    // time sync is skipped while the camera clock is within this many ms of the host
+    int64_t time_sync_threshold_ms_;
+    // last measured camera minus host clock difference, logged with captures
+    int64_t clock_offset_ms_;
+    int64_t clock_rtt_ms_;
+
+    // all downloads; in interactive and daemon mode takePhoto() queues the
+    // photo with it and returns
+    TransferEngine transfers_;
+    bool async_downloads_;
+
+    // descriptors from the last scan are kept alive so a reconnect can
+    // re-open the same device without probing USB and WiFi again
+    ins_camera::DeviceDiscovery discovery_;
+    std::vector<ins_camera::DeviceDescriptor> device_list_;
+    int selected_index_;
+
+    void releaseDevices() {
+        if (!device_list_.empty()) {
+            discovery_.FreeDeviceDescriptors(device_list_);
+            device_list_.clear();
+        }
+        selected_index_ = -1;
+    }
+
+    // picks which discovered camera to open: the --serial selection if given,
+    // otherwise the most recently used camera from the discovery cache,
+    // otherwise the first one found. returns -1 if --serial matches nothing.
+    int selectDevice() const {
+        if (!preferred_serial_.empty()) {
+            for (size_t i = 0; i < device_list_.size(); i++) {
+                if (device_list_[i].serial_number == preferred_serial_) {
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        }
+
+        const std::vector<DeviceCacheEntry> cache = loadDeviceCache();
+        int best = 0;
+        int64_t best_time = -1;
+        for (size_t i = 0; i < device_list_.size(); i++) {
+            for (size_t j = 0; j < cache.size(); j++) {
+                if (cache[j].serial_number == device_list_[i].serial_number &&
+                    cache[j].connection_type == device_list_[i].info.connection_type &&
+                    cache[j].last_good > best_time) {
+                    best = static_cast<int>(i);
+                    best_time = cache[j].last_good;
+                }
+            }
+        }
+        return best;
+    }
+
+    bool openDevice(const ins_camera::DeviceDescriptor& device) {
+        invalidateModeState();
+        camera_ = std::make_shared<ins_camera::Camera>(device.info);
+        if (!traced("Open", [&] { return camera_->Open(); })) {
+            camera_.reset();
+            return false;
+        }
+        transfers_.attach(camera_, traced("GetHttpBaseUrl", [&] { return camera_->GetHttpBaseUrl(); }));
+        // the camera may change mode on its own when a capture ends (storage full, overheating, ...)
+        camera_->SetCaptureStoppedNotification([this](const std::string&, int) {
+            invalidateModeState();
+        });
+        return true;
+    }
+
+    void invalidateModeState() {
+        mode_state_ = MODE_UNKNOWN;
+    }
+
+    bool ensurePhotoMode() {
+        if (mode_state_ == MODE_PHOTO_SINGLE) {
+            mode_switches_saved_++;
+            return true;
+        }
+        std::cout << "Setting photo mode..." << std::endl;
+        mode_switches_sent_++;
+        bool ret = traced("SetPhotoSubMode", [&] {
+            return camera_->SetPhotoSubMode(ins_camera::SubPhotoMode::PHOTO_SINGLE);
+        });
+        mode_state_ = ret ? MODE_PHOTO_SINGLE : MODE_UNKNOWN;
+        return ret;
+    }
+
+    bool ensureVideoMode() {
+        if (mode_state_ == MODE_VIDEO_NORMAL) {
+            mode_switches_saved_++;
+            return true;
+        }
+        std::cout << "Setting video mode..." << std::endl;
+        mode_switches_sent_++;
+        bool ret = traced("SetVideoSubMode", [&] {
+            return camera_->SetVideoSubMode(ins_camera::SubVideoMode::VIDEO_NORMAL);
+        });
+        mode_state_ = ret ? MODE_VIDEO_NORMAL : MODE_UNKNOWN;
+        return ret;
+    }
+
+    // host wall clock expressed the way the camera keeps time: local time
+    // written as if it were UTC (that's what SyncLocalTimeToCamera expects)
+    static int64_t hostLocalTimeMs(const std::chrono::system_clock::time_point& when) {
+        const std::time_t t = std::chrono::system_clock::to_time_t(when);
+        std::tm tm{};
+#ifdef WIN32
+        localtime_s(&tm, &t);
+        const int64_t seconds = static_cast<int64_t>(_mkgmtime(&tm));
+#else
+        localtime_r(&t, &tm);
+        const int64_t seconds = static_cast<int64_t>(timegm(&tm));
+#endif
+        const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            when.time_since_epoch()).count() % 1000;
+        return seconds * 1000 + ms;
+    }
+
+    // reads the camera clock a few times and keeps the sample with the
+    // smallest round-trip, stopping early once the sync decision can't change.
+    // returns false if the camera didn't report a usable time.
+    bool measureClockOffset(int64_t& offset_ms, int64_t& rtt_ms) {
+        const int max_samples = 3;
+        bool have_sample = false;
+        for (int i = 0; i < max_samples; i++) {
+            const auto wall_before = std::chrono::system_clock::now();
+            const auto before = std::chrono::steady_clock::now();
+            int64_t camera_time = traced("GetCameraMediaTime", [&] { return camera_->GetCameraMediaTime(); });
+            const int64_t rtt = static_cast<int64_t>(elapsedMs(before));
+            if (camera_time <= 0) {
+                return have_sample;
+            }
+            // the SDK doesn't document the unit, normalise seconds/microseconds to ms
+            if (camera_time < 100000000000LL) {
+                camera_time *= 1000;
+            } else if (camera_time > 100000000000000LL) {
+                camera_time /= 1000;
+            }
+
+            // assume the camera read its clock half way through the round-trip
+            const int64_t host_time = hostLocalTimeMs(wall_before + std::chrono::milliseconds(rtt / 2));
+            if (!have_sample || rtt < rtt_ms) {
+                offset_ms = camera_time - host_time;
+                rtt_ms = rtt;
+                have_sample = true;
+            }
+
+            const int64_t drift = offset_ms < 0 ? -offset_ms : offset_ms;
+            if (drift + rtt_ms / 2 <= time_sync_threshold_ms_ || drift - rtt_ms / 2 > time_sync_threshold_ms_) {
+                break;
+            }
+        }
+        return have_sample;
+    }
+
+    // only pushes the host time to the camera if its clock has drifted past the threshold
+    void syncTime() {
+        int64_t offset_ms = 0;
+        int64_t rtt_ms = 0;
+        bool measured = time_sync_threshold_ms_ > 0 && measureClockOffset(offset_ms, rtt_ms);
+        const int64_t drift = offset_ms < 0 ? -offset_ms : offset_ms;
+
+        if (measured && drift <= time_sync_threshold_ms_) {
+            clock_offset_ms_ = offset_ms;
+            clock_rtt_ms_ = rtt_ms;
+            std::cout << "Camera clock offset " << formatClockOffset() << ", within "
+                      << time_sync_threshold_ms_ << " ms, skipping time sync." << std::endl;
+            return;
+        }
+
+        const auto now = std::chrono::system_clock::now();
+        const uint64_t time_seconds = static_cast<uint64_t>(hostLocalTimeMs(now) / 1000);
+        if (traced("SyncLocalTimeToCamera", [&] { return camera_->SyncLocalTimeToCamera(time_seconds); })) {
+            // the camera only takes whole seconds
+            clock_offset_ms_ = -(hostLocalTimeMs(now) % 1000);
+            clock_rtt_ms_ = measured ? rtt_ms : -1;
+            if (measured) {
+                std::cout << "Camera clock was off by " << offset_ms << " ms, synced to host time." << std::endl;
+            }
+        } else {
+            clock_offset_ms_ = measured ? offset_ms : 0;
+            clock_rtt_ms_ = measured ? rtt_ms : -1;
+            std::cerr << "Warning: Failed to sync time to camera." << std::endl;
+        }
+    }
+
+public:
+    CameraController()
+        : is_connected_(false), mode_state_(MODE_UNKNOWN), mode_switches_sent_(0),
+          mode_switches_saved_(0), time_sync_threshold_ms_(DEFAULT_TIME_SYNC_THRESHOLD_MS),
+          clock_offset_ms_(0), clock_rtt_ms_(-1), transfers_(tracer_), async_downloads_(false), selected_index_(-1) {}
+
+    ~CameraController() {
+        disconnect();
+        releaseDevices();
+    }
+
+    // in interactive and daemon mode photos are downloaded in the background
+    void setAsyncDownloads(bool enabled) {
+        async_downloads_ = enabled;
+    }
+
+    // blocks until every queued background download has finished
+    void waitForDownloads() {
+        transfers_.waitIdle();
+    }
+
+    void printPendingDownloads() {
+        transfers_.printPending();
+    }
+
+    // only connect to the camera with this serial number
+    void setPreferredSerial(const std::string& serial) {
+        preferred_serial_ = serial;
+    }
+
+    // connections per file for HTTP downloads, 0 disables the HTTP path
+    void setHttpConnections(int connections) {
+        transfers_.setHttpConnections(connections);
+    }
+
+    int httpConnections() const {
+        return transfers_.httpConnections();
+    }
+
+    // 0 never gives up on a download that stopped making progress
+    void setStallTimeout(int seconds) {
+        transfers_.setStallTimeout(seconds);
+    }
+
+    int stallTimeout() const {
+        return transfers_.stallTimeout();
+    }
+
+    // 0 forces a sync on every connect
+    void setTimeSyncThreshold(int64_t threshold_ms) {
+        time_sync_threshold_ms_ = threshold_ms < 0 ? 0 : threshold_ms;
+    }
+
+    int64_t timeSyncThreshold() const {
+        return time_sync_threshold_ms_;
+    }
+
+    std::string formatClockOffset() const {
+        std::string text = (clock_offset_ms_ >= 0 ? "+" : "") + std::to_string(clock_offset_ms_) + " ms";
+        if (clock_rtt_ms_ >= 0) {
+            text += " (rtt " + std::to_string(clock_rtt_ms_) + " ms)";
+        }
+        return text;
+    }
+
+    std::string connectedSerial() const {
+        if (!is_connected_ || selected_index_ < 0) {
+            return std::string();
+        }
+        return device_list_[selected_index_].serial_number;
+    }
+
+    bool discoverAndConnect() {
+        ins_camera::SetLogLevel(ins_camera::LogLevel::ERR);
+        const auto connect_start = std::chrono::steady_clock::now();
+
+        // fast path: re-open the device we used last time in this process
+        if (selected_index_ >= 0) {
+            const auto& last_device = device_list_[selected_index_];
+            std::cout << "Reconnecting to: " << last_device.camera_name
+                      << " (SN: " << last_device.serial_number << ")..." << std::endl;
+            if (openDevice(last_device)) {
+                const double open_ms = elapsedMs(connect_start);
+                const auto sync_start = std::chrono::steady_clock::now();
+                syncTime();
+                is_connected_ = true;
+                rememberDevice(last_device);
+                std::cout << "Successfully connected to camera!" << std::endl;
+                std::cout << "Connect timing (warm): discovery skipped, open "
+                          << std::fixed << std::setprecision(1) << open_ms << " ms, time sync "
+                          << elapsedMs(sync_start) << " ms, total " << elapsedMs(connect_start) << " ms" << std::endl;
+                return true;
+            }
+            std::cout << "Reconnect failed, rescanning..." << std::endl;
+        }
+        releaseDevices();
+
+        std::cout << "Discovering Insta360 cameras..." << std::endl;
+        const auto discovery_start = std::chrono::steady_clock::now();
+        device_list_ = traced("discovery", [&] { return discovery_.GetAvailableDevices(); });
+        const double discovery_ms = elapsedMs(discovery_start);
+        
+        if (device_list_.empty()) {
+            std::cerr << "Error: No Insta360 camera found." << std::endl;
+            std::cerr << "Please ensure:" << std::endl;
+            std::cerr << "  1. Camera is powered on" << std::endl;
+            std::cerr << "  2. Camera is connected via USB or WiFi" << std::endl;
+            return false;
+        }
+
+        std::cout << "Found " << device_list_.size() << " camera(s):" << std::endl;
+        for (size_t i = 0; i < device_list_.size(); i++) {
+            const auto& device = device_list_[i];
+            std::cout << "  [" << i << "] " << device.camera_name 
+                      << " (SN: " << device.serial_number 
+                      << ", FW: " << device.fw_version
+                      << ", " << connectionTypeName(device.info.connection_type) << ")" << std::endl;
+        }
+
+        int index = selectDevice();
+        if (index < 0) {
+            std::cerr << "Error: No camera with serial number " << preferred_serial_ << " found." << std::endl;
+            releaseDevices();
+            return false;
+        }
+
+        const auto& selected_device = device_list_[index];
+        std::cout << "\nConnecting to: " << selected_device.camera_name 
+                  << " (SN: " << selected_device.serial_number << ")..." << std::endl;
+
+        const auto open_start = std::chrono::steady_clock::now();
+        if (!openDevice(selected_device)) {
+            std::cerr << "Error: Failed to open camera connection." << std::endl;
+            releaseDevices();
+            return false;
+        }
+        const double open_ms = elapsedMs(open_start);
+
+        // sync time to camera
+        const auto sync_start = std::chrono::steady_clock::now();
+        syncTime();
+        const double sync_ms = elapsedMs(sync_start);
+
+        selected_index_ = index;
+        is_connected_ = true;
+        rememberDevice(selected_device);
+        std::cout << "Successfully connected to camera!" << std::endl;
+        std::cout << "Connect timing (cold): discovery " << std::fixed << std::setprecision(1) << discovery_ms
+                  << " ms, open " << open_ms << " ms, time sync " << sync_ms
+                  << " ms, total " << elapsedMs(connect_start) << " ms" << std::endl;
+        
+        return true;
+    }
+
+    void disconnect() {
+        transfers_.detach();
+        invalidateModeState();
+        if (camera_ && is_connected_) {
+            camera_->Close();
+            is_connected_ = false;
+            std::cout << "Disconnected from camera." << std::endl;
+        }
+    }
+
+    bool takePhoto(const std::string& save_directory = "./") {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        // check if camera is still connected
+        if (!camera_->IsConnected()) {
+            std::cerr << "Error: Camera connection lost." << std::endl;
+            is_connected_ = false;
+            return false;
+        }
+
+        if (!ensurePhotoMode()) {
+            std::cerr << "Warning: Failed to set photo mode, continuing anyway..." << std::endl;
+        }
+
+        std::cout << "Taking photo..." << std::endl;
+        const auto url = traced("TakePhoto", [&] { return camera_->TakePhoto(); });
+        
+        if (url.Empty() || !url.IsSingleOrigin()) {
+            std::cerr << "Error: Failed to take photo." << std::endl;
+            invalidateModeState();
+            return false;
+        }
+
+        const std::string photo_url = url.GetSingleOrigin();
+        std::cout << "Photo captured! URL: " << photo_url << std::endl;
+        std::cout << "Camera clock offset: " << formatClockOffset() << std::endl;
+
+        // download the photo if save directory is provided
+        if (!save_directory.empty()) {
+            std::string save_path = save_directory;
+            if (save_path.back() != '/' && save_path.back() != '\\') {
+                save_path += "/";
+            }
+            
+            // check if directory exists
+            if (!fileExists(save_path)) {
+                std::cerr << "Warning: Save directory does not exist: " << save_path << std::endl;
+                std::cerr << "Photo URL saved on camera: " << photo_url << std::endl;
+                return true;
+            }
+
+            std::string file_name = getFileName(photo_url);
+            if (file_name.empty()) {
+                file_name = "photo_" + getCurrentTime() + ".jpg";
+            }
+            
+            std::string full_path = save_path + file_name;
+            if (async_downloads_) {
+                TransferJob job;
+                job.remote_url = photo_url;
+                job.local_path = full_path;
+                job.priority = 0;
+                transfers_.enqueue(job);
+                return true;
+            }
+
+            std::cout << "Downloading photo to: " << full_path << std::endl;
+            DownloadResult result = transfers_.download(photo_url, full_path, true);
+            if (!result.warning.empty()) {
+                std::cerr << "Warning: " << result.warning << std::endl;
+            }
+            if (!result.success) {
+                std::cerr << "Error: " << result.error << std::endl;
+                std::cerr << "Photo URL on camera: " << photo_url << std::endl;
+                return false;
+            }
+            std::cout << "Photo successfully downloaded to: " << full_path 
+                     << " (" << formatBytes(result.file_size) << ")" << std::endl;
+            return true;
+        }
+
+        return true;
+    }
+
+    bool shutdownCamera() {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        waitForDownloads();
+        std::cout << "Shutting down camera..." << std::endl;
+        invalidateModeState();
+        bool ret = traced("ShutdownCamera", [&] { return camera_->ShutdownCamera(); });
+        
+        if (ret) {
+            std::cout << "Camera shutdown command sent successfully." << std::endl;
+            is_connected_ = false;
+            return true;
+        } else {
+            std::cerr << "Error: Failed to shutdown camera." << std::endl;
+            return false;
+        }
+    }
+
+    bool getBatteryStatus() {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        ins_camera::BatteryStatus status{};
+        bool ret = traced("GetBatteryStatus", [&] { return camera_->GetBatteryStatus(status); });
+        
+        if (!ret) {
+            std::cerr << "Error: Failed to get battery status." << std::endl;
+            return false;
+        }
+
+        std::cout << "Battery Status:" << std::endl;
+        std::cout << "  Power Type: " << (status.power_type == ins_camera::PowerType::BATTERY ? "Battery" : "Adapter") << std::endl;
+        std::cout << "  Battery Level: " << status.battery_level << "%" << std::endl;
+        std::cout << "  Battery Scale: " << status.battery_scale << std::endl;
+        
+        return true;
+    }
+
+    bool getStorageStatus() {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        ins_camera::StorageStatus status{};
+        bool ret = traced("GetStorageState", [&] { return camera_->GetStorageState(status); });
+        
+        if (!ret) {
+            std::cerr << "Error: Failed to get storage status." << std::endl;
+            return false;
+        }
+
+        // convert bytes to GB or MB
+        auto formatBytes = [](uint64_t bytes) -> std::string {
+            const uint64_t GB = 1024ULL * 1024ULL * 1024ULL;
+            const uint64_t MB = 1024ULL * 1024ULL;
+            
+            if (bytes >= GB) {
+                double gb = static_cast<double>(bytes) / GB;
+                char buffer[32];
+                snprintf(buffer, sizeof(buffer), "%.2f GB", gb);
+                return std::string(buffer);
+            } else if (bytes >= MB) {
+                double mb = static_cast<double>(bytes) / MB;
+                char buffer[32];
+                snprintf(buffer, sizeof(buffer), "%.2f MB", mb);
+                return std::string(buffer);
+            } else {
+                return std::to_string(bytes) + " bytes";
+            }
+        };
+
+        // convert CardState enum to readable text
+        std::string state_text;
+        switch (status.state) {
+            case ins_camera::STOR_CS_PASS:
+                state_text = "OK";
+                break;
+            case ins_camera::STOR_CS_NOCARD:
+                state_text = "No Card";
+                break;
+            case ins_camera::STOR_CS_NOSPACE:
+                state_text = "No Space";
+                break;
+            case ins_camera::STOR_CS_INVALID_FORMAT:
+                state_text = "Invalid Format";
+                break;
+            case ins_camera::STOR_CS_WPCARD:
+                state_text = "Write Protected";
+                break;
+            case ins_camera::STOR_CS_OTHER_ERROR:
+                state_text = "Other Error";
+                break;
+            default:
+                state_text = "Unknown";
+                break;
+        }
+
+        uint64_t used_space = status.total_space - status.free_space;
+        double used_percentage = status.total_space > 0 
+            ? (static_cast<double>(used_space) / status.total_space) * 100.0 
+            : 0.0;
+
+        std::cout << "Storage Status:" << std::endl;
+        std::cout << "  State: " << state_text << std::endl;
+        std::cout << "  Total Space: " << formatBytes(status.total_space) << std::endl;
+        std::cout << "  Free Space: " << formatBytes(status.free_space) << std::endl;
+        std::cout << "  Used Space: " << formatBytes(used_space) << " (" 
+                  << std::fixed << std::setprecision(1) << used_percentage << "%)" << std::endl;
+        
+        return true;
+    }
+
+    bool setVideoMode() {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        if (!ensureVideoMode()) {
+            std::cerr << "Error: Failed to set video mode." << std::endl;
+            return false;
+        }
+
+        std::cout << "Video mode set successfully." << std::endl;
+        return true;
+    }
+
+    bool startRecording() {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        // check if camera is still connected
+        if (!camera_->IsConnected()) {
+            std::cerr << "Error: Camera connection lost." << std::endl;
+            is_connected_ = false;
+            return false;
+        }
+
+        // set video mode first
+        bool ret = ensureVideoMode();
+        if (!ret) {
+            std::cerr << "Warning: Failed to set video mode, continuing anyway..." << std::endl;
+        }
+
+        // set video capture parameters (not sure yet exactly what to set the parameters to)
+        // ins_camera::RecordParams record_params;
+        // record_params.resolution = ins_camera::VideoResolution::RES_3840_3840P30;
+        // record_params.bitrate = 1024 * 1024 * 10; // 10 Mbps default
+        // ret = camera_->SetVideoCaptureParams(record_params, ins_camera::CameraFunctionMode::FUNCTION_MODE_NORMAL_VIDEO);
+        // if (!ret) {
+        //     std::cerr << "Warning: Failed to set video capture params, continuing anyway..." << std::endl;
+        // }
+
+        std::cout << "Starting recording..." << std::endl;
+        ret = traced("StartRecording", [&] { return camera_->StartRecording(); });
+        
+        if (!ret) {
+            std::cerr << "Error: Failed to start recording." << std::endl;
+            invalidateModeState();
+            return false;
+        }
+
+        std::cout << "Recording started successfully!" << std::endl;
+        std::cout << "Camera clock offset: " << formatClockOffset() << std::endl;
+        return true;
+    }
+
+    // record-stop --preview: LRV proxies right away, origins behind them
+    bool downloadPreview(const ins_camera::MediaUrl& url, const std::string& save_path) {
+        bool all_success = true;
+        const auto& lrvs = url.LRVUrls();
+        for (size_t i = 0; i < lrvs.size(); i++) {
+            const std::string full_path = save_path + getFileName(lrvs[i]);
+            std::cout << "Downloading preview to: " << full_path << std::endl;
+            const auto start = std::chrono::steady_clock::now();
+            DownloadResult result = transfers_.download(lrvs[i], full_path, true);
+            if (!result.warning.empty()) {
+                std::cerr << "Warning: " << result.warning << std::endl;
+            }
+            if (result.success) {
+                std::cout << std::fixed << std::setprecision(1) << "Preview ready: " << full_path << " ("
+                          << formatBytes(result.file_size) << ", " << elapsedMs(start) / 1000.0 << " s)" << std::endl;
+            } else {
+                std::cerr << "Error: " << result.error << std::endl;
+                all_success = false;
+            }
+        }
+
+        const auto& origins = url.OriginUrls();
+        if (!async_downloads_) {
+            std::cout << "Downloading full resolution..." << std::endl;
+            return downloadOrigins(origins, save_path) && all_success;
+        }
+        for (size_t i = 0; i < origins.size(); i++) {
+            TransferJob job;
+            job.remote_url = origins[i];
+            job.local_path = save_path + getFileName(origins[i]);
+            job.priority = ORIGIN_DOWNLOAD_PRIORITY;
+            transfers_.enqueue(job);
+        }
+        return all_success;
+    }
+
+    // downloads the origin files of one recording. several (one per lens) are fetched
+    // together and only kept under their real names if all of them made it.
+    bool downloadOrigins(const std::vector<std::string>& origins, const std::string& save_path) {
+        std::vector<std::string> full_paths;
+        std::cout << "Video URLs (" << origins.size() << "):" << std::endl;
+        for (size_t i = 0; i < origins.size(); i++) {
+            std::string file_name = getFileName(origins[i]);
+            if (file_name.empty()) {
+                file_name = "video_" + getCurrentTime() + "_" + std::to_string(i) + ".mp4";
+            }
+            full_paths.push_back(save_path + file_name);
+            std::cout << "  [" << (i + 1) << "/" << origins.size() << "] " << origins[i] << " -> " << full_paths[i] << std::endl;
+        }
+
+        std::vector<DownloadResult> results;
+        const bool all_success = transfers_.downloadGroup(origins, full_paths, results);
+        int downloaded = 0;
+        for (size_t i = 0; i < origins.size(); i++) {
+            if (!results[i].warning.empty()) {
+                std::cerr << "Warning: " << getFileName(full_paths[i]) << ": " << results[i].warning << std::endl;
+            }
+            if (!results[i].success) {
+                std::cerr << "Error: " << results[i].error << std::endl;
+                continue;
+            }
+            downloaded++;
+            if (all_success) {
+                std::cout << "Successfully downloaded: " << full_paths[i]
+                          << " (" << formatBytes(results[i].file_size) << ")" << std::endl;
+            }
+        }
+        if (!all_success) {
+            std::cerr << "Error: Recording incomplete, " << downloaded << " of " << origins.size()
+                      << " file(s) downloaded";
+            if (downloaded > 0) {
+                std::cerr << " (kept as *" << INCOMPLETE_SUFFIX << ")";
+            }
+            std::cerr << ". All files remain on the camera." << std::endl;
+        }
+        return all_success;
+    }
+
+    // with preview, the recording's LRV proxy is downloaded first and the full-resolution
+    // origins are left to the background queue (interactive/daemon) or fetched afterwards
+    bool stopRecording(const std::string& save_directory = "./", bool preview = false) {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        // check if camera is still connected
+        if (!camera_->IsConnected()) {
+            std::cerr << "Error: Camera connection lost." << std::endl;
+            is_connected_ = false;
+            return false;
+        }
+
+        std::cout << "Stopping recording..." << std::endl;
+        const auto url = traced("StopRecording", [&] { return camera_->StopRecording(); });
+        
+        if (url.Empty()) {
+            std::cerr << "Error: Failed to stop recording or no video was recorded." << std::endl;
+            invalidateModeState();
+            return false;
+        }
+
+        std::cout << "Recording stopped successfully!" << std::endl;
+        std::cout << "Camera clock offset: " << formatClockOffset() << std::endl;
+        
+        // Prepare save directory
+        std::string save_path = save_directory;
+        if (!save_path.empty() && save_path.back() != '/' && save_path.back() != '\\') {
+            save_path += "/";
+        }
+        
+        // Check if directory exists (if save directory is provided)
+        if (!save_directory.empty() && !fileExists(save_path)) {
+            std::cerr << "Warning: Save directory does not exist: " << save_path << std::endl;
+            std::cerr << "Video URL(s) saved on camera:" << std::endl;
+            if (url.IsSingleOrigin()) {
+                std::cout << "  " << url.GetSingleOrigin() << std::endl;
+            } else {
+                const auto& origins = url.OriginUrls();
+                for (size_t i = 0; i < origins.size(); i++) {
+                    std::cout << "  [" << i << "] " << origins[i] << std::endl;
+                }
+            }
+            return true;
+        }
+
+        // refuse up front rather than fill the card and leave half a recording behind
+        if (!save_directory.empty()) {
+            std::vector<std::string> needed = url.OriginUrls();
+            if (preview) {
+                needed.insert(needed.end(), url.LRVUrls().begin(), url.LRVUrls().end());
+            }
+            std::map<std::string, int64_t> sizes;
+            transfers_.remoteSizes(needed, sizes);
+            if (!admitDownloads(needed, sizes, save_path, false)) {
+                std::cerr << "Error: Recording not downloaded, it remains on the camera:" << std::endl;
+                const auto& origins = url.OriginUrls();
+                for (size_t i = 0; i < origins.size(); i++) {
+                    std::cerr << "  " << origins[i] << std::endl;
+                }
+                return false;
+            }
+        }
+
+        if (!save_directory.empty() && preview) {
+            if (!url.LRVUrls().empty()) {
+                return downloadPreview(url, save_path);
+            }
+            std::cout << "No LRV preview for this recording, downloading the full video." << std::endl;
+        }
+
+        // Download video file(s) if save directory is provided
+        if (!save_directory.empty()) {
+            bool all_success = true;
+            
+            if (url.IsSingleOrigin()) {
+                const std::string video_url = url.GetSingleOrigin();
+                std::cout << "Video URL: " << video_url << std::endl;
+                
+                std::string file_name = getFileName(video_url);
+                if (file_name.empty()) {
+                    file_name = "video_" + getCurrentTime() + ".mp4";
+                }
+                
+                std::string full_path = save_path + file_name;
+                std::cout << "Downloading video to: " << full_path << std::endl;
+
+                DownloadResult result = transfers_.download(video_url, full_path, true);
+                if (!result.warning.empty()) {
+                    std::cerr << "Warning: " << result.warning << std::endl;
+                }
+                if (result.success) {
+                    std::cout << "Video successfully downloaded to: " << full_path 
+                             << " (" << formatBytes(result.file_size) << ")" << std::endl;
+                } else {
+                    std::cerr << "Error: " << result.error << std::endl;
+                    std::cerr << "Video URL on camera: " << video_url << std::endl;
+                    all_success = false;
+                }
+            } else {
+                all_success = downloadOrigins(url.OriginUrls(), save_path);
+            }
+            
+            return all_success;
+        } else {
+            // display video URL(s) if no save directory provided
+            if (url.IsSingleOrigin()) {
+                std::cout << "Video URL: " << url.GetSingleOrigin() << std::endl;
+            } else {
+                const auto& origins = url.OriginUrls();
+                std::cout << "Video URLs (" << origins.size() << "):" << std::endl;
+                for (size_t i = 0; i < origins.size(); i++) {
+                    std::cout << "  [" << i << "] " << origins[i] << std::endl;
+                }
+            }
+        }
+        
+        return true;
+    }
+
+    // free-space admission for downloads into save_path. sizes (camera path -> bytes,
+    // from the HTTP server) lists what still has to be transferred. files without an
+    // entry can't be admitted up front; that is reported and they are only checked when
+    // their download starts. if the batch doesn't fit, fit keeps urls in their order while
+    // they still fit, otherwise the batch is refused. returns false if nothing should be
+    // downloaded.
+    bool admitDownloads(std::vector<std::string>& urls, const std::map<std::string, int64_t>& sizes,
+                        const std::string& save_path, bool fit) {
+        const int64_t space = spaceForDownloads(save_path);
+        int64_t needed = 0;
+        size_t unknown = 0;
+        for (size_t i = 0; i < urls.size(); i++) {
+            std::map<std::string, int64_t>::const_iterator size = sizes.find(urls[i]);
+            if (size == sizes.end()) {
+                unknown++;
+            } else {
+                needed += size->second;
+            }
+        }
+        if (space >= 0 && unknown > 0) {
+            if (unknown == urls.size()) {
+                std::cout << "Free-space check skipped, file sizes need the camera's HTTP server;"
+                          << " each file is checked when its download starts." << std::endl;
+            } else {
+                std::cout << "Free-space check skipped for " << unknown << " of " << urls.size()
+                          << " file(s) of unknown size; those are checked when their download starts." << std::endl;
+            }
+        }
+        if (space < 0 || needed <= space) {
+            return true;
+        }
+        std::cerr << "Not enough space in " << save_path << ": " << formatBytes(needed) << " to download, "
+                  << formatBytes(space) << " free (" << formatBytes(DISK_SPACE_RESERVE) << " kept in reserve)." << std::endl;
+        if (!fit) {
+            return false;
+        }
+        std::vector<std::string> admitted;
+        int64_t remaining = space;
+        for (size_t i = 0; i < urls.size(); i++) {
+            std::map<std::string, int64_t>::const_iterator size = sizes.find(urls[i]);
+            if (size != sizes.end() && size->second > remaining) {
+                continue;
+            }
+            remaining -= size == sizes.end() ? 0 : size->second;
+            admitted.push_back(urls[i]);
+        }
+        std::cout << "Downloading the " << admitted.size() << " of " << urls.size() << " file(s) that fit ("
+                  << formatBytes(space - remaining) << "), the rest stays on the camera." << std::endl;
+        urls.swap(admitted);
+        return !urls.empty();
+    }
+
+    // records the camera's live stream into save_directory, as one file per stream
+    // or as rolling segments, until options.seconds pass or SIGINT/SIGTERM arrives
+    bool recordStream(const std::string& save_directory, const StreamOptions& options) {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        std::string save_path = save_directory;
+        if (save_path.back() != '/' && save_path.back() != '\\') {
+            save_path += "/";
+        }
+        if (!fileExists(save_path)) {
+            std::cerr << "Error: Save directory does not exist: " << save_path << std::endl;
+            return false;
+        }
+
+        const bool h265 = camera_->GetVideoEncodeType() == ins_camera::VideoEncodeType::H265;
+        std::shared_ptr<StreamRecorder> recorder = std::make_shared<StreamRecorder>(
+            options.buffer_bytes, save_path + "LIVE_" + getCurrentTime(), h265 ? CODEC_H265 : CODEC_H264);
+        recorder->setSegments(options.segment_seconds, options.retain_seconds);
+        std::shared_ptr<ins_camera::StreamDelegate> delegate = recorder;
+        camera_->SetStreamDelegate(delegate);
+        recorder->start();
+
+        ins_camera::LiveStreamParam param;
+        param.video_resolution = ins_camera::VideoResolution::RES_3840_1920P30;
+        param.lrv_video_resulution = ins_camera::VideoResolution::RES_1440_720P30;
+        param.enable_audio = false;
+        param.using_lrv = options.lrv;
+
+        // Ctrl-C ends the recording, not the program
+        struct sigaction sa{};
+        struct sigaction old_int{};
+        struct sigaction old_term{};
+        sa.sa_handler = handleStreamSignal;
+        sigemptyset(&sa.sa_mask);
+        g_stream_stop = 0;
+        sigaction(SIGINT, &sa, &old_int);
+        sigaction(SIGTERM, &sa, &old_term);
+
+        bool success = traced("StartLiveStreaming", [&] { return camera_->StartLiveStreaming(param); });
+        if (!success) {
+            std::cerr << "Error: Failed to start the live stream." << std::endl;
+        } else {
+            std::cout << "Streaming " << (h265 ? "H.265" : "H.264") << (options.lrv ? " (preview resolution)" : "") << " to "
+                      << save_path;
+            if (options.segment_seconds > 0) {
+                std::cout << " in " << options.segment_seconds << " s segments";
+                if (options.retain_seconds > 0) {
+                    std::cout << ", keeping the last " << options.retain_seconds << " s";
+                }
+            }
+            std::cout << (options.seconds > 0 ? " for " + std::to_string(options.seconds) + " s" : std::string(", Ctrl-C to stop"))
+                      << "..." << std::endl;
+            const auto start = std::chrono::steady_clock::now();
+            int shown = 0;
+            while (!g_stream_stop && (options.seconds <= 0 || elapsedMs(start) < options.seconds * 1000.0)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                const int elapsed = static_cast<int>(elapsedMs(start) / 1000.0);
+                if (elapsed > shown) {
+                    shown = elapsed;
+                    std::cout << "\rStreaming: " << elapsed << " s, " << recorder->frames() << " frames, "
+                              << formatBytes(recorder->bytes()) << ", " << recorder->droppedFrames() << " dropped   "
+                              << std::flush;
+                }
+            }
+            std::cout << std::endl;
+            if (!traced("StopLiveStreaming", [&] { return camera_->StopLiveStreaming(); })) {
+                std::cerr << "Warning: Failed to stop the live stream cleanly." << std::endl;
+            }
+        }
+        sigaction(SIGINT, &old_int, nullptr);
+        sigaction(SIGTERM, &old_term, nullptr);
+        recorder->stop();
+
+        for (size_t i = 0; i < recorder->paths().size(); i++) {
+            if (recorder->segmented()) {
+                std::cout << "Segments: " << recorder->paths()[i] << std::endl;
+            } else {
+                std::cout << "Saved: " << recorder->paths()[i] << " (" << formatBytes(getFileSize(recorder->paths()[i]))
+                          << ")" << std::endl;
+            }
+        }
+        recorder->printStats(std::cout);
+        if (!recorder->writeError().empty()) {
+            std::cerr << "Error: " << recorder->writeError() << std::endl;
+            success = false;
+        }
+        return success;
+    }
+
+    // streams into a DashcamRecorder and saves an event into save_directory on every
+    // trigger: a line on stdin (Enter or "trigger"), SIGUSR1, or a line written to
+    // options.fifo_path. runs until options.seconds pass, "quit", SIGINT or SIGTERM.
+    bool runDashcam(const std::string& save_directory, const DashcamOptions& options) {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        std::string save_path = save_directory;
+        if (save_path.back() != '/' && save_path.back() != '\\') {
+            save_path += "/";
+        }
+        if (!fileExists(save_path)) {
+            std::cerr << "Error: Save directory does not exist: " << save_path << std::endl;
+            return false;
+        }
+
+        // opened read-write so the FIFO never reports end of file between writers
+        int fifo = -1;
+        if (!options.fifo_path.empty()) {
+            if (mkfifo(options.fifo_path.c_str(), 0600) != 0 && errno != EEXIST) {
+                std::cerr << "Error: Cannot create FIFO " << options.fifo_path << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            fifo = open(options.fifo_path.c_str(), O_RDWR | O_NONBLOCK);
+            if (fifo < 0) {
+                std::cerr << "Error: Cannot open FIFO " << options.fifo_path << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+        }
+
+        const bool h265 = camera_->GetVideoEncodeType() == ins_camera::VideoEncodeType::H265;
+        std::shared_ptr<DashcamRecorder> recorder = std::make_shared<DashcamRecorder>(
+            save_path, h265 ? CODEC_H265 : CODEC_H264, options.pre_seconds, options.post_seconds, options.memory_bytes);
+        std::shared_ptr<ins_camera::StreamDelegate> delegate = recorder;
+        camera_->SetStreamDelegate(delegate);
+        recorder->start();
+
+        ins_camera::LiveStreamParam param;
+        param.video_resolution = ins_camera::VideoResolution::RES_3840_1920P30;
+        param.lrv_video_resulution = ins_camera::VideoResolution::RES_1440_720P30;
+        param.enable_audio = true;
+        param.enable_gyro = true;
+        param.using_lrv = options.lrv;
+
+        struct sigaction sa{};
+        struct sigaction trigger_sa{};
+        struct sigaction old_int{};
+        struct sigaction old_term{};
+        struct sigaction old_usr1{};
+        sa.sa_handler = handleStreamSignal;
+        sigemptyset(&sa.sa_mask);
+        trigger_sa.sa_handler = handleDashcamTrigger;
+        sigemptyset(&trigger_sa.sa_mask);
+        g_stream_stop = 0;
+        g_dashcam_trigger = 0;
+        sigaction(SIGINT, &sa, &old_int);
+        sigaction(SIGTERM, &sa, &old_term);
+        sigaction(SIGUSR1, &trigger_sa, &old_usr1);
+
+        bool success = traced("StartLiveStreaming", [&] { return camera_->StartLiveStreaming(param); });
+        if (!success) {
+            std::cerr << "Error: Failed to start the live stream." << std::endl;
+        } else {
+            std::cout << "Dashcam: keeping " << options.pre_seconds << " s in memory (at most "
+                      << formatBytes(options.memory_bytes) << "), saving " << options.post_seconds
+                      << " s more on a trigger, into " << save_path << std::endl;
+            std::cout << "Trigger with Enter, SIGUSR1 (kill -USR1 " << getpid() << ")";
+            if (fifo >= 0) {
+                std::cout << " or a line to " << options.fifo_path;
+            }
+            std::cout << ". 'status' shows memory use, 'quit' stops." << std::endl;
+
+            const auto start = std::chrono::steady_clock::now();
+            bool stdin_open = true;
+            std::string stdin_line;
+            std::string fifo_line;
+            bool quit = false;
+            while (!quit && !g_stream_stop && (options.seconds <= 0 || elapsedMs(start) < options.seconds * 1000.0)) {
+                struct pollfd fds[2];
+                int nfds = 0;
+                if (stdin_open) {
+                    fds[nfds].fd = STDIN_FILENO;
+                    fds[nfds].events = POLLIN;
+                    nfds++;
+                }
+                if (fifo >= 0) {
+                    fds[nfds].fd = fifo;
+                    fds[nfds].events = POLLIN;
+                    nfds++;
+                }
+                if (poll(fds, nfds, 100) > 0) {
+                    for (int i = 0; i < nfds; i++) {
+                        if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+                            continue;
+                        }
+                        char buffer[512];
+                        const ssize_t got = read(fds[i].fd, buffer, sizeof(buffer));
+                        if (got <= 0) {
+                            if (fds[i].fd == STDIN_FILENO && (got == 0 || errno != EINTR)) {
+                                stdin_open = false;
+                            }
+                            continue;
+                        }
+                        std::string& pending = fds[i].fd == STDIN_FILENO ? stdin_line : fifo_line;
+                        pending.append(buffer, static_cast<size_t>(got));
+                        size_t newline;
+                        while ((newline = pending.find('\n')) != std::string::npos) {
+                            std::string line = pending.substr(0, newline);
+                            pending.erase(0, newline + 1);
+                            const size_t first = line.find_first_not_of(" \t\r");
+                            line = first == std::string::npos ? "" : line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+                            if (fds[i].fd != STDIN_FILENO) {
+                                recorder->trigger(line.empty() ? "FIFO" : "FIFO: " + line);
+                            } else if (line.empty() || line == "trigger") {
+                                recorder->trigger("keyboard");
+                            } else if (line == "status") {
+                                std::cout << recorder->status() << std::endl;
+                            } else if (line == "quit" || line == "exit") {
+                                quit = true;
+                            } else {
+                                std::cout << "Commands: trigger (or just Enter), status, quit" << std::endl;
+                            }
+                        }
+                    }
+                }
+                if (g_dashcam_trigger) {
+                    g_dashcam_trigger = 0;
+                    recorder->trigger("SIGUSR1");
+                }
+                const std::vector<std::string> notices = recorder->takeNotices();
+                for (size_t i = 0; i < notices.size(); i++) {
+                    (notices[i].compare(0, 6, "Error:") == 0 ? std::cerr : std::cout) << notices[i] << std::endl;
+                }
+            }
+            if (!traced("StopLiveStreaming", [&] { return camera_->StopLiveStreaming(); })) {
+                std::cerr << "Warning: Failed to stop the live stream cleanly." << std::endl;
+            }
+        }
+        sigaction(SIGINT, &old_int, nullptr);
+        sigaction(SIGTERM, &old_term, nullptr);
+        sigaction(SIGUSR1, &old_usr1, nullptr);
+        recorder->stop();
+        if (fifo >= 0) {
+            close(fifo);
+        }
+
+        const std::vector<std::string> notices = recorder->takeNotices();
+        for (size_t i = 0; i < notices.size(); i++) {
+            (notices[i].compare(0, 6, "Error:") == 0 ? std::cerr : std::cout) << notices[i] << std::endl;
+        }
+        recorder->printStats(std::cout);
+        return success;
+    }
+
+    // the camera's file list. a cached listing of this camera is revalidated with
+    // GetCameraFilesCount() and only re-fetched when the count changed, the cache
+    // is older than LISTING_CACHE_MAX_AGE_SEC or refresh is set.
+    std::vector<std::string> listCameraFiles(bool refresh, bool& from_cache) {
+        from_cache = false;
+        const std::string serial = connectedSerial();
+        const int64_t now = static_cast<int64_t>(time(nullptr));
+        ListingCache cache;
+        int count = -1;
+        bool have_count = false;
+        if (!refresh && !serial.empty() && loadListingCache(serial, cache) &&
+            now - cache.fetched_at < LISTING_CACHE_MAX_AGE_SEC) {
+            have_count = traced("GetCameraFilesCount", [&] { return camera_->GetCameraFilesCount(count); });
+            if (have_count && count == cache.count) {
+                from_cache = true;
+                return cache.files;
+            }
+        }
+        if (!have_count) {
+            have_count = traced("GetCameraFilesCount", [&] { return camera_->GetCameraFilesCount(count); });
+        }
+        // counted first: a file added in between makes the next check miss, never hit wrongly
+        cache.files = traced("GetCameraFilesList", [&] { return camera_->GetCameraFilesList(); });
+        if (!serial.empty() && have_count) {
+            cache.count = count;
+            cache.fetched_at = now;
+            saveListingCache(serial, cache);
+        }
+        return cache.files;
+    }
+
+    // drops files this program deleted from the cached listing, so the next
+    // count check still matches
+    void forgetCameraFiles(const std::vector<std::string>& deleted) {
+        const std::string serial = connectedSerial();
+        ListingCache cache;
+        if (deleted.empty() || serial.empty() || !loadListingCache(serial, cache)) {
+            return;
+        }
+        const std::set<std::string> gone(deleted.begin(), deleted.end());
+        std::vector<std::string> kept;
+        for (size_t i = 0; i < cache.files.size(); i++) {
+            if (!gone.count(cache.files[i])) {
+                kept.push_back(cache.files[i]);
+            }
+        }
+        cache.count -= static_cast<int>(cache.files.size() - kept.size());
+        cache.files.swap(kept);
+        saveListingCache(serial, cache);
+    }
+
+    // finishes a copy-storage run that stopped (crash, power loss) after files were
+    // journaled as durable but before their camera copies were deleted. a file is
+    // only deleted if it is still on disk at the journaled size. entries of other
+    // cameras are left alone and returned.
+    std::vector<JournalEntry> replayCopyJournal(CopyJournal& journal) {
+        std::vector<JournalEntry> pending = journal.pending();
+        std::vector<JournalEntry> other_cameras;
+        const std::string serial = connectedSerial();
+        std::vector<std::string> deleted;
+        bool announced = false;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (pending[i].serial_number != serial) {
+                other_cameras.push_back(pending[i]);
+                continue;
+            }
+            if (!announced) {
+                std::cout << "Finishing an interrupted copy (" << journal.path() << ")..." << std::endl;
+                announced = true;
+            }
+            if (getFileSize(pending[i].local_path) != pending[i].size) {
+                std::cerr << "Warning: " << pending[i].local_path << " is missing or truncated, "
+                          << pending[i].remote_path << " stays on the camera." << std::endl;
+                continue;
+            }
+            if (traced("DeleteCameraFile", [&] { return camera_->DeleteCameraFile(pending[i].remote_path); })) {
+                std::cout << "Deleted from camera: " << pending[i].remote_path << std::endl;
+            } else {
+                // most likely the delete went through and only its journal line was lost
+                std::cerr << "Warning: Failed to delete file from camera: " << pending[i].remote_path << std::endl;
+            }
+            deleted.push_back(pending[i].remote_path);
+        }
+        if (!pending.empty()) {
+            journal.reset(other_cameras);
+        }
+        forgetCameraFiles(deleted);
+        return other_cameras;
+    }
+
+    // prints the camera's files and how long the listing took
+    bool listFiles(bool refresh) {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        bool from_cache = false;
+        std::vector<std::string> file_list = listCameraFiles(refresh, from_cache);
+        const double list_ms = elapsedMs(start);
+
+        for (size_t i = 0; i < file_list.size(); i++) {
+            std::cout << file_list[i] << std::endl;
+        }
+        std::cout << file_list.size() << " file(s) on camera" << std::endl;
+        std::cout << std::fixed << std::setprecision(1) << "Listing took " << list_ms << " ms ("
+                  << (from_cache ? "warm: cached, count unchanged" : "cold: fetched from camera") << ")" << std::endl;
+        return true;
+    }
+
+    // copies every file on the camera to save_directory and deletes it from the camera.
+    // with options.incremental, files the manifest says were already copied (and are
+    // still on disk at the recorded size) are not downloaded again, only deleted.
+    bool copyStorage(const std::string& save_directory = "./", const CopyOptions& options = CopyOptions()) {
+        if (!is_connected_ || !camera_) {
+            std::cerr << "Error: Camera not connected." << std::endl;
+            return false;
+        }
+
+        // Check if camera is still connected
+        if (!camera_->IsConnected()) {
+            std::cerr << "Error: Camera connection lost." << std::endl;
+            is_connected_ = false;
+            return false;
+        }
+
+        // a queued photo must be on disk before we start deleting files from the camera
+        waitForDownloads();
+
+        // Prepare save directory
+        std::string save_path = save_directory;
+        if (save_path.back() != '/' && save_path.back() != '\\') {
+            save_path += "/";
+        }
+        
+        // Check if directory exists
+        if (!fileExists(save_path)) {
+            std::cerr << "Error: Save directory does not exist: " << save_path << std::endl;
+            return false;
+        }
+
+        // finish the deletes of a run that was cut short before listing, so those files aren't copied again
+        CopyJournal journal(save_path);
+        const std::vector<JournalEntry> other_cameras = replayCopyJournal(journal);
+
+        std::cout << "Getting list of files from camera..." << std::endl;
+        bool from_cache = false;
+        std::vector<std::string> file_list = listCameraFiles(false, from_cache);
+        
+        if (file_list.empty()) {
+            std::cout << "No files found on camera storage." << std::endl;
+            return true;
+        }
+
+        std::cout << "Found " << file_list.size() << " file(s) on camera" << (from_cache ? " (cached listing)" : "")
+                  << "." << std::endl;
+
+        // filter on names before anything goes over the wire, so skipped files cost nothing
+        const size_t listed = file_list.size();
+        if (options.filter.active()) {
+            std::vector<std::string> selected;
+            for (size_t i = 0; i < file_list.size(); i++) {
+                if (options.filter.matchesName(file_list[i])) {
+                    selected.push_back(file_list[i]);
+                }
+            }
+            file_list.swap(selected);
+        }
+
+        // sizes drive free-space admission as well as --max-size and smallest-first.
+        // --incremental skips files that are already here: their size comes from the
+        // manifest and they take no space, only the rest is probed on the camera.
+        CopyManifest manifest(save_path);
+        const std::string serial = connectedSerial();
+        std::map<std::string, int64_t> sizes;
+        std::set<std::string> copied;
+        std::vector<std::string> to_probe;
+        for (size_t i = 0; i < file_list.size(); i++) {
+            ManifestEntry entry;
+            if (options.incremental && manifest.lookup(serial, file_list[i], entry) &&
+                getFileSize(save_path + getFileName(file_list[i])) == entry.size) {
+                sizes[file_list[i]] = entry.size;
+                copied.insert(file_list[i]);
+            } else {
+                to_probe.push_back(file_list[i]);
+            }
+        }
+        const size_t probed = transfers_.remoteSizes(to_probe, sizes);
+        const bool have_sizes = probed == to_probe.size();
+        if (!have_sizes && probed > 0) {
+            std::cerr << "Warning: No size for " << to_probe.size() - probed << " of " << to_probe.size()
+                      << " file(s) from the camera's HTTP server." << std::endl;
+        }
+        if (options.filter.max_size >= 0 && probed == 0 && !to_probe.empty()) {
+            std::cerr << "Error: --max-size needs file sizes from the camera's HTTP server, which is not reachable."
+                      << std::endl;
+            return false;
+        }
+        if (options.order == SCHEDULE_SMALLEST_FIRST && !have_sizes) {
+            std::cout << "File sizes need the camera's HTTP server, ordering by file type instead." << std::endl;
+        }
+
+        if (options.filter.active()) {
+            std::vector<std::string> selected;
+            int64_t selected_bytes = 0;
+            for (size_t i = 0; i < file_list.size(); i++) {
+                if (options.filter.matches(file_list[i], sizes)) {
+                    std::map<std::string, int64_t>::const_iterator size = sizes.find(file_list[i]);
+                    selected_bytes += size == sizes.end() ? 0 : size->second;
+                    selected.push_back(file_list[i]);
+                }
+            }
+            file_list.swap(selected);
+            std::cout << "Selected " << file_list.size() << " of " << listed << " file(s) ("
+                      << options.filter.describe() << ")";
+            if (probed > 0 || !copied.empty()) {
+                std::cout << ", " << formatBytes(selected_bytes);
+            }
+            std::cout << "." << std::endl;
+            if (file_list.empty()) {
+                std::cout << "No files match, nothing to copy." << std::endl;
+                return true;
+            }
+        }
+        scheduleTransfers(file_list, options.order, sizes);
+
+        std::map<std::string, int64_t> to_transfer = sizes;
+        for (std::set<std::string>::const_iterator it = copied.begin(); it != copied.end(); ++it) {
+            to_transfer[*it] = 0;
+        }
+        if (!admitDownloads(file_list, to_transfer, save_path, options.fit)) {
+            std::cerr << "Error: Nothing copied. Free up space" << (options.fit ? "" : ", or use --fit to copy what fits")
+                      << "." << std::endl;
+            return false;
+        }
+
+        int photo_count = 0;
+        for (size_t i = 0; i < file_list.size(); i++) {
+            photo_count += fileKind(file_list[i]) == FILE_PHOTO ? 1 : 0;
+        }
+        std::cout << "Download order: " << SCHEDULE_POLICY_NAMES[options.order] << std::endl;
+
+        // three stage pipeline: this thread downloads file i+1 while a verifier
+        // checks file i and a deleter removes already verified files from the
+        // camera. the verifier syncs verified files to disk a group at a time and
+        // journals them; a group only reaches the delete stage once that is done.
+        struct CopyItem {
+            std::string file_url;
+            std::string full_path;
+            DownloadResult result;
+            double download_ms;
+            double verify_ms;
+            bool from_manifest;  // copied by an earlier run, nothing to download or verify
+        };
+        BoundedQueue<CopyItem> verify_queue(COPY_PIPELINE_WINDOW);
+        BoundedQueue<std::vector<CopyItem> > delete_queue(COPY_PIPELINE_WINDOW);
+
+        // worker threads can't write to std::cout (it may belong to a daemon client),
+        // so they queue their messages and this thread prints them between files
+        std::mutex report_mutex;
+        std::vector<std::pair<bool, std::string> > reports;  // (is_error, message)
+        std::vector<std::string> deleted;  // camera paths, dropped from the cached listing at the end
+        int success_count = 0;
+        int fail_count = 0;
+        int skipped_count = 0;
+        int64_t bytes_copied = 0;
+        int64_t bytes_avoided = 0;
+        double checksum_ms = 0.0;  // streaming hash plus the read-back, summed over files
+        int64_t bytes_hashed = 0;
+        double sync_ms = 0.0;  // fdatasync of files, directory and journal
+        int sync_groups = 0;
+        // when files became usable locally, measured from the start of the copy
+        double first_file_ms = -1.0;
+        double all_photos_ms = -1.0;
+        int photos_ready = 0;
+        double stage_ms = 0.0;  // time each file spent in every stage, i.e. what a serial copy would take
+        auto report = [&](bool is_error, const std::string& message) {
+            std::lock_guard<std::mutex> lock(report_mutex);
+            reports.push_back(std::make_pair(is_error, message));
+        };
+        auto flushReports = [&]() {
+            std::lock_guard<std::mutex> lock(report_mutex);
+            for (size_t r = 0; r < reports.size(); r++) {
+                (reports[r].first ? std::cerr : std::cout) << reports[r].second << std::endl;
+            }
+            reports.clear();
+        };
+
+        const auto copy_start = std::chrono::steady_clock::now();
+        // called by the verifier once a file is safely on disk
+        auto fileReady = [&](const std::string& file_url) {
+            std::lock_guard<std::mutex> lock(report_mutex);
+            if (first_file_ms < 0) {
+                first_file_ms = elapsedMs(copy_start);
+            }
+            if (fileKind(file_url) == FILE_PHOTO && ++photos_ready == photo_count) {
+                all_photos_ms = elapsedMs(copy_start);
+            }
+        };
+
+        // group commit: sync the group's files and the directory, then journal them as
+        // durable. only after that are they recorded in the manifest and may be deleted.
+        auto commitGroup = [&](std::vector<CopyItem>& group) {
+            if (group.empty()) {
+                return;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            std::vector<CopyItem> durable;
+            std::vector<JournalEntry> entries;
+            for (size_t g = 0; g < group.size(); g++) {
+                if (!syncFile(group[g].full_path)) {
+                    report(true, "Error: Cannot sync " + group[g].full_path + ": " + strerror(errno) + " (kept on camera)");
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    fail_count++;
+                    continue;
+                }
+                JournalEntry entry;
+                entry.serial_number = serial;
+                entry.remote_path = group[g].file_url;
+                entry.local_path = group[g].full_path;
+                entry.size = group[g].result.file_size;
+                entries.push_back(entry);
+                durable.push_back(group[g]);
+            }
+            group.clear();
+            const bool journaled = durable.empty() || (syncDirectory(save_path) && journal.commitDurable(entries));
+            {
+                std::lock_guard<std::mutex> lock(report_mutex);
+                sync_ms += elapsedMs(start);
+                sync_groups++;
+                if (!journaled) {
+                    fail_count += static_cast<int>(durable.size());
+                }
+            }
+            if (!journaled) {
+                report(true, "Error: Cannot write the copy journal " + journal.path() + ": " + strerror(errno) +
+                             " (" + std::to_string(durable.size()) + " file(s) kept on camera)");
+                return;
+            }
+            for (size_t g = 0; g < durable.size(); g++) {
+                if (durable[g].from_manifest) {
+                    continue;
+                }
+                ManifestEntry entry;
+                entry.checksum = durable[g].result.checksum;
+                entry.serial_number = serial;
+                entry.remote_path = durable[g].file_url;
+                entry.size = durable[g].result.file_size;
+                entry.copied_at = static_cast<int64_t>(time(nullptr));
+                if (!manifest.record(entry)) {
+                    report(true, "Warning: Could not update copy manifest in " + save_path);
+                }
+            }
+            if (!durable.empty()) {
+                delete_queue.push(durable);
+            }
+        };
+
+        std::thread verifier([&] {
+            std::vector<CopyItem> group;
+            int64_t group_bytes = 0;
+            auto addToGroup = [&](const CopyItem& item) {
+                group.push_back(item);
+                group_bytes += item.result.file_size;
+                if (group.size() >= JOURNAL_GROUP_FILES || group_bytes >= JOURNAL_GROUP_BYTES) {
+                    commitGroup(group);
+                    group_bytes = 0;
+                }
+            };
+            CopyItem item;
+            while (verify_queue.pop(item)) {
+                if (item.from_manifest) {
+                    fileReady(item.file_url);
+                    addToGroup(item);
+                    continue;
+                }
+                const auto start = std::chrono::steady_clock::now();
+                // HTTP transfers were hashed while written, SDK ones only get the read-back
+                const int passes = item.result.has_checksum ? 2 : 1;
+                transfers_.verify(item.full_path, item.result, true, true);
+                if (item.result.file_size > 0) {
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    checksum_ms += item.result.checksum_ms;
+                    bytes_hashed += passes * item.result.file_size;
+                }
+                item.verify_ms = elapsedMs(start);
+                if (!item.result.warning.empty()) {
+                    report(true, "Warning: " + item.result.warning);
+                }
+                if (!item.result.success) {
+                    report(true, "Error: " + item.result.error + " (kept on camera)");
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    fail_count++;
+                    stage_ms += item.download_ms + item.verify_ms;
+                    continue;
+                }
+                char checksum[9];
+                snprintf(checksum, sizeof(checksum), "%08x", item.result.checksum);
+                report(false, "Verified: " + item.full_path + " (" + formatBytes(item.result.file_size) +
+                              ", crc32c " + checksum + ")");
+                fileReady(item.file_url);
+                addToGroup(item);
+            }
+            commitGroup(group);
+            delete_queue.close();
+        });
+
+        // deletes a committed group from the camera in one batch
+        std::thread deleter([&] {
+            std::vector<CopyItem> batch;
+            while (delete_queue.pop(batch)) {
+                for (size_t b = 0; b < batch.size(); b++) {
+                    const CopyItem& item = batch[b];
+                    const auto start = std::chrono::steady_clock::now();
+                    bool delete_success = traced("DeleteCameraFile", [&] { return camera_->DeleteCameraFile(item.file_url); });
+                    const double delete_ms = elapsedMs(start);
+                    if (delete_success) {
+                        journal.recordDeleted(serial, item.file_url);
+                        report(false, "Deleted from camera: " + item.file_url);
+                    } else {
+                        report(true, "Warning: Failed to delete file from camera: " + item.file_url +
+                                     "\nFile was downloaded but remains on camera.");
+                    }
+                    // Still count as success since download worked
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    success_count++;
+                    if (delete_success) {
+                        deleted.push_back(item.file_url);
+                    }
+                    if (item.from_manifest) {
+                        continue;
+                    }
+                    bytes_copied += item.result.file_size;
+                    stage_ms += item.download_ms + item.verify_ms + delete_ms;
+                }
+            }
+        });
+
+        std::vector<std::pair<std::string, int> > retried;  // files that needed retries, and how many
+        for (size_t i = 0; i < file_list.size(); i++) {
+            const std::string& file_url = file_list[i];
+            std::string file_name = getFileName(file_url);
+            
+            if (file_name.empty()) {
+                file_name = "file_" + getCurrentTime() + "_" + std::to_string(i);
+            }
+            
+            flushReports();
+            std::string full_path = save_path + file_name;
+
+            CopyItem item;
+            item.file_url = file_url;
+            item.full_path = full_path;
+            item.from_manifest = false;
+
+            ManifestEntry entry;
+            if (options.incremental && manifest.lookup(serial, file_url, entry) && getFileSize(full_path) == entry.size) {
+                std::cout << "\n[" << (i + 1) << "/" << file_list.size() << "] Already copied: " << file_name
+                          << " (" << formatBytes(entry.size) << ")" << std::endl;
+                item.from_manifest = true;
+                item.result.success = true;
+                item.result.expected_size = entry.size;
+                item.result.file_size = entry.size;
+                item.download_ms = 0.0;
+                item.verify_ms = 0.0;
+                skipped_count++;
+                bytes_avoided += entry.size;
+                verify_queue.push(item);
+                continue;
+            }
+
+            std::cout << "\n[" << (i + 1) << "/" << file_list.size() << "] Downloading: " << file_name << std::endl;
+            const auto start = std::chrono::steady_clock::now();
+            item.result = transfers_.transfer(file_url, full_path, true);
+            item.download_ms = elapsedMs(start);
+            item.verify_ms = 0.0;
+            if (item.result.retries > 0) {
+                retried.push_back(std::make_pair(file_name, item.result.retries));
+            }
+            if (!item.result.success) {
+                std::cerr << "Error: " << item.result.error << std::endl;
+                std::lock_guard<std::mutex> lock(report_mutex);
+                fail_count++;
+                stage_ms += item.download_ms;
+                continue;
+            }
+            std::cout << "Downloaded: " << full_path << std::endl;
+            verify_queue.push(item);
+        }
+        verify_queue.close();
+        verifier.join();
+        deleter.join();
+        flushReports();
+        // every journaled file was deleted or reported; nothing is left to replay
+        journal.reset(other_cameras);
+        forgetCameraFiles(deleted);
+        const double copy_ms = elapsedMs(copy_start);
+
+        std::cout << "\n=== Copy Summary ===" << std::endl;
+        std::cout << "Successfully copied: " << success_count << " file(s)" << std::endl;
+        if (fail_count > 0) {
+            std::cout << "Failed: " << fail_count << " file(s)" << std::endl;
+        }
+        if (skipped_count > 0) {
+            std::cout << "Already copied (download skipped): " << skipped_count << " file(s), "
+                      << formatBytes(bytes_avoided) << " not transferred" << std::endl;
+        }
+        std::cout << "Total: " << file_list.size() << " file(s)" << std::endl;
+        if (first_file_ms >= 0) {
+            std::cout << std::fixed << std::setprecision(2) << "Time to first file: " << first_file_ms / 1000.0 << " s";
+            if (photo_count > 0) {
+                std::cout << ", to all " << photo_count << " photo(s): ";
+                if (all_photos_ms >= 0) {
+                    std::cout << all_photos_ms / 1000.0 << " s";
+                } else {
+                    std::cout << "n/a (" << photo_count - photos_ready << " not copied)";
+                }
+            }
+            std::cout << " (order: " << SCHEDULE_POLICY_NAMES[options.order] << ")" << std::endl;
+        }
+        if (!retried.empty()) {
+            std::cout << "Retried after stalls or dropped transfers:" << std::endl;
+            for (size_t r = 0; r < retried.size(); r++) {
+                std::cout << "  " << retried[r].first << ": " << retried[r].second << " retr"
+                          << (retried[r].second == 1 ? "y" : "ies") << std::endl;
+            }
+        }
+        if (bytes_copied > 0 && copy_ms > 0 && stage_ms > 0) {
+            const double mb = static_cast<double>(bytes_copied) / (1024.0 * 1024.0);
+            std::cout << std::fixed << std::setprecision(2)
+                      << "Throughput: " << mb * 1000.0 / copy_ms << " MB/s (" << formatBytes(bytes_copied)
+                      << " in " << copy_ms / 1000.0 << " s), serial download/verify/delete would be "
+                      << mb * 1000.0 / stage_ms << " MB/s (" << stage_ms / 1000.0 << " s)" << std::endl;
+            if (checksum_ms > 0) {
+                std::cout << "Checksums: CRC-32C (" << (crc32cUsesHardware() ? "hardware" : "software") << "), "
+                          << checksum_ms / 1000.0 << " s hashing "
+                          << formatBytes(bytes_hashed) << " (" << static_cast<double>(bytes_hashed) / 1048.576 / checksum_ms
+                          << " MB/s), " << checksum_ms * 100.0 / copy_ms << "% of copy time" << std::endl;
+            }
+        }
+        if (sync_groups > 0) {
+            std::cout << std::fixed << std::setprecision(2) << "Synced to disk before deleting: " << sync_groups
+                      << " group(s), " << sync_ms / 1000.0 << " s" << std::endl;
+        }
+
+        return fail_count == 0;
+    }
+
+    // session counters for interactive and daemon mode
+    void printSessionStats() const {
+        std::cout << "Session Stats:" << std::endl;
+        std::cout << "  Mode switches sent: " << mode_switches_sent_ << std::endl;
+        std::cout << "  Mode switches skipped (round-trips saved): " << mode_switches_saved_ << std::endl;
+        transfers_.printStats();
+        tracer_.printSessionSummary();
+    }
+
+    PhaseTracer& tracer() {
+        return tracer_;
+    }
+
+    bool isConnected() const {
+        return is_connected_ && camera_ && camera_->IsConnected();
+    }
+};
+
+// location of the daemon control socket. it must be private to the user:
+// clients send their working directory and arguments to whatever listens there.
+// $CAMERA_CONTROL_SOCKET, else $XDG_RUNTIME_DIR/camera_control.sock, else
+// /tmp/camera_control-<uid>/camera_control.sock. returns "" if that fallback
+// directory exists but isn't a 0700 directory owned by us.
+const char* const SOCKET_NAME = "camera_control.sock";
+
+std::string getSocketPath() {
+    const char* env = getenv("CAMERA_CONTROL_SOCKET");
+    if (env && *env) {
+        return std::string(env);
+    }
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        return std::string(runtime) + "/" + SOCKET_NAME;
+    }
+
+    std::string dir = "/tmp/camera_control-" + std::to_string(geteuid());
+    mkdir(dir.c_str(), 0700);
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & 0777) != 0700) {
+        std::cerr << "Warning: " << dir << " is not a private directory, not using the camera daemon" << std::endl;
+        return std::string();
+    }
+    return dir + "/" + SOCKET_NAME;
+}
+
+// true if the process on the other end of a unix socket runs as our user
+bool peerIsOwner(int fd) {
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0 || length != sizeof(cred)) {
+        return false;
+    }
+    return cred.uid == geteuid();
+}
+
+// removes "--name value" or "--name=value" from args. returns true if found.
+bool extractOption(std::vector<std::string>& args, const std::string& name, std::string& value) {
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == name && i + 1 < args.size()) {
+            value = args[i + 1];
+            args.erase(args.begin() + i, args.begin() + i + 2);
+            return true;
+        }
+        if (args[i].compare(0, name.size() + 1, name + "=") == 0) {
+            value = args[i].substr(name.size() + 1);
+            args.erase(args.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// removes a boolean "--name" switch from args. returns true if it was present.
+bool extractFlag(std::vector<std::string>& args, const std::string& name) {
+    std::vector<std::string>::iterator it = std::find(args.begin(), args.end(), name);
+    if (it == args.end()) {
+        return false;
+    }
+    args.erase(it);
+    return true;
+}
+
+// gyro-export FILE [--from T] [--to T]: a gyro log's samples as CSV on stdout,
+// optionally only those with timestamps in [from, to] (the SDK's timestamp units).
+// needs no camera. returns a process exit status.
+int exportGyroLog(const std::vector<std::string>& args) {
+    std::vector<std::string> rest(args.begin() + 1, args.end());
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    std::string value;
+    if (extractOption(rest, "--from", value)) {
+        from = atoll(value.c_str());
+    }
+    if (extractOption(rest, "--to", value)) {
+        to = atoll(value.c_str());
+    }
+    if (rest.size() != 1) {
+        std::cerr << "Usage: gyro-export FILE [--from TIMESTAMP] [--to TIMESTAMP]" << std::endl;
+        return 1;
+    }
+    GyroLogReader reader;
+    std::string error;
+    if (!reader.open(rest[0], error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    std::vector<ins_camera::GyroData> samples;
+    const bool ok = reader.query(from, to, samples);
+    printf("timestamp,ax,ay,az,gx,gy,gz\n");
+    for (size_t i = 0; i < samples.size(); i++) {
+        const ins_camera::GyroData& sample = samples[i];
+        printf("%lld,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", static_cast<long long>(sample.timestamp), sample.ax, sample.ay,
+               sample.az, sample.gx, sample.gy, sample.gz);
+    }
+    fflush(stdout);
+    std::cerr << samples.size() << " sample(s) from " << reader.blocks().size() << " block(s)"
+              << (reader.indexed() ? "" : ", index rebuilt (the log was not closed)") << std::endl;
+    if (!ok) {
+        std::cerr << "Error: " << rest[0] << " has a damaged block, output stops there." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// runs a single command against an already connected controller.
+// args[0] is the command name, the remaining entries are its arguments.
+// returns a process exit status (0 on success).
+int runCommand(CameraController& controller, const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return 1;
+    }
+
+    const std::string& command = args[0];
+    std::vector<std::string> rest(args.begin() + 1, args.end());
+    const bool preview = command == "record-stop" && extractFlag(rest, "--preview");
+    const bool refresh = command == "list" && extractFlag(rest, "--refresh");
+    StreamOptions stream_options;
+    if (command == "stream-record") {
+        std::string value;
+        if (extractOption(rest, "--seconds", value)) {
+            stream_options.seconds = atoi(value.c_str());
+        }
+        int64_t buffer_bytes = 0;
+        if (extractOption(rest, "--buffer", value)) {
+            if (!parseByteSize(value, buffer_bytes) || buffer_bytes < (1 << 20)) {
+                std::cerr << "Error: Invalid --buffer '" << value << "'. Use a size of at least 1M." << std::endl;
+                return 1;
+            }
+            stream_options.buffer_bytes = static_cast<size_t>(buffer_bytes);
+        }
+        if (extractOption(rest, "--segment", value)) {
+            stream_options.segment_seconds = atoi(value.c_str());
+            if (stream_options.segment_seconds <= 0) {
+                std::cerr << "Error: Invalid --segment '" << value << "'. Use a number of seconds." << std::endl;
+                return 1;
+            }
+        }
+        if (extractOption(rest, "--retain", value)) {
+            stream_options.retain_seconds = atoi(value.c_str());
+            if (stream_options.retain_seconds <= 0 || stream_options.segment_seconds <= 0) {
+                std::cerr << "Error: --retain needs a number of seconds and --segment." << std::endl;
+                return 1;
+            }
+        }
+        stream_options.lrv = extractFlag(rest, "--lrv");
+    }
+    DashcamOptions dashcam_options;
+    if (command == "dashcam") {
+        std::string value;
+        if (extractOption(rest, "--pre", value)) {
+            dashcam_options.pre_seconds = atoi(value.c_str());
+            if (dashcam_options.pre_seconds <= 0) {
+                std::cerr << "Error: Invalid --pre '" << value << "'. Use a number of seconds." << std::endl;
+                return 1;
+            }
+        }
+        if (extractOption(rest, "--post", value)) {
+            dashcam_options.post_seconds = atoi(value.c_str());
+            if (dashcam_options.post_seconds < 0 || value.empty() || !isdigit(static_cast<unsigned char>(value[0]))) {
+                std::cerr << "Error: Invalid --post '" << value << "'. Use a number of seconds." << std::endl;
+                return 1;
+            }
+        }
+        if (extractOption(rest, "--memory", value)) {
+            if (!parseByteSize(value, dashcam_options.memory_bytes) || dashcam_options.memory_bytes < (4 << 20)) {
+                std::cerr << "Error: Invalid --memory '" << value << "'. Use a size of at least 4M." << std::endl;
+                return 1;
+            }
+        }
+        if (extractOption(rest, "--seconds", value)) {
+            dashcam_options.seconds = atoi(value.c_str());
+        }
+        extractOption(rest, "--fifo", dashcam_options.fifo_path);
+        dashcam_options.lrv = extractFlag(rest, "--lrv");
+    }
+    CopyOptions copy_options;
+    if (command == "copy-storage") {
+        copy_options.incremental = extractFlag(rest, "--incremental");
+        copy_options.fit = extractFlag(rest, "--fit");
+        std::string order;
+        if (extractOption(rest, "--order", order) && !parseSchedulePolicy(order, copy_options.order)) {
+            std::cerr << "Error: Unknown --order '" << order << "'. Use listing, photos-first, smallest-first,"
+                      << " newest-first or lrv-first." << std::endl;
+            return 1;
+        }
+        std::string value;
+        if (extractOption(rest, "--ext", value) && !parseExtensionList(value, copy_options.filter.extensions)) {
+            std::cerr << "Error: --ext needs a comma separated list such as insp,insv." << std::endl;
+            return 1;
+        }
+        if (extractOption(rest, "--since", value) && !parseTimeBound(value, false, copy_options.filter.since)) {
+            std::cerr << "Error: Invalid --since '" << value << "'. Use YYYYMMDD[_HHMM[SS]] or an age like 1h." << std::endl;
+            return 1;
+        }
+        if (extractOption(rest, "--until", value) && !parseTimeBound(value, true, copy_options.filter.until)) {
+            std::cerr << "Error: Invalid --until '" << value << "'. Use YYYYMMDD[_HHMM[SS]] or an age like 1h." << std::endl;
+            return 1;
+        }
+        if (extractOption(rest, "--max-size", value) && !parseByteSize(value, copy_options.filter.max_size)) {
+            std::cerr << "Error: Invalid --max-size '" << value << "'. Use bytes or a K/M/G suffix." << std::endl;
+            return 1;
+        }
+    }
+
+    // whatever is left is the directory, which may have been split on spaces
+    std::string arg;
+    for (size_t i = 0; i < rest.size(); i++) {
+        arg += (i > 0 ? " " : "") + rest[i];
+    }
+    if (arg.empty()) {
+        arg = "./";
+    }
+
+    bool success = false;
+    if (command == "connect") {
+        std::cout << "Camera connected. Use 'photo', 'shutdown', 'battery', 'storage', or video commands." << std::endl;
+        success = true;
+    }
+    else if (command == "photo") {
+        success = controller.takePhoto(arg);
+    }
+    else if (command == "shutdown") {
+        success = controller.shutdownCamera();
+    }
+    else if (command == "battery") {
+        success = controller.getBatteryStatus();
+    }
+    else if (command == "storage") {
+        success = controller.getStorageStatus();
+    }
+    else if (command == "video-mode") {
+        success = controller.setVideoMode();
+    }
+    else if (command == "record-start") {
+        success = controller.startRecording();
+    }
+    else if (command == "record-stop") {
+        success = controller.stopRecording(arg, preview);
+    }
+    else if (command == "copy-storage") {
+        success = controller.copyStorage(arg, copy_options);
+    }
+    else if (command == "list") {
+        success = controller.listFiles(refresh);
+    }
+    else if (command == "stream-record") {
+        success = controller.recordStream(arg, stream_options);
+    }
+    else if (command == "dashcam") {
+        success = controller.runDashcam(arg, dashcam_options);
+    }
+    else if (command == "pending") {
+        controller.printPendingDownloads();
+        success = true;
+    }
+    else if (command == "stats") {
+        controller.printSessionStats();
+        success = true;
+    }
+    else {
+        std::cerr << "Unknown command: " << command << std::endl;
+        return 2;
+    }
+
+    return success ? 0 : 1;
+}
+
+// streambuf that forwards everything written to it to a socket. used by the
+// daemon to send a command's std::cout/std::cerr output back to the client.
+class SocketStreamBuf : public std::streambuf {
+private:
+    int fd_;
+    char buffer_[4096];
+
+    bool flushBuffer() {
+        const char* data = pbase();
+        size_t remaining = static_cast<size_t>(pptr() - pbase());
+        while (remaining > 0) {
+            ssize_t n = send(fd_, data, remaining, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // client went away, drop the rest of the output
+                break;
+            }
+            data += n;
+            remaining -= static_cast<size_t>(n);
+        }
+        setp(buffer_, buffer_ + sizeof(buffer_));
+        return remaining == 0;
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (ch != traits_type::eof()) {
+            *pptr() = static_cast<char>(ch);
+            pbump(1);
+        }
+        flushBuffer();
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override {
+        return flushBuffer() ? 0 : -1;
+    }
+
+public:
+    explicit SocketStreamBuf(int fd) : fd_(fd) {
+        // leave one slot free so overflow() can always store its character
+        setp(buffer_, buffer_ + sizeof(buffer_) - 1);
+    }
+
+    ~SocketStreamBuf() {
+        sync();
+    }
+};
+
+// daemon wire protocol (one command per connection):
+//   request:  "<client cwd>\n" followed by one "<arg>\n" per argument and a terminating "\n"
+//   response: the command's output, then a '\0' byte followed by one byte of exit status
+int connectToSocket(const std::string& socket_path) {
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// forwards a command to a running daemon. returns false if no daemon is
+// listening, in which case the caller should run the command itself.
+bool forwardToDaemon(const std::string& socket_path, const std::vector<std::string>& args, int& exit_status) {
+    int fd = connectToSocket(socket_path);
+    if (fd < 0) {
+        return false;
+    }
+
+    char cwd[4096];
+    std::string request = getcwd(cwd, sizeof(cwd)) ? std::string(cwd) : std::string(".");
+    request += "\n";
+    for (size_t i = 0; i < args.size(); i++) {
+        request += args[i] + "\n";
+    }
+    request += "\n";
+
+    if (!writeAll(fd, request)) {
+        close(fd);
+        return false;
+    }
+
+    // stream output through until the status trailer arrives
+    bool got_trailer = false;
+    bool expect_status = false;
+    exit_status = 1;
+    char buffer[4096];
+    while (!got_trailer) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (expect_status) {
+                exit_status = static_cast<unsigned char>(buffer[i]);
+                got_trailer = true;
+                break;
+            }
+            if (buffer[i] == '\0') {
+                expect_status = true;
+            } else {
+                std::cout.put(buffer[i]);
+            }
+        }
+        std::cout.flush();
+    }
+    close(fd);
+
+    if (!got_trailer) {
+        std::cerr << "Error: Lost connection to camera daemon." << std::endl;
+        exit_status = 1;
+    }
+    return true;
+}
+
+bool readRequest(int fd, std::string& cwd, std::vector<std::string>& args) {
+    std::string data;
+    char buffer[1024];
+    while (data.size() < 65536) {
+        // request ends with an empty line
+        if (data == "\n" || (data.size() >= 2 && data.compare(data.size() - 2, 2, "\n\n") == 0)) {
+            break;
+        }
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data.append(buffer, static_cast<size_t>(n));
+    }
+
+    std::vector<std::string> lines;
+    size_t start = 0;
+    size_t end;
+    while ((end = data.find('\n', start)) != std::string::npos) {
+        lines.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    while (!lines.empty() && lines.back().empty()) {
+        lines.pop_back();
+    }
+    if (lines.size() < 2) {
+        return false;
+    }
+
+    cwd = lines[0];
+    args.assign(lines.begin() + 1, lines.end());
+    return true;
+}
+
+// --seconds N (or --seconds=N) with N > 0 among a command's arguments, read the way runCommand() reads it
+bool hasBoundedDuration(std::vector<std::string> args) {
+    std::string seconds;
+    return extractOption(args, "--seconds", seconds) && atoi(seconds.c_str()) > 0;
+}
+
+volatile sig_atomic_t g_daemon_stop = 0;
+
+void handleDaemonSignal(int) {
+    g_daemon_stop = 1;
+}
+
+// long-lived mode: keeps the camera open and serves commands from
+// thin clients over a unix domain socket, one command at a time.
+int runDaemon(CameraController& controller, const std::string& socket_path, bool daemon_trace) {
+    sockaddr_un addr{};
+    if (socket_path.empty()) {
+        std::cerr << "Error: No usable socket path, set CAMERA_CONTROL_SOCKET" << std::endl;
+        return 1;
+    }
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: Socket path too long: " << socket_path << std::endl;
+        return 1;
+    }
+
+    // refuse to start twice, but clean up a stale socket from a crashed daemon
+    int probe = connectToSocket(socket_path);
+    if (probe >= 0) {
+        close(probe);
+        std::cerr << "Error: A camera daemon is already running on " << socket_path << std::endl;
+        return 1;
+    }
+    unlink(socket_path.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Error: Failed to create socket: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 8) != 0) {
+        std::cerr << "Error: Failed to listen on " << socket_path << ": " << strerror(errno) << std::endl;
+        close(listen_fd);
+        return 1;
+    }
+    chmod(socket_path.c_str(), 0600);
+
+    // no SA_RESTART so accept() returns and the stop flag gets checked
+    struct sigaction sa{};
+    sa.sa_handler = handleDaemonSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    controller.setAsyncDownloads(true);
+    std::cout << "Camera daemon listening on " << socket_path << std::endl;
+
+    while (!g_daemon_stop) {
+        int client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error: accept() failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        // the socket's directory should keep other users out; check anyway
+        if (!peerIsOwner(client_fd)) {
+            std::cerr << "Rejected connection from another user" << std::endl;
+            close(client_fd);
+            continue;
+        }
+
+        std::string cwd;
+        std::vector<std::string> args;
+        if (!readRequest(client_fd, cwd, args)) {
+            close(client_fd);
+            continue;
+        }
+        std::cout << "Request: " << args[0] << (args.size() > 1 ? " " + args[1] : std::string()) << std::endl;
+
+        int status = 0;
+        bool stop_after = false;
+        {
+            SocketStreamBuf client_buf(client_fd);
+            std::streambuf* old_out = std::cout.rdbuf(&client_buf);
+            std::streambuf* old_err = std::cerr.rdbuf(&client_buf);
+
+            // relative save directories are relative to the client, not the daemon
+            if (cwd.empty() || chdir(cwd.c_str()) != 0) {
+                std::cerr << "Warning: Cannot change to client directory: " << cwd << std::endl;
+            }
+
+            // a --serial selection must match the camera the daemon already owns
+            std::string serial;
+            bool has_serial = extractOption(args, "--serial", serial);
+            bool print_trace = extractFlag(args, "--trace");
+            controller.tracer().setPrintTable(print_trace || daemon_trace);
+            // process-level options a client put on the command line apply to this command only
+            std::string connections;
+            const bool has_connections = extractOption(args, "--connections", connections);
+            const int daemon_connections = controller.httpConnections();
+            if (has_connections) {
+                controller.setHttpConnections(atoi(connections.c_str()));
+            }
+            std::string stall_timeout;
+            const int daemon_stall_timeout = controller.stallTimeout();
+            if (extractOption(args, "--stall-timeout", stall_timeout)) {
+                controller.setStallTimeout(atoi(stall_timeout.c_str()));
+            }
+            // only matters if this command has to reconnect
+            std::string sync_threshold;
+            const int64_t daemon_sync_threshold = controller.timeSyncThreshold();
+            if (extractOption(args, "--time-sync-threshold", sync_threshold)) {
+                controller.setTimeSyncThreshold(atoll(sync_threshold.c_str()));
+            }
+            // the client's trace file, relative to its directory, gets this command's line
+            std::string trace_file;
+            const std::string daemon_trace_file = controller.tracer().traceFile();
+            if (extractOption(args, "--trace-file", trace_file)) {
+                controller.tracer().setTraceFile(trace_file);
+            }
+            if (!args.empty()) {
+                controller.tracer().beginCommand(args[0]);
+            }
+
+            if (args.empty()) {
+                std::cerr << "Error: No command given." << std::endl;
+                status = 2;
+            }
+            else if (args[0] == "daemon-stop") {
+                std::cout << "Stopping camera daemon." << std::endl;
+                stop_after = true;
+            }
+            else if (args[0] == "daemon" || args[0] == "interactive") {
+                std::cerr << "Error: '" << args[0] << "' cannot be run through the daemon." << std::endl;
+                status = 2;
+            }
+            else if (args[0] == "dashcam") {
+                // its Enter/status/quit triggers are read from stdin, which is the daemon's, not the client's
+                std::cerr << "Error: 'dashcam' reads its triggers from the terminal and runs until stopped; run "
+                          << "'daemon-stop' first or set CAMERA_CONTROL_NO_DAEMON=1." << std::endl;
+                status = 1;
+            }
+            else if (args[0] == "stream-record" && !hasBoundedDuration(args)) {
+                // the daemon serves one command at a time, an open-ended recording would lock out every other client
+                std::cerr << "Error: 'stream-record' through the daemon needs --seconds N; stop the daemon or set "
+                          << "CAMERA_CONTROL_NO_DAEMON=1 to record until Ctrl-C." << std::endl;
+                status = 1;
+            }
+            else {
+                if (!controller.isConnected()) {
+                    std::cout << "Camera not connected, reconnecting..." << std::endl;
+                    controller.disconnect();
+                }
+
+                if (!controller.isConnected() && !controller.discoverAndConnect()) {
+                    status = 1;
+                }
+                else if (has_serial && serial != controller.connectedSerial()) {
+                    std::cerr << "Error: Daemon is connected to camera " << controller.connectedSerial()
+                              << ", not " << serial << "." << std::endl;
+                    status = 1;
                 }
-            } else {
-                const auto& origins = url.OriginUrls();
-                std::cout << "Video URLs (" << origins.size() << "):" << std::endl;
-                
-                for (size_t i = 0; i < origins.size(); i++) {
-                    const std::string& video_url = origins[i];
-                    std::cout << "\n[" << (i + 1) << "/" << origins.size() << "] " << video_url << std::endl;
-                    
-                    std::string file_name = getFileName(video_url);
-                    if (file_name.empty()) {
-                        file_name = "video_" + getCurrentTime() + "_" + std::to_string(i) + ".mp4";
-                    }
-                    
-                    std::string full_path = save_path + file_name;
-                    std::cout << "Downloading to: " << full_path << std::endl;
-
-                    int64_t last_progress = -1;
-                    int64_t last_current = -1;
-                    auto last_update_time = std::chrono::steady_clock::now();
-                    int64_t total_size_known = 0;
-                    
-                    bool download_success = camera_->DownloadCameraFile(video_url, full_path,
-                        [&](int64_t current, int64_t total_size) {
-                            total_size_known = total_size;
-                            auto now = std::chrono::steady_clock::now();
-                            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_update_time).count();
-                            
-                            // Use floating-point for more accurate progress calculation
-                            double progress_double = total_size > 0 ? (static_cast<double>(current) * 100.0 / static_cast<double>(total_size)) : 0.0;
-                            int64_t progress = static_cast<int64_t>(progress_double);
-                            
-                            // Force 100% when current equals total_size (handle edge case)
-                            if (current >= total_size && total_size > 0) {
-                                progress = 100;
-                            }
-                            
-                            // Show progress if it changed, or if we're near completion
-                            if (progress != last_progress || (current != last_current && total_size > 0 && current >= total_size * 0.97)) {
-                                if (total_size > 0) {
-                                    std::cout << "\rDownload progress: " << progress << "% (" 
-                                             << formatBytes(current) << " / " << formatBytes(total_size) << ")" << std::flush;
-                                } else {
-                                    std::cout << "\rDownload progress: " << formatBytes(current) << " downloaded" << std::flush;
-                                }
-                                last_progress = progress;
-                                last_current = current;
-                                last_update_time = now;
-                            }
-                            
-                            // Timeout detection: if no progress for 30 seconds, warn
-                            if (elapsed > 30 && current == last_current && current < total_size) {
-                                std::cout << "\nWarning: Download appears stalled at " << progress << "%" << std::endl;
-                                std::cout << "Continuing to wait..." << std::flush;
-                            }
-                        });
-                    
-                    // Explicitly show 100% if download succeeded (handles case where SDK doesn't call callback at 100%)
-                    if (download_success) {
-                        if (total_size_known > 0) {
-                            std::cout << "\rDownload progress: 100% (" << formatBytes(total_size_known) 
-                                     << " / " << formatBytes(total_size_known) << ")" << std::flush;
-                        } else {
-                            std::cout << "\rDownload progress: 100%" << std::flush;
-                        }
+                else {
+                    status = runCommand(controller, args);
+                    if (args[0] == "shutdown" && status == 0) {
+                        stop_after = true;
                     }
-                    std::cout << std::endl;
-                    
-                    if (download_success) {
-                        // Verify file was actually written
-                        int64_t file_size = getFileSize(full_path);
-                        if (file_size < 0) {
-                            std::cerr << "Error: Download reported success but file does not exist: " << full_path << std::endl;
-                            all_success = false;
-                        } else if (file_size == 0) {
-                            std::cerr << "Error: Download reported success but file is empty: " << full_path << std::endl;
-                            all_success = false;
-                        } else {
-                            if (total_size_known > 0 && file_size != total_size_known) {
-                                std::cerr << "Warning: File size mismatch. Expected: " << formatBytes(total_size_known) 
-                                         << ", Got: " << formatBytes(file_size) << std::endl;
-                            }
-                            std::cout << "Successfully downloaded: " << full_path 
-                                     << " (" << formatBytes(file_size) << ")" << std::endl;
-                        }
-                    } else {
-                        std::cerr << "Error: Failed to download video." << std::endl;
-                        std::cerr << "Video URL on camera: " << video_url << std::endl;
-                        all_success = false;
+                    // stream-record has SIGINT/SIGTERM while it runs; one that ended it early was meant for us
+                    if (args[0] == "stream-record" && g_stream_stop) {
+                        stop_after = true;
                     }
                 }
             }
-            
-            return all_success;
-        } else {
-            // display video URL(s) if no save directory provided
-            if (url.IsSingleOrigin()) {
-                std::cout << "Video URL: " << url.GetSingleOrigin() << std::endl;
-            } else {
-                const auto& origins = url.OriginUrls();
-                std::cout << "Video URLs (" << origins.size() << "):" << std::endl;
-                for (size_t i = 0; i < origins.size(); i++) {
-                    std::cout << "  [" << i << "] " << origins[i] << std::endl;
-                }
-            }
+
+            controller.tracer().endCommand(status == 0);
+            controller.setHttpConnections(daemon_connections);
+            controller.setStallTimeout(daemon_stall_timeout);
+            controller.setTimeSyncThreshold(daemon_sync_threshold);
+            controller.tracer().setTraceFile(daemon_trace_file);
+            std::cout.flush();
+            std::cerr.flush();
+            std::cout.rdbuf(old_out);
+            std::cerr.rdbuf(old_err);
+        }
+
+        std::string trailer(1, '\0');
+        trailer += static_cast<char>(status & 0xff);
+        writeAll(client_fd, trailer);
+        close(client_fd);
+
+        if (stop_after) {
+            break;
         }
-        
-        return true;
     }
 
-    bool copyStorage(const std::string& save_directory = "./") {
-        if (!is_connected_ || !camera_) {
-            std::cerr << "Error: Camera not connected." << std::endl;
-            return false;
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    controller.waitForDownloads();
+    controller.printSessionStats();
+    controller.disconnect();
+    std::cout << "Camera daemon stopped." << std::endl;
+    return 0;
+}
+
+// swallows output but still pays for formatting it, for benchmarks
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        return n;
+    }
+};
+
+// cost per progress callback, replaying the callbacks of a 4 GB video
+// delivered in 64 KB steps (what DownloadCameraFile reports)
+void benchProgress() {
+    const int64_t total = 4LL << 30;
+    const int64_t step = 64 << 10;
+    const int rounds = 16;
+    const int64_t calls = rounds * (total / step);
+    NullBuffer null_buffer;
+    std::ostream null_out(&null_buffer);
+
+    auto run = [&](const char* name, const std::function<void(int64_t)>& callback) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            for (int64_t current = step; current <= total; current += step) {
+                callback(current);
+            }
         }
+        const double ms = elapsedMs(start);
+        std::cout << "  " << std::left << std::setw(34) << name << std::right << std::setw(8)
+                  << ms * 1e6 / calls << " ns/call, " << std::setw(7) << ms / rounds << " ms per 4 GB file" << std::endl;
+    };
 
-        // Check if camera is still connected
-        if (!camera_->IsConnected()) {
-            std::cerr << "Error: Camera connection lost." << std::endl;
-            is_connected_ = false;
-            return false;
+    std::cout << "Progress callback overhead (" << calls << " callbacks, output discarded):" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    run("format a line on every callback", [&](int64_t current) {
+        char line[128];
+        snprintf(line, sizeof(line), "\rDownload progress: %d%% (%s / %s)",
+                 static_cast<int>(current * 100 / total), formatBytes(current).c_str(), formatBytes(total).c_str());
+        null_out << line << std::flush;
+    });
+    ProgressReporter visible(&null_out);
+    run("ProgressReporter, foreground", [&](int64_t current) {
+        visible.update(current, total);
+    });
+    ProgressReporter silent(nullptr);
+    run("ProgressReporter, background", [&](int64_t current) {
+        silent.update(current, total);
+    });
+}
+
+// stands in for the SDK's live stream: Annex-B H.264 frames at a given bitrate and
+// frame rate (a keyframe with SPS/PPS every gop frames, P frames in between),
+// delivered to a StreamDelegate the way OnVideoData would be
+class SyntheticStream {
+private:
+    std::vector<uint8_t> keyframe_;
+    std::vector<uint8_t> frame_;
+    int fps_;
+    int gop_;
+
+    // start code, NAL header and bytes that never form another start code
+    static void fillNal(std::vector<uint8_t>& out, uint8_t header, size_t size, uint32_t& seed) {
+        static const uint8_t start_code[] = { 0, 0, 0, 1 };
+        out.insert(out.end(), start_code, start_code + 4);
+        out.push_back(header);
+        for (size_t i = 0; i < size; i++) {
+            seed = seed * 1103515245u + 12345u;
+            out.push_back(static_cast<uint8_t>(1 + (seed >> 16) % 255));
         }
+    }
 
-        std::cout << "Getting list of files from camera..." << std::endl;
-        std::vector<std::string> file_list = camera_->GetCameraFilesList();
-        
-        if (file_list.empty()) {
-            std::cout << "No files found on camera storage." << std::endl;
-            return true;
+public:
+    SyntheticStream(int64_t bitrate_bps, int fps, int gop) : fps_(fps), gop_(gop) {
+        // keyframes are about 5x the size of the frames in between
+        const size_t frame_bytes = static_cast<size_t>(bitrate_bps / 8 / fps);
+        const size_t p_bytes = frame_bytes * gop / (gop + 4);
+        uint32_t seed = 42;
+        fillNal(keyframe_, 0x67, 24, seed);  // SPS
+        fillNal(keyframe_, 0x68, 4, seed);   // PPS
+        fillNal(keyframe_, 0x65, p_bytes * 5, seed);
+        fillNal(frame_, 0x41, p_bytes, seed);
+    }
+
+    size_t bytesPerGop() const {
+        return keyframe_.size() + frame_.size() * (gop_ - 1);
+    }
+
+    // delivers frames for seconds at speed times the frame rate. returns the frames delivered.
+    int64_t run(ins_camera::StreamDelegate& delegate, double seconds, double speed) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto interval = std::chrono::microseconds(static_cast<int64_t>(1000000 / (fps_ * speed)));
+        int64_t index = 0;
+        while (elapsedMs(start) < seconds * 1000.0) {
+            const std::vector<uint8_t>& frame = index % gop_ == 0 ? keyframe_ : frame_;
+            delegate.OnVideoData(frame.data(), frame.size(), index * 1000 / fps_, 0, 0);
+            index++;
+            std::this_thread::sleep_until(start + interval * index);
         }
+        return index;
+    }
+};
 
-        std::cout << "Found " << file_list.size() << " file(s) on camera." << std::endl;
+// what the SDK example does: fwrite() straight from the callback
+class FwriteStreamDelegate : public ins_camera::StreamDelegate {
+private:
+    FILE* file_;
 
-        // Prepare save directory
-        std::string save_path = save_directory;
-        if (save_path.back() != '/' && save_path.back() != '\\') {
-            save_path += "/";
+public:
+    LatencyHistogram latency;
+
+    explicit FwriteStreamDelegate(const std::string& path) : file_(fopen(path.c_str(), "wb")) {}
+
+    ~FwriteStreamDelegate() {
+        if (file_) {
+            fclose(file_);
         }
-        
-        // Check if directory exists
-        if (!fileExists(save_path)) {
-            std::cerr << "Error: Save directory does not exist: " << save_path << std::endl;
-            return false;
+    }
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t, uint8_t, int) override {
+        const auto start = std::chrono::steady_clock::now();
+        if (file_) {
+            fwrite(data, size, 1, file_);
         }
+        latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+    }
 
-        int success_count = 0;
-        int fail_count = 0;
+    void OnAudioData(const uint8_t*, size_t, int64_t) override {}
+    void OnGyroData(const std::vector<ins_camera::GyroData>&) override {}
+    void OnExposureData(const ins_camera::ExposureData&) override {}
+};
 
-        // Download and delete each file
-        for (size_t i = 0; i < file_list.size(); i++) {
-            const std::string& file_url = file_list[i];
-            std::string file_name = getFileName(file_url);
-            
-            if (file_name.empty()) {
-                file_name = "file_" + getCurrentTime() + "_" + std::to_string(i);
-            }
-            
-            std::string full_path = save_path + file_name;
-            std::cout << "\n[" << (i + 1) << "/" << file_list.size() << "] Downloading: " << file_name << std::endl;
+// callback latency and drops of the stream recorder against fwrite() in the
+// callback, on a synthetic 10 Mbit/s 30 fps stream written to directory: in real
+// time, then as a burst at 8x the rate (what a card that stalls has to catch up with)
+void benchStream(const std::string& directory) {
+    std::string dir = directory;
+    if (dir.empty()) {
+        char temp[] = "/tmp/camera_control_bench.XXXXXX";
+        if (!mkdtemp(temp)) {
+            std::cerr << "Error: Cannot create a scratch directory: " << strerror(errno) << std::endl;
+            return;
+        }
+        dir = temp;
+    }
+    const std::string base = dir + "/bench_stream";
+    const double paced_seconds = 5.0;
+    const double burst_seconds = 2.0;
+    const double burst_speed = 8.0;
+    SyntheticStream stream(10LL * 1000 * 1000, 30, 30);
 
-            int64_t last_progress = -1;
-            int64_t last_current = -1;
-            auto last_update_time = std::chrono::steady_clock::now();
-            int64_t total_size_known = 0;
-            
-            bool download_success = camera_->DownloadCameraFile(file_url, full_path,
-                [&](int64_t current, int64_t total_size) {
-                    total_size_known = total_size;
-                    auto now = std::chrono::steady_clock::now();
-                    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_update_time).count();
-                    
-                    // Use floating-point for more accurate progress calculation
-                    double progress_double = total_size > 0 ? (static_cast<double>(current) * 100.0 / static_cast<double>(total_size)) : 0.0;
-                    int64_t progress = static_cast<int64_t>(progress_double);
-                    
-                    // Force 100% when current equals total_size (handle edge case)
-                    if (current >= total_size && total_size > 0) {
-                        progress = 100;
-                    }
-                    
-                    // Show progress if it changed, or if we're near completion
-                    if (progress != last_progress || (current != last_current && total_size > 0 && current >= total_size * 0.97)) {
-                        if (total_size > 0) {
-                            std::cout << "\rDownload progress: " << progress << "% (" 
-                                     << formatBytes(current) << " / " << formatBytes(total_size) << ")" << std::flush;
-                        } else {
-                            std::cout << "\rDownload progress: " << formatBytes(current) << " downloaded" << std::flush;
-                        }
-                        last_progress = progress;
-                        last_current = current;
-                        last_update_time = now;
-                    }
-                    
-                    // Timeout detection: if no progress for 30 seconds, warn
-                    if (elapsed > 30 && current == last_current && current < total_size) {
-                        std::cout << "\nWarning: Download appears stalled at " << progress << "%" << std::endl;
-                        std::cout << "Continuing to wait..." << std::flush;
-                    }
-                });
-            
-            // Explicitly show 100% if download succeeded (handles case where SDK doesn't call callback at 100%)
-            if (download_success) {
-                if (total_size_known > 0) {
-                    std::cout << "\rDownload progress: 100% (" << formatBytes(total_size_known) 
-                             << " / " << formatBytes(total_size_known) << ")" << std::flush;
-                } else {
-                    std::cout << "\rDownload progress: 100%" << std::flush;
-                }
-            }
+    std::cout << "Live stream recording, synthetic 10 Mbit/s H.264 at 30 fps into " << dir << ":" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (int burst = 0; burst < 2; burst++) {
+        const double seconds = burst ? burst_seconds : paced_seconds;
+        const double speed = burst ? burst_speed : 1.0;
+        std::cout << (burst ? "  8x burst for 2 s:" : "  real time for 5 s:") << std::endl;
+        {
+            FwriteStreamDelegate vendor(base + "_fwrite.h264");
+            const int64_t frames = stream.run(vendor, seconds, speed);
+            std::cout << "    fwrite in callback:   " << vendor.latency.summary() << " (" << frames << " frames)"
+                      << std::endl;
+        }
+        StreamRecorder recorder(DEFAULT_STREAM_BUFFER_BYTES, base, CODEC_H264);
+        recorder.start();
+        const int64_t frames = stream.run(recorder, seconds, speed);
+        recorder.stop();
+        std::cout << "    ring + writer thread: " << recorder.callbackLatency().summary() << " (" << frames
+                  << " frames, " << recorder.droppedFrames() << " dropped)" << std::endl;
+        if (burst) {
             std::cout << std::endl;
-            
-            if (download_success) {
-                // Verify file was actually written
-                int64_t file_size = getFileSize(full_path);
-                if (file_size < 0) {
-                    std::cerr << "Error: Download reported success but file does not exist: " << full_path << std::endl;
-                    fail_count++;
-                    continue;
-                }
-                if (file_size == 0) {
-                    std::cerr << "Error: Download reported success but file is empty: " << full_path << std::endl;
-                    fail_count++;
-                    continue;
-                }
-                if (total_size_known > 0 && file_size != total_size_known) {
-                    std::cerr << "Warning: File size mismatch. Expected: " << formatBytes(total_size_known) 
-                             << ", Got: " << formatBytes(file_size) << std::endl;
-                    // Still consider it success if file exists and has data
-                }
-                std::cout << "Successfully downloaded: " << full_path 
-                         << " (" << formatBytes(file_size) << ")" << std::endl;
-                
-                // Delete file from camera after successful download
-                std::cout << "Deleting from camera: " << file_url << std::endl;
-                bool delete_success = camera_->DeleteCameraFile(file_url);
-                
-                if (delete_success) {
-                    std::cout << "Successfully deleted from camera." << std::endl;
-                    success_count++;
-                } else {
-                    std::cerr << "Warning: Failed to delete file from camera: " << file_url << std::endl;
-                    std::cerr << "File was downloaded but remains on camera." << std::endl;
-                    success_count++; // Still count as success since download worked
-                }
-            } else {
-                std::cerr << "Error: Failed to download: " << file_url << std::endl;
-                fail_count++;
+            recorder.printStats(std::cout);
+        }
+    }
+    unlink((base + "_fwrite.h264").c_str());
+    unlink((base + "_0.h264").c_str());
+    unlink((base + "_0.h264.idx").c_str());
+    if (directory.empty()) {
+        rmdir(dir.c_str());
+    }
+}
+
+// an Annex-B H.264 bitstream of about size bytes: an SPS/PPS/IDR keyframe every 30
+// NAL units, P slices in between, random (encoder-like) payloads with emulation
+// prevention applied. returns the number of NAL units and keyframes in it.
+void buildSyntheticBitstream(size_t size, std::vector<uint8_t>& out, int64_t& nals, int64_t& keyframes) {
+    out.clear();
+    out.reserve(size + (1 << 20));
+    nals = 0;
+    keyframes = 0;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    auto add = [&](uint8_t header, size_t payload, bool long_start_code) {
+        static const uint8_t start_code[] = { 0, 0, 0, 1 };
+        out.insert(out.end(), start_code + (long_start_code ? 0 : 1), start_code + 4);
+        out.push_back(header);
+        int zeros = 0;
+        for (size_t i = 0; i < payload; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            const uint8_t byte = static_cast<uint8_t>(seed >> 24);
+            if (zeros >= 2 && byte <= 3) {
+                out.push_back(3);
+                zeros = 0;
             }
+            out.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+        // a NAL unit can't end in a zero byte
+        if (out.back() == 0) {
+            out.push_back(0x80);
         }
+        nals++;
+    };
+    while (out.size() < size) {
+        if (nals % 30 == 0) {
+            add(0x67, 24, true);
+            add(0x68, 4, true);
+            add(0x65, 200 * 1024, true);
+            keyframes++;
+        } else {
+            add(0x41, 40 * 1024, false);
+        }
+    }
+}
 
-        std::cout << "\n=== Copy Summary ===" << std::endl;
-        std::cout << "Successfully copied: " << success_count << " file(s)" << std::endl;
-        if (fail_count > 0) {
-            std::cout << "Failed: " << fail_count << " file(s)" << std::endl;
+// start code search and NAL classification throughput on a synthetic bitstream of
+// megabytes MB: byte loop, memchr() and the vector scan, then the incremental
+// scanner the stream recorder runs, fed in 64 KB pieces. false if the scans disagree
+bool benchNal(int megabytes) {
+    std::vector<uint8_t> stream;
+    int64_t expected_nals = 0;
+    int64_t expected_keyframes = 0;
+    buildSyntheticBitstream(static_cast<size_t>(megabytes) << 20, stream, expected_nals, expected_keyframes);
+    const uint8_t* begin = stream.data();
+    const uint8_t* end = begin + stream.size();
+    const double mb = stream.size() / 1e6;
+    const int rounds = 5;
+
+    std::cout << "Annex-B start code scan, " << formatBytes(static_cast<int64_t>(stream.size())) << " synthetic H.264 ("
+              << expected_nals << " NAL units, " << expected_keyframes << " keyframes), best of " << rounds << ":"
+              << std::endl;
+    std::cout << std::fixed << std::setprecision(0);
+    bool ok = true;
+    auto run = [&](const std::string& name, const std::function<int64_t()>& scan) {
+        double best = 0;
+        int64_t found = 0;
+        for (int r = 0; r < rounds; r++) {
+            const auto start = std::chrono::steady_clock::now();
+            found = scan();
+            const double ms = elapsedMs(start);
+            if (r == 0 || ms < best) {
+                best = ms;
+            }
         }
-        std::cout << "Total: " << file_list.size() << " file(s)" << std::endl;
+        std::cout << "  " << std::left << std::setw(34) << name << std::right << std::setw(8)
+                  << mb * 1000.0 / std::max(best, 0.001) << " MB/s  (" << found << " found)" << std::endl;
+        ok = ok && found == expected_nals;
+    };
+    typedef const uint8_t* (*Finder)(const uint8_t*, const uint8_t*);
+    auto count_with = [&](Finder find) {
+        int64_t count = 0;
+        for (const uint8_t* p = begin; (p = find(p, end)) != end; p += 3) {
+            count++;
+        }
+        return count;
+    };
+    run("byte loop", [&] { return count_with(findStartCodeScalar); });
+    run("memchr() for 01", [&] { return count_with(findStartCodeMemchr); });
+    run(std::string("vector compare (") + startCodeScanName() + ")", [&] { return count_with(findStartCode); });
+    int64_t keyframes = 0;
+    run("incremental scanner, 64 KB pieces", [&] {
+        AnnexBScanner scanner;
+        int64_t count = 0;
+        keyframes = 0;
+        for (size_t at = 0; at < stream.size(); at += 64 * 1024) {
+            scanner.scan(begin + at, std::min<size_t>(64 * 1024, stream.size() - at), [&](uint64_t, uint8_t header) {
+                count++;
+                keyframes += isRandomAccessNal(CODEC_H264, header) ? 1 : 0;
+            });
+        }
+        return count;
+    });
+    ok = ok && keyframes == expected_keyframes;
 
-        return fail_count == 0;
+    // pieces of 1 to 7 bytes split start codes every which way; offsets must match a whole-buffer scan
+    std::vector<uint64_t> offsets;
+    for (const uint8_t* p = begin; (p = findStartCode(p, end)) != end && offsets.size() < 4096; p += 3) {
+        offsets.push_back(static_cast<uint64_t>(p - begin));
     }
+    const size_t prefix = offsets.empty() ? 0 : static_cast<size_t>(offsets.back()) + 4;
+    AnnexBScanner scanner;
+    size_t matched = 0;
+    for (size_t at = 0, piece = 1; at < prefix; at += piece, piece = piece % 7 + 1) {
+        scanner.scan(begin + at, std::min(piece, prefix - at), [&](uint64_t offset, uint8_t) {
+            ok = ok && matched < offsets.size() && offsets[matched] == offset;
+            matched++;
+        });
+    }
+    ok = ok && matched == offsets.size();
+    std::cout << (ok ? "All scans agree." : "MISMATCH between scans.") << std::endl;
+    return ok;
+}
 
-    bool isConnected() const {
-        return is_connected_ && camera_ && camera_->IsConnected();
+// samples of a camera at rest on a moving vehicle, as an IMU reports them at 1 kHz:
+// microsecond timestamps with a little jitter, gravity plus slow motion plus sensor noise
+std::vector<ins_camera::GyroData> buildSyntheticImu(size_t count) {
+    std::vector<ins_camera::GyroData> samples(count);
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    auto noise = [&](double sigma) {
+        // sum of four uniforms, close enough to a normal distribution
+        double sum = 0;
+        for (int k = 0; k < 4; k++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            sum += static_cast<double>(seed >> 11) / 9007199254740992.0 - 0.5;
+        }
+        return sum * sigma * 1.732;
+    };
+    int64_t timestamp = 1000000;
+    for (size_t i = 0; i < count; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        timestamp += 1000 + static_cast<int64_t>(seed % 5) - 2;
+        const double t = timestamp / 1e6;
+        ins_camera::GyroData& sample = samples[i];
+        sample.timestamp = timestamp;
+        sample.ax = 0.3 * sin(t * 0.7) + noise(0.02);
+        sample.ay = 0.2 * sin(t * 1.3 + 1) + noise(0.02);
+        sample.az = 9.81 + 0.1 * sin(t * 2.1) + noise(0.02);
+        sample.gx = 0.05 * sin(t * 0.5) + noise(0.002);
+        sample.gy = 0.03 * sin(t * 0.9 + 2) + noise(0.002);
+        sample.gz = 0.2 * sin(t * 0.2) + noise(0.002);
     }
-};
+    return samples;
+}
+
+// gyro log size and speed on count synthetic 1 kHz IMU samples: against raw structs
+// and CSV, block encode and decode rates, time range queries through the mmap reader.
+// false if anything read back differs by more than the rounding
+bool benchGyro(size_t count) {
+    const std::vector<ins_camera::GyroData> samples = buildSyntheticImu(count);
+    const double raw_mb = count * sizeof(ins_camera::GyroData) / 1e6;
+    const int rounds = 3;
+    bool ok = true;
+
+    std::cout << "Gyro log, " << count << " synthetic samples (" << std::fixed << std::setprecision(0)
+              << count / 1000.0 << " s at 1 kHz), best of " << rounds << ":" << std::endl;
+    auto best_of = [&](const std::function<void()>& run) {
+        double best = 0;
+        for (int r = 0; r < rounds; r++) {
+            const auto start = std::chrono::steady_clock::now();
+            run();
+            const double ms = elapsedMs(start);
+            best = r == 0 ? ms : std::min(best, ms);
+        }
+        return std::max(best, 0.001);
+    };
+
+    size_t csv_bytes = 0;
+    const double csv_ms = best_of([&] {
+        char line[160];
+        csv_bytes = 0;
+        for (size_t i = 0; i < count; i++) {
+            const ins_camera::GyroData& sample = samples[i];
+            csv_bytes += static_cast<size_t>(snprintf(line, sizeof(line), "%lld,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n",
+                                                      static_cast<long long>(sample.timestamp), sample.ax, sample.ay,
+                                                      sample.az, sample.gx, sample.gy, sample.gz));
+        }
+    });
+    std::vector<uint8_t> encoded;
+    encoded.reserve(count * 16);
+    const double encode_ms = best_of([&] {
+        encoded.clear();
+        for (size_t at = 0; at < count; at += GYRO_BLOCK_SAMPLES) {
+            encodeGyroBlock(&samples[at], std::min<size_t>(GYRO_BLOCK_SAMPLES, count - at), GYRO_ACCEL_STEP,
+                            GYRO_RATE_STEP, encoded);
+        }
+    });
+    std::vector<ins_camera::GyroData> decoded;
+    decoded.reserve(count);
+    const double decode_ms = best_of([&] {
+        decoded.clear();
+        const uint8_t* end = encoded.data() + encoded.size();
+        for (const uint8_t* block = encoded.data(); block < end;
+             block += GYRO_BLOCK_HEADER_BYTES + getLittle<uint32_t>(block + 8)) {
+            if (!decodeGyroBlock(block, end, GYRO_ACCEL_STEP, GYRO_RATE_STEP, decoded)) {
+                ok = false;
+                break;
+            }
+        }
+    });
+    double worst_accel = 0;
+    double worst_rate = 0;
+    ok = ok && decoded.size() == count;
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = decoded[i].timestamp == samples[i].timestamp;
+        worst_accel = std::max(worst_accel, std::max(std::fabs(decoded[i].ax - samples[i].ax),
+                               std::max(std::fabs(decoded[i].ay - samples[i].ay), std::fabs(decoded[i].az - samples[i].az))));
+        worst_rate = std::max(worst_rate, std::max(std::fabs(decoded[i].gx - samples[i].gx),
+                              std::max(std::fabs(decoded[i].gy - samples[i].gy), std::fabs(decoded[i].gz - samples[i].gz))));
+    }
+    ok = ok && worst_accel <= GYRO_ACCEL_STEP * 0.5001 && worst_rate <= GYRO_RATE_STEP * 0.5001;
+
+    std::cout << std::setprecision(1);
+    std::cout << "  raw GyroData structs      " << std::setw(10) << formatBytes(static_cast<int64_t>(count * sizeof(ins_camera::GyroData)))
+              << "  " << std::setw(5) << static_cast<double>(sizeof(ins_camera::GyroData)) << " B/sample" << std::endl;
+    std::cout << "  CSV text                  " << std::setw(10) << formatBytes(static_cast<int64_t>(csv_bytes)) << "  "
+              << std::setw(5) << static_cast<double>(csv_bytes) / count << " B/sample, formatted at "
+              << raw_mb * 1000.0 / csv_ms << " MB/s" << std::endl;
+    std::cout << "  gyro log blocks           " << std::setw(10) << formatBytes(static_cast<int64_t>(encoded.size())) << "  "
+              << std::setw(5) << static_cast<double>(encoded.size()) / count << " B/sample, "
+              << static_cast<double>(count * sizeof(ins_camera::GyroData)) / encoded.size() << "x smaller than raw"
+              << std::endl;
+    std::cout << "  encode                    " << std::setw(10) << count / encode_ms / 1000.0 << " M samples/s ("
+              << raw_mb * 1000.0 / encode_ms << " MB/s of structs)" << std::endl;
+    std::cout << "  decode                    " << std::setw(10) << count / decode_ms / 1000.0 << " M samples/s ("
+              << raw_mb * 1000.0 / decode_ms << " MB/s of structs)" << std::endl;
+    std::cout << std::setprecision(6) << "  worst rounding error: accelerometer " << worst_accel << ", gyroscope "
+              << worst_rate << std::endl;
+
+    // through the file: write, then 1 s range queries via mmap, with and without the index
+    char temp[] = "/tmp/camera_control_bench.XXXXXX";
+    if (!mkdtemp(temp)) {
+        std::cerr << "Error: Cannot create a scratch directory: " << strerror(errno) << std::endl;
+        return false;
+    }
+    const std::string path = std::string(temp) + "/bench.gyro";
+    {
+        GyroLogWriter writer;
+        writer.open(path);
+        for (size_t at = 0; at < count; at += 10) {
+            writer.add(&samples[at], std::min<size_t>(10, count - at));  // as OnGyroData delivers them
+        }
+        writer.close();
+        ok = ok && writer.error().empty();
+    }
+    const int queries = 1000;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            // as if the writer died before close(): no index or footer
+            const int64_t file_size = getFileSize(path);
+            const int64_t tail = static_cast<int64_t>(((count + GYRO_BLOCK_SAMPLES - 1) / GYRO_BLOCK_SAMPLES) *
+                                                      GYRO_INDEX_ENTRY_BYTES + GYRO_FOOTER_BYTES);
+            if (truncate(path.c_str(), file_size - tail) != 0) {
+                ok = false;
+                break;
+            }
+        }
+        GyroLogReader reader;
+        std::string error;
+        if (!reader.open(path, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            ok = false;
+            break;
+        }
+        uint64_t seed = 7;
+        size_t returned = 0;
+        std::vector<ins_camera::GyroData> found;
+        const auto start = std::chrono::steady_clock::now();
+        for (int q = 0; q < queries; q++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            const size_t first = static_cast<size_t>((seed >> 33) % count);
+            found.clear();
+            ok = reader.query(samples[first].timestamp, samples[first].timestamp + 1000000, found) && ok;
+            returned += found.size();
+            ok = ok && !found.empty() && found.front().timestamp == samples[first].timestamp;
+        }
+        const double ms = elapsedMs(start);
+        std::cout << std::setprecision(1) << "  1 s range query, " << (reader.indexed() ? "index   " : "no index")
+                  << "  " << std::setw(6) << ms * 1000.0 / queries << " us (" << reader.blocks().size() << " blocks, "
+                  << returned / queries << " samples each)" << std::endl;
+        ok = ok && reader.indexed() == (pass == 0);
+    }
+    unlink(path.c_str());
+    rmdir(temp);
+    std::cout << (ok ? "Read back within the rounding steps." : "MISMATCH reading the log back.") << std::endl;
+    return ok;
+}
+
+// in-binary micro-benchmarks, no camera needed. returns a process exit status.
+int runBenchmark(const std::vector<std::string>& args) {
+    const std::string name = args.size() > 1 ? args[1] : "";
+    if (name == "progress") {
+        benchProgress();
+        return 0;
+    }
+    if (name == "stream") {
+        benchStream(args.size() > 2 ? args[2] : "");
+        return 0;
+    }
+    if (name == "nal") {
+        const int megabytes = args.size() > 2 ? atoi(args[2].c_str()) : 64;
+        return benchNal(megabytes > 0 ? megabytes : 64) ? 0 : 1;
+    }
+    if (name == "gyro") {
+        const long samples = args.size() > 2 ? atol(args[2].c_str()) : 0;
+        return benchGyro(samples > 0 ? static_cast<size_t>(samples) : 1000000) ? 0 : 1;
+    }
+    std::cerr << "Unknown benchmark '" << name << "'. Available: progress, stream, nal, gyro" << std::endl;
+    return 1;
+}
 
 void printUsage(const char* program_name) {
     std::cout << "Insta360 Camera Control for Raspberry Pi" << std::endl;
-    std::cout << "Usage: " << program_name << " <command> [options]" << std::endl;
+    std::cout << "Usage: " << program_name << " [--serial SN] [--time-sync-threshold MS] [--connections N] [--stall-timeout SEC] [--trace] [--trace-file FILE] <command> [options]" << std::endl;
     std::cout << std::endl;
     std::cout << "Commands:" << std::endl;
     std::cout << "  connect              - Connect to camera" << std::endl;
@@ -874,8 +7266,51 @@ void printUsage(const char* program_name) {
     std::cout << "  video-mode           - Switch camera to video mode" << std::endl;
     std::cout << "  record-start         - Start recording video (keeps connection open)" << std::endl;
     std::cout << "  record-stop [dir]    - Stop recording video (optionally save to directory)" << std::endl;
+    std::cout << "      --preview        - Download the LRV preview first, full resolution in the background" << std::endl;
     std::cout << "  copy-storage [dir]   - Copy all files from camera storage to directory (deletes from camera after copying)" << std::endl;
+    std::cout << "      --incremental    - Skip files the directory's copy manifest says were already copied" << std::endl;
+    std::cout << "      --order POLICY   - photos-first (default), smallest-first, newest-first, lrv-first or listing" << std::endl;
+    std::cout << "      --ext LIST       - Only files with these extensions, e.g. insp,insv" << std::endl;
+    std::cout << "      --since TIME     - Only files captured at or after TIME (YYYYMMDD[_HHMM[SS]] or an age: 30m, 1h, 2d)" << std::endl;
+    std::cout << "      --until TIME     - Only files captured at or before TIME" << std::endl;
+    std::cout << "      --max-size SIZE  - Only files up to SIZE (e.g. 500M; needs the HTTP server)" << std::endl;
+    std::cout << "      --fit            - If the files don't fit on disk, copy those that do (in --order) instead of refusing" << std::endl;
+    std::cout << "  list                 - List the files on the camera (cached, revalidated by file count)" << std::endl;
+    std::cout << "      --refresh        - Ignore the cached listing and fetch it from the camera" << std::endl;
+    std::cout << "  stream-record [dir]  - Record the live stream to LIVE_<time>_<n>.h264/.h265 (+ .idx keyframe index)" << std::endl;
+    std::cout << "      --seconds N      - Stop after N seconds (default: on Ctrl-C)" << std::endl;
+    std::cout << "      --lrv            - Stream the low resolution preview instead of full resolution" << std::endl;
+    std::cout << "      --buffer SIZE    - Frame buffer between the camera and the disk (default 16M)" << std::endl;
+    std::cout << "      --segment SEC    - Cut into segments of about SEC seconds at keyframes, listed in LIVE_<time>_<n>.segments" << std::endl;
+    std::cout << "      --retain SEC     - With --segment, delete segments older than the last SEC seconds" << std::endl;
+    std::cout << "  dashcam [dir]        - Keep the last seconds of the live stream in memory, save them on a trigger" << std::endl;
+    std::cout << "      --pre SEC        - Seconds kept before a trigger (default " << DEFAULT_PREROLL_SEC << ")" << std::endl;
+    std::cout << "      --post SEC       - Seconds saved after it (default " << DEFAULT_POSTROLL_SEC << ")" << std::endl;
+    std::cout << "      --memory SIZE    - Cap on the memory holding them (default 64M)" << std::endl;
+    std::cout << "      --fifo PATH      - Also trigger on each line written to this FIFO (Enter and SIGUSR1 always do)" << std::endl;
+    std::cout << "      --seconds N      - Stop after N seconds (default: on Ctrl-C or quit)" << std::endl;
+    std::cout << "      --lrv            - Stream the low resolution preview instead of full resolution" << std::endl;
+    std::cout << "  gyro-export FILE     - Print a .gyro log as CSV (no camera needed)" << std::endl;
+    std::cout << "      --from T, --to T - Only samples with timestamps from T and/or up to T" << std::endl;
+    std::cout << "  pending              - Show background photo downloads (interactive/daemon)" << std::endl;
+    std::cout << "  stats                - Show session counters (interactive/daemon)" << std::endl;
     std::cout << "  interactive          - Interactive mode" << std::endl;
+    std::cout << "  daemon [socket]      - Keep the camera open and serve commands over a unix socket" << std::endl;
+    std::cout << "  daemon-stop          - Stop a running daemon" << std::endl;
+    std::cout << "  bench <name>         - Run a micro-benchmark without a camera (progress, stream [dir], nal [MB], gyro [samples])" << std::endl;
+    std::cout << std::endl;
+    std::cout << "--serial SN selects a camera by serial number; otherwise the last camera used is preferred." << std::endl;
+    std::cout << "--time-sync-threshold MS only syncs the camera clock when it is off by more than MS (default "
+              << DEFAULT_TIME_SYNC_THRESHOLD_MS << ", 0 = always sync)." << std::endl;
+    std::cout << "--connections N downloads over the camera's HTTP server with N parallel range requests per file"
+              << " (default " << DEFAULT_HTTP_CONNECTIONS << ", 0 = SDK downloads only)." << std::endl;
+    std::cout << "--stall-timeout SEC cancels a download that makes no progress for SEC seconds and retries it up to "
+              << DOWNLOAD_RETRIES << " times (default " << DEFAULT_STALL_TIMEOUT_SEC << ", 0 = wait forever)." << std::endl;
+    std::cout << "--trace prints a per-phase latency breakdown of each command, --trace-file appends it as JSON lines." << std::endl;
+    std::cout << "When a daemon is running, commands are forwarded to it instead of reconnecting." << std::endl;
+    std::cout << "Socket: $CAMERA_CONTROL_SOCKET (default $XDG_RUNTIME_DIR/" << SOCKET_NAME
+              << ", else /tmp/camera_control-<uid>/" << SOCKET_NAME << "), "
+              << "set CAMERA_CONTROL_NO_DAEMON=1 to bypass it." << std::endl;
     std::cout << std::endl;
     std::cout << "Examples:" << std::endl;
     std::cout << "  " << program_name << " copy-storage ./videos   # Copy all files from camera storage to ./videos and delete from camera" << std::endl;
@@ -885,129 +7320,141 @@ void printUsage(const char* program_name) {
     std::cout << "  " << program_name << " record-stop ./videos    # Stop recording and save to ./videos" << std::endl;
     std::cout << "  " << program_name << " shutdown                # Power off camera" << std::endl;
     std::cout << "  " << program_name << " interactive             # Interactive mode" << std::endl;
+    std::cout << "  " << program_name << " daemon &                # Start daemon, later commands skip discovery" << std::endl;
 }
 
+// the tests build this file with CAMERA_CONTROL_NO_MAIN and their own main()
+#ifndef CAMERA_CONTROL_NO_MAIN
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         printUsage(argv[0]);
         return 1;
     }
 
-    std::string command = argv[1];
-    
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::vector<std::string> forward_args = args;
+    std::string serial;
+    std::string sync_threshold;
+    extractOption(args, "--serial", serial);
+    extractOption(args, "--time-sync-threshold", sync_threshold);
+    std::string trace_file;
+    extractOption(args, "--trace-file", trace_file);
+    std::string connections;
+    extractOption(args, "--connections", connections);
+    std::string stall_timeout;
+    extractOption(args, "--stall-timeout", stall_timeout);
+    bool print_trace = extractFlag(args, "--trace");
+    if (args.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::string command = args[0];
+
+    // hand the command to a running daemon so we don't pay for discovery + Open
+    const char* no_daemon = getenv("CAMERA_CONTROL_NO_DAEMON");
+    bool use_daemon = !(no_daemon && *no_daemon && std::string(no_daemon) != "0");
+    if (command == "bench") {
+        return runBenchmark(args);
+    }
+    if (command == "gyro-export") {
+        return exportGyroLog(args);
+    }
+    if (command == "daemon-stop") {
+        int status = 0;
+        if (!forwardToDaemon(getSocketPath(), args, status)) {
+            std::cerr << "No camera daemon running on " << getSocketPath() << std::endl;
+            return 1;
+        }
+        return status;
+    }
+    if (use_daemon && command != "daemon" && command != "interactive") {
+        int status = 0;
+        if (forwardToDaemon(getSocketPath(), forward_args, status)) {
+            if (status == 2) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            return status;
+        }
+    }
+
     CameraController controller;
+    controller.setPreferredSerial(serial);
+    if (!sync_threshold.empty()) {
+        controller.setTimeSyncThreshold(atoll(sync_threshold.c_str()));
+    }
+    if (!connections.empty()) {
+        controller.setHttpConnections(atoi(connections.c_str()));
+    }
+    if (!stall_timeout.empty()) {
+        controller.setStallTimeout(atoi(stall_timeout.c_str()));
+    }
+    controller.tracer().setPrintTable(print_trace);
+    controller.tracer().setTraceFile(trace_file);
+
+    // one-shot commands include the connect phases in their trace
+    controller.tracer().beginCommand(command == "daemon" || command == "interactive" ? "connect" : command);
 
     if (command == "connect") {
         if (!controller.discoverAndConnect()) {
+            controller.tracer().endCommand(false);
             return 1;
         }
         std::cout << "Camera connected. Use 'photo', 'shutdown', 'battery', 'storage', or video commands." << std::endl;
+        controller.tracer().endCommand(true);
         return 0;
     }
 
     // for other commands, we need to connect first
     if (!controller.discoverAndConnect()) {
+        controller.tracer().endCommand(false);
         return 1;
     }
 
-    if (command == "photo") {
-        std::string save_dir = (argc > 2) ? argv[2] : "./";
-        bool success = controller.takePhoto(save_dir);
-        controller.disconnect();
-        return success ? 0 : 1;
-    }
-    else if (command == "shutdown") {
-        bool success = controller.shutdownCamera();
-        controller.disconnect();
-        return success ? 0 : 1;
-    }
-    else if (command == "battery") {
-        bool success = controller.getBatteryStatus();
-        controller.disconnect();
-        return success ? 0 : 1;
-    }
-    else if (command == "storage") {
-        bool success = controller.getStorageStatus();
-        controller.disconnect();
-        return success ? 0 : 1;
-    }
-    else if (command == "video-mode") {
-        bool success = controller.setVideoMode();
-        controller.disconnect();
-        return success ? 0 : 1;
-    }
-    else if (command == "record-start") {
-        bool success = controller.startRecording();
-        // if (success) {
-        //     std::cout << "\nRecording in progress. Keep this process running." << std::endl;
-        //     std::cout << "Use 'record-stop' command in another terminal or Ctrl+C to stop." << std::endl;
-        //     std::cout << "Press Enter to stop recording and exit..." << std::endl;
-        //     std::cin.get();
-        //     controller.stopRecording();
-        // }
-        controller.disconnect();
-        return success ? 0 : 1;
-    }
-    else if (command == "record-stop") {
-        std::string save_dir = (argc > 2) ? argv[2] : "./";
-        bool success = controller.stopRecording(save_dir);
-        controller.disconnect();
-        return success ? 0 : 1;
-    }
-    else if (command == "copy-storage") {
-        std::string save_dir = (argc > 2) ? argv[2] : "./";
-        bool success = controller.copyStorage(save_dir);
-        controller.disconnect();
-        return success ? 0 : 1;
+    if (command == "daemon") {
+        controller.tracer().endCommand(true);
+        std::string socket_path = (args.size() > 1) ? args[1] : getSocketPath();
+        return runDaemon(controller, socket_path, print_trace);
     }
     else if (command == "interactive") {
+        controller.tracer().endCommand(true);
+        controller.setAsyncDownloads(true);
         std::cout << "\n=== Interactive Mode ===" << std::endl;
-        std::cout << "Commands: photo [dir], shutdown, battery, storage, record-start, record-stop [dir], quit" << std::endl;
+        std::cout << "Commands: photo [dir], shutdown, battery, storage, video-mode, record-start, record-stop [dir], copy-storage [dir], list, stream-record [dir], dashcam [dir], pending, stats, quit" << std::endl;
         
         std::string line;
         while (true) {
             std::cout << "\n> ";
-            std::getline(std::cin, line);
+            if (!std::getline(std::cin, line)) {
+                break;
+            }
             
             if (line == "quit" || line == "exit") {
                 break;
             }
-            else if (line == "photo") {
-                controller.takePhoto("./");
-            }
-            else if (line.substr(0, 5) == "photo") {
-                std::string dir = line.length() > 6 ? line.substr(6) : "./";
-                controller.takePhoto(dir);
-            }
-            else if (line == "shutdown") {
-                if (controller.shutdownCamera()) {
-                    break;
-                }
-            }
-            else if (line == "battery") {
-                controller.getBatteryStatus();
-            }
-            else if (line == "storage") {
-                controller.getStorageStatus();
-            }
-            else if (line == "video-mode") {
-                controller.setVideoMode();
-            }
-            else if (line == "record-start") {
-                controller.startRecording();
-            }
-            else if (line == "record-stop") {
-                controller.stopRecording("./");
+            else if (line.empty()) {
+                continue;
             }
-            else if (line.substr(0, 12) == "record-stop ") {
-                std::string dir = line.length() > 12 ? line.substr(12) : "./";
-                controller.stopRecording(dir);
+
+            // runCommand joins the words after any options back into one directory
+            std::vector<std::string> line_args;
+            std::stringstream words(line);
+            std::string word;
+            while (words >> word) {
+                line_args.push_back(word);
             }
-            else if (line.empty()) {
+            if (line_args.empty()) {
                 continue;
             }
-            else {
-                std::cout << "Unknown command. Try: photo, shutdown, battery, storage, video-mode, record-start, record-stop, quit" << std::endl;
+
+            controller.tracer().beginCommand(line_args[0]);
+            int status = runCommand(controller, line_args);
+            controller.tracer().endCommand(status == 0);
+            if (status == 2) {
+                std::cout << "Unknown command. Try: photo, shutdown, battery, storage, video-mode, record-start, record-stop, copy-storage, list, stream-record, dashcam, pending, stats, quit" << std::endl;
+            }
+            else if (line_args[0] == "shutdown" && status == 0) {
+                break;
             }
             
             // check if still connected
@@ -1017,15 +7464,19 @@ int main(int argc, char* argv[]) {
             }
         }
         
+        controller.waitForDownloads();
+        controller.printSessionStats();
         controller.disconnect();
         return 0;
     }
-    else {
-        std::cerr << "Unknown command: " << command << std::endl;
+
+    int status = runCommand(controller, args);
+    if (status == 2) {
         printUsage(argv[0]);
         return 1;
     }
-
-    return 0;
+    controller.tracer().endCommand(status == 0);
+    controller.disconnect();
+    return status;
 }
-
+#endif
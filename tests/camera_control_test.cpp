@@ -0,0 +1,1547 @@
+// tests for camera_control.cpp, built against the fake SDK in fake_camera.cpp (make test).
+// every test gets a fresh scratch directory; its output is only shown when it fails.
+#define CAMERA_CONTROL_NO_MAIN
+#include "../camera_control.cpp"
+
+#include "fake_camera.h"
+#include "http_standin.h"
+
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/wait.h>
+
+namespace {
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+struct RegisterTest {
+    RegisterTest(const char* name, void (*run)()) {
+        TestCase test = { name, run };
+        testCases().push_back(test);
+    }
+};
+
+#define TEST(name) \
+    void name(); \
+    RegisterTest register_##name(#name, name); \
+    void name()
+
+// failures of the running test, EXPECT may be used from helper threads
+std::mutex g_failures_mutex;
+std::vector<std::string> g_failures;
+
+void fail(const char* file, int line, const std::string& what) {
+    std::lock_guard<std::mutex> lock(g_failures_mutex);
+    g_failures.push_back(std::string(file) + ":" + std::to_string(line) + ": " + what);
+}
+
+#define EXPECT(condition) \
+    do { \
+        if (!(condition)) { \
+            fail(__FILE__, __LINE__, "expected " #condition); \
+        } \
+    } while (0)
+
+#define EXPECT_EQ(expected, actual) \
+    do { \
+        std::ostringstream expect_expected_, expect_actual_; \
+        expect_expected_ << (expected); \
+        expect_actual_ << (actual); \
+        if (expect_expected_.str() != expect_actual_.str()) { \
+            fail(__FILE__, __LINE__, "expected " #actual " == " + expect_expected_.str() + \
+                                     ", got " + expect_actual_.str()); \
+        } \
+    } while (0)
+
+bool contains(const std::string& text, const std::string& part) {
+    return text.find(part) != std::string::npos;
+}
+
+// what the running test printed so far (std::cout and std::cerr)
+std::ostringstream g_output;
+
+std::string testOutput() {
+    return g_output.str();
+}
+
+// scratch directory of the running test
+std::string g_scratch;
+
+int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+void removeTree(const std::string& path) {
+    nftw(path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+std::string scratchPath(const std::string& name) {
+    return g_scratch + "/" + name;
+}
+
+// names in a directory that start with prefix
+int countFiles(const std::string& directory, const std::string& prefix) {
+    int count = 0;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return 0;
+    }
+    while (dirent* entry = readdir(dir)) {
+        count += std::string(entry->d_name).compare(0, prefix.size(), prefix) == 0 ? 1 : 0;
+    }
+    closedir(dir);
+    return count;
+}
+
+// content that differs at every offset a range could start at, so misplaced bytes change the checksum
+void writePatternFile(const std::string& path, int64_t size) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::vector<char> block(64 * 1024);
+    uint32_t state = 12345;
+    for (int64_t written = 0; written < size; written += static_cast<int64_t>(block.size())) {
+        for (size_t i = 0; i < block.size(); i++) {
+            state = state * 1103515245u + 12345u;
+            block[i] = static_cast<char>(state >> 24);
+        }
+        out.write(block.data(), static_cast<std::streamsize>(std::min<int64_t>(block.size(), size - written)));
+    }
+}
+
+// tests/fixtures/DCIM/Camera01 (absolute, the daemon tests change directory): a small
+// photo and a zero-length video, like a camera whose recording was cut off. files
+// spanning several HTTP_CHUNK_SIZE ranges are written by the tests instead of being
+// kept in the repository.
+std::string g_fixture_dir;
+
+std::string fixtureDir() {
+    return g_fixture_dir;
+}
+
+// a camera directory in the scratch area holding the fixture files
+std::string makeCameraDir() {
+    const std::string camera_dir = scratchPath("camera");
+    mkdir(camera_dir.c_str(), 0755);
+    DIR* dir = opendir(fixtureDir().c_str());
+    EXPECT(dir != nullptr);
+    while (dir) {
+        dirent* entry = readdir(dir);
+        if (!entry) {
+            closedir(dir);
+            break;
+        }
+        const std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            std::ifstream in(fixtureDir() + "/" + name, std::ios::binary);
+            std::ofstream out(camera_dir + "/" + name, std::ios::binary);
+            out << in.rdbuf();
+        }
+    }
+    return camera_dir;
+}
+
+uint32_t fileChecksum(const std::string& path) {
+    uint32_t crc = 0;
+    EXPECT(crc32cFile(path, crc));
+    return crc;
+}
+
+// waits up to timeout_ms for ready() to come true
+template <typename F>
+bool waitFor(F ready, int timeout_ms = 5000) {
+    const auto start = std::chrono::steady_clock::now();
+    while (!ready()) {
+        if (elapsedMs(start) > timeout_ms) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+int listenOn(const std::string& socket_path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        return -1;
+    }
+    return fd;
+}
+
+// sends one request with a cwd line of our choosing, the way forwardToDaemon() frames it,
+// and splits the reply into output and exit status. false if the trailer never came.
+bool daemonRequest(const std::string& socket_path, const std::string& cwd, const std::vector<std::string>& args,
+                   std::string& output, int& status) {
+    output.clear();
+    status = -1;
+    int fd = connectToSocket(socket_path);
+    if (fd < 0) {
+        return false;
+    }
+    std::string request = cwd + "\n";
+    for (size_t i = 0; i < args.size(); i++) {
+        request += args[i] + "\n";
+    }
+    request += "\n";
+    std::string reply;
+    if (writeAll(fd, request)) {
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            reply.append(buffer, static_cast<size_t>(n));
+        }
+    }
+    close(fd);
+
+    // exactly one '\0' and one status byte after it, at the very end
+    const size_t nul = reply.find('\0');
+    if (nul == std::string::npos || nul + 2 != reply.size()) {
+        output = reply;
+        return false;
+    }
+    output = reply.substr(0, nul);
+    status = static_cast<unsigned char>(reply[nul + 1]);
+    return true;
+}
+
+// a daemon on a fake camera, serving from its own thread
+class DaemonFixture {
+private:
+    CameraController controller_;
+    std::thread thread_;
+    std::atomic<int> exit_code_;
+
+public:
+    const std::string socket_path;
+
+    // http_base_url: the camera's file server, empty for none
+    explicit DaemonFixture(const std::string& http_base_url = std::string())
+        : exit_code_(-1), socket_path(scratchPath("daemon.sock")) {
+        fake_camera::reset(scratchPath("camera"));
+        fake_camera::control().http_base_url = http_base_url;
+        if (!controller_.discoverAndConnect()) {
+            fail(__FILE__, __LINE__, "fake camera did not connect");
+            return;
+        }
+        thread_ = std::thread([this] { exit_code_ = runDaemon(controller_, socket_path, false); });
+        const std::string path = socket_path;
+        waitFor([path] {
+            int fd = connectToSocket(path);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return fd >= 0;
+        });
+    }
+
+    ~DaemonFixture() {
+        if (thread_.joinable()) {
+            stop();
+        }
+    }
+
+    // daemon-stop, then waits for runDaemon() to return its exit code
+    int stop() {
+        std::string output;
+        int status = 0;
+        daemonRequest(socket_path, "/", std::vector<std::string>(1, "daemon-stop"), output, status);
+        thread_.join();
+        return exit_code_;
+    }
+};
+
+std::vector<std::string> words(const char* a, const char* b = nullptr, const char* c = nullptr,
+                               const char* d = nullptr) {
+    std::vector<std::string> list(1, a);
+    const char* more[] = { b, c, d };
+    for (size_t i = 0; i < 3 && more[i]; i++) {
+        list.push_back(more[i]);
+    }
+    return list;
+}
+
+// ---- daemon protocol ----
+
+TEST(readRequestParsesCwdAndArgLines) {
+    int fds[2];
+    EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    // arrives in pieces, the terminating empty line last
+    std::thread writer([&] {
+        writeAll(fds[1], "/home/pi/captures\nphoto\n");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        writeAll(fds[1], "./with space\n");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        writeAll(fds[1], "\n");
+    });
+    std::string cwd;
+    std::vector<std::string> args;
+    EXPECT(readRequest(fds[0], cwd, args));
+    writer.join();
+    EXPECT_EQ("/home/pi/captures", cwd);
+    EXPECT_EQ(2u, args.size());
+    EXPECT(args.size() == 2 && args[0] == "photo" && args[1] == "./with space");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(readRequestRejectsIncompleteRequests) {
+    int fds[2];
+    std::string cwd;
+    std::vector<std::string> args;
+
+    // a cwd line but no command
+    EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    writeAll(fds[1], "/tmp\n\n");
+    EXPECT(!readRequest(fds[0], cwd, args));
+    close(fds[0]);
+    close(fds[1]);
+
+    // client hung up before the terminating empty line
+    EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    writeAll(fds[1], "/tmp\nphoto\n");
+    close(fds[1]);
+    EXPECT(!readRequest(fds[0], cwd, args));
+    close(fds[0]);
+}
+
+TEST(forwardToDaemonSendsCwdAndArgsAndReadsTrailer) {
+    const std::string socket_path = scratchPath("scripted.sock");
+    int listen_fd = listenOn(socket_path);
+    EXPECT(listen_fd >= 0);
+
+    std::string cwd;
+    std::vector<std::string> args;
+    std::thread server([&] {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        EXPECT(readRequest(fd, cwd, args));
+        std::string reply = "first line\nsecond line\n";
+        reply += '\0';
+        reply += static_cast<char>(3);
+        writeAll(fd, reply);
+        close(fd);
+    });
+    int status = 0;
+    EXPECT(forwardToDaemon(socket_path, words("copy-storage", "--serial", "IXSE0001"), status));
+    server.join();
+    close(listen_fd);
+
+    char here[4096];
+    EXPECT(getcwd(here, sizeof(here)) != nullptr);
+    EXPECT_EQ(here, cwd);
+    EXPECT_EQ(3u, args.size());
+    EXPECT(args == words("copy-storage", "--serial", "IXSE0001"));
+    EXPECT_EQ(3, status);
+    EXPECT_EQ("first line\nsecond line\n", testOutput());
+}
+
+TEST(forwardToDaemonReportsMissingTrailer) {
+    const std::string socket_path = scratchPath("scripted.sock");
+    int status = 0;
+    // nobody listening: the caller runs the command itself
+    EXPECT(!forwardToDaemon(socket_path, words("battery"), status));
+
+    int listen_fd = listenOn(socket_path);
+    std::thread server([&] {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        std::string cwd;
+        std::vector<std::string> args;
+        readRequest(fd, cwd, args);
+        writeAll(fd, "partial output");
+        close(fd);
+    });
+    EXPECT(forwardToDaemon(socket_path, words("battery"), status));
+    server.join();
+    close(listen_fd);
+    EXPECT_EQ(1, status);
+    EXPECT(contains(testOutput(), "partial output"));
+    EXPECT(contains(testOutput(), "Lost connection to camera daemon"));
+}
+
+TEST(socketPathIsPrivateToTheUser) {
+    const char* saved_socket = getenv("CAMERA_CONTROL_SOCKET");
+    const char* saved_runtime = getenv("XDG_RUNTIME_DIR");
+    const std::string old_socket = saved_socket ? saved_socket : "";
+    const std::string old_runtime = saved_runtime ? saved_runtime : "";
+
+    setenv("CAMERA_CONTROL_SOCKET", "/somewhere/else.sock", 1);
+    EXPECT_EQ("/somewhere/else.sock", getSocketPath());
+    unsetenv("CAMERA_CONTROL_SOCKET");
+    setenv("XDG_RUNTIME_DIR", scratchPath("run").c_str(), 1);
+    EXPECT_EQ(scratchPath("run") + "/camera_control.sock", getSocketPath());
+
+    // no runtime directory: a 0700 directory of our own under /tmp
+    unsetenv("XDG_RUNTIME_DIR");
+    const std::string dir = "/tmp/camera_control-" + std::to_string(geteuid());
+    EXPECT_EQ(dir + "/camera_control.sock", getSocketPath());
+    struct stat st;
+    EXPECT(lstat(dir.c_str(), &st) == 0);
+    EXPECT(S_ISDIR(st.st_mode));
+    EXPECT_EQ(0700u, st.st_mode & 0777u);
+    EXPECT(st.st_uid == geteuid());
+
+    // one that others can get into is not used
+    chmod(dir.c_str(), 0755);
+    EXPECT_EQ("", getSocketPath());
+    EXPECT(contains(testOutput(), "is not a private directory"));
+    chmod(dir.c_str(), 0700);
+
+    if (saved_socket) {
+        setenv("CAMERA_CONTROL_SOCKET", old_socket.c_str(), 1);
+    }
+    if (saved_runtime) {
+        setenv("XDG_RUNTIME_DIR", old_runtime.c_str(), 1);
+    }
+}
+
+TEST(daemonRejectsOtherUsers) {
+    int fds[2];
+    EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    EXPECT(peerIsOwner(fds[0]));
+    close(fds[0]);
+    close(fds[1]);
+
+    DaemonFixture daemon;
+    struct stat st;
+    EXPECT(stat(daemon.socket_path.c_str(), &st) == 0);
+    EXPECT_EQ(0600u, st.st_mode & 0777u);
+
+    // connecting as someone else needs root to switch users
+    if (geteuid() == 0) {
+        // let the other user reach the socket so only the uid check stops it
+        const std::string base = g_scratch.substr(0, g_scratch.rfind('/'));
+        chmod(base.c_str(), 0711);
+        chmod(daemon.socket_path.c_str(), 0666);
+        pid_t child = fork();
+        if (child == 0) {
+            if (setgid(65534) != 0 || setuid(65534) != 0) {
+                _exit(2);
+            }
+            int fd = connectToSocket(daemon.socket_path);
+            if (fd < 0) {
+                _exit(3);
+            }
+            const char request[] = "/\nbattery\n\n";
+            if (write(fd, request, sizeof(request) - 1) < 0) {
+                _exit(4);
+            }
+            // closed without a reply (a reset, since the request went unread)
+            char reply[64];
+            _exit(read(fd, reply, sizeof(reply)) <= 0 ? 0 : 1);
+        }
+        int wait_status = -1;
+        EXPECT(waitpid(child, &wait_status, 0) == child);
+        EXPECT(WIFEXITED(wait_status));
+        EXPECT_EQ(0, WEXITSTATUS(wait_status));
+        EXPECT(contains(testOutput(), "Rejected connection from another user"));
+        chmod(base.c_str(), 0700);
+    }
+
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("battery"), output, status));
+    EXPECT_EQ(0, status);
+}
+
+TEST(daemonRunsCommandsInClientDirectory) {
+    const std::string client_dir = scratchPath("client");
+    mkdir(client_dir.c_str(), 0755);
+    mkdir((client_dir + "/shots").c_str(), 0755);
+    DaemonFixture daemon;
+
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("photo", "shots"), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(contains(output, "Queued download to: " + client_dir + "/shots/IMG_"));
+
+    EXPECT(daemonRequest(daemon.socket_path, scratchPath("missing"), words("battery"), output, status));
+    EXPECT(contains(output, "Cannot change to client directory: " + scratchPath("missing")));
+
+    // daemon-stop waits for the queued photo
+    EXPECT_EQ(0, daemon.stop());
+    EXPECT_EQ(1, countFiles(client_dir + "/shots", "IMG_"));
+}
+
+TEST(daemonStopEndsTheDaemon) {
+    DaemonFixture daemon;
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("battery"), output, status));
+    EXPECT_EQ(0, status);
+
+    EXPECT_EQ(0, daemon.stop());
+    EXPECT(!fileExists(daemon.socket_path));
+    EXPECT(!daemonRequest(daemon.socket_path, "/", words("battery"), output, status));
+}
+
+TEST(daemonRejectsSerialMismatch) {
+    DaemonFixture daemon;
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("--serial", "IXSE9999", "battery"), output, status));
+    EXPECT_EQ(1, status);
+    EXPECT(contains(output, "Daemon is connected to camera IXSE0001, not IXSE9999."));
+
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("--serial", "IXSE0001", "battery"), output, status));
+    EXPECT_EQ(0, status);
+}
+
+TEST(daemonRejectsInteractiveCommands) {
+    DaemonFixture daemon;
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("interactive"), output, status));
+    EXPECT_EQ(2, status);
+    EXPECT(contains(output, "'interactive' cannot be run through the daemon"));
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("daemon"), output, status));
+    EXPECT_EQ(2, status);
+
+    // dashcam would poll the daemon's stdin for triggers and never return
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("dashcam", "--fifo", "/tmp/unused", "."), output, status));
+    EXPECT_EQ(1, status);
+    EXPECT(contains(output, "'dashcam' reads its triggers from the terminal"));
+    EXPECT_EQ(0, fake_camera::control().streams);
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("battery"), output, status));
+    EXPECT_EQ(0, status);
+}
+
+TEST(daemonRejectsOpenEndedStreamRecord) {
+    const std::string client_dir = scratchPath("client");
+    mkdir(client_dir.c_str(), 0755);
+    DaemonFixture daemon;
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("stream-record", "."), output, status));
+    EXPECT_EQ(1, status);
+    EXPECT(contains(output, "'stream-record' through the daemon needs --seconds N"));
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("stream-record", "--seconds", "0", "."), output, status));
+    EXPECT_EQ(1, status);
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("stream-record", "--seconds=0", "."), output, status));
+    EXPECT_EQ(1, status);
+
+    // a bounded recording runs, in either option form, and the daemon serves the next command afterwards
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("stream-record", "--seconds", "1", "."), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("stream-record", "--seconds=1", "."), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("battery"), output, status));
+    EXPECT_EQ(0, status);
+}
+
+TEST(daemonStopsAfterSignalEndsRecording) {
+    const std::string client_dir = scratchPath("client");
+    mkdir(client_dir.c_str(), 0755);
+    DaemonFixture daemon;
+    // Ctrl-C on the daemon once the recording is under way; blocked here and in the
+    // interrupter so the daemon's thread is the one that takes it
+    sigset_t signals, old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    std::thread interrupter([] {
+        if (waitFor([] { return fake_camera::control().streams > 0; })) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            kill(getpid(), SIGTERM);
+        }
+    });
+    std::string output;
+    int status = -1;
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("stream-record", "--seconds", "30", "."), output, status));
+    interrupter.join();
+    pthread_sigmask(SIG_SETMASK, &old_signals, nullptr);
+    EXPECT_EQ(0, status);
+    EXPECT(elapsedMs(start) < 10000);
+    // the signal stopped the daemon too, after the recording was saved
+    EXPECT(waitFor([&daemon] { return !fileExists(daemon.socket_path); }));
+}
+
+TEST(daemonAppliesProcessOptionsPerCommand) {
+    const std::string camera_dir = scratchPath("camera");
+    mkdir(camera_dir.c_str(), 0755);
+    const std::string photo = "IMG_20250101_120000_00_001.insp";
+    writePatternFile(camera_dir + "/" + photo, 300000);
+    HttpStandIn server(camera_dir);
+    DaemonFixture daemon(server.baseUrl());
+    std::string output;
+    int status = -1;
+    // a global option before the command, as main() forwards it
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("--connections", "2", "battery"), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(!contains(output, "Unknown command"));
+
+    // --connections 0 keeps this copy on the SDK, and isn't taken for the save directory
+    const std::string client_dir = scratchPath("client");
+    mkdir(client_dir.c_str(), 0755);
+    mkdir((client_dir + "/sdk").c_str(), 0755);
+    mkdir((client_dir + "/http").c_str(), 0755);
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("copy-storage", "--connections", "0", "sdk"), output,
+                         status));
+    EXPECT_EQ(0, status);
+    EXPECT_EQ(0, server.requests);
+    EXPECT_EQ(1, fake_camera::control().downloads);
+    EXPECT(fileExists(client_dir + "/sdk/" + photo));
+
+    // the next command is back on the daemon's own setting
+    writePatternFile(camera_dir + "/" + photo, 300000);
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("copy-storage", "http"), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(server.requests > 0);
+    EXPECT_EQ(1, fake_camera::control().downloads);
+    EXPECT(fileExists(client_dir + "/http/" + photo));
+}
+
+TEST(daemonAppliesStallTimeoutPerCommand) {
+    const std::string camera_dir = scratchPath("camera");
+    mkdir(camera_dir.c_str(), 0755);
+    writePatternFile(camera_dir + "/IMG_20250101_120000_00_001.insp", 300000);
+    const std::string client_dir = scratchPath("client");
+    mkdir(client_dir.c_str(), 0755);
+    DaemonFixture daemon;
+    fake_camera::control().hang_downloads = 1;
+    std::string output;
+    int status = -1;
+    // the daemon's own 30 s default would hold this copy far longer than the test waits
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("--stall-timeout", "1", "copy-storage", "."), output,
+                         status));
+    EXPECT_EQ(0, status);
+    EXPECT(elapsedMs(start) < 15000);
+    EXPECT_EQ(1, fake_camera::control().cancels);
+    EXPECT_EQ(2, fake_camera::control().downloads);
+    EXPECT(fileExists(client_dir + "/IMG_20250101_120000_00_001.insp"));
+}
+
+TEST(daemonAppliesTimeSyncThresholdToReconnect) {
+    DaemonFixture daemon;
+    std::string output;
+    int status = -1;
+    fake_camera::control().connected = false;
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("--time-sync-threshold", "5000", "battery"), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(contains(output, "within 5000 ms, skipping time sync"));
+
+    fake_camera::control().connected = false;
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("battery"), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(contains(output, "within 2000 ms, skipping time sync"));
+}
+
+TEST(daemonWritesClientTraceFile) {
+    const std::string client_dir = scratchPath("client");
+    mkdir(client_dir.c_str(), 0755);
+    DaemonFixture daemon;
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("--trace-file", "trace.jsonl", "battery"), output,
+                         status));
+    EXPECT_EQ(0, status);
+    EXPECT(!contains(output, "Unknown command"));
+    // only the command that asked for it is written
+    EXPECT(daemonRequest(daemon.socket_path, client_dir, words("storage"), output, status));
+    EXPECT_EQ(0, status);
+
+    std::ifstream in(client_dir + "/trace.jsonl");
+    std::string line;
+    EXPECT(std::getline(in, line));
+    EXPECT(contains(line, "{\"command\":\"battery\""));
+    EXPECT(contains(line, "\"ok\":true"));
+    EXPECT(!std::getline(in, line));
+}
+
+TEST(daemonReconnectsWhenCameraDropped) {
+    DaemonFixture daemon;
+    const int opens = fake_camera::control().opens;
+    fake_camera::control().connected = false;
+
+    std::string output;
+    int status = -1;
+    EXPECT(daemonRequest(daemon.socket_path, "/", words("battery"), output, status));
+    EXPECT_EQ(0, status);
+    EXPECT(contains(output, "Camera not connected, reconnecting..."));
+    // the warm path re-opens the known device without another discovery
+    EXPECT(contains(output, "Reconnecting to: Insta360 X4 (SN: IXSE0001)"));
+    EXPECT_EQ(opens + 1, fake_camera::control().opens);
+    EXPECT_EQ(1, fake_camera::control().discoveries);
+}
+
+// ---- HTTP downloads ----
+
+TEST(httpDownloadResumesAfterDroppedConnection) {
+    const std::string camera_dir = scratchPath("camera");
+    mkdir(camera_dir.c_str(), 0755);
+    const int64_t size = 3 * 1024 * 1024;
+    writePatternFile(camera_dir + "/VID_20250101_120000_00_001.insv", size);
+    HttpStandIn server(camera_dir);
+    server.dropAt(1024 * 1024);
+
+    HttpDownloader http(server.baseUrl(), 1, 5);
+    const std::string remote = "/DCIM/Camera01/VID_20250101_120000_00_001.insv";
+    const std::string local = scratchPath("VID_20250101_120000_00_001.insv");
+    int64_t resumed_from = -1;
+    uint32_t checksum = 0;
+    double checksum_ms = 0.0;
+    std::string error;
+    EXPECT(!http.download(remote, local, ins_camera::DownloadProgressCallBack(), resumed_from, checksum,
+                          checksum_ms, error));
+    EXPECT_EQ("connection closed early", error);
+    EXPECT_EQ(0, resumed_from);
+    EXPECT(fileExists(HttpDownloader::partPath(local)));
+    EXPECT(fileExists(HttpDownloader::statePath(local)));
+    EXPECT_EQ(1024 * 1024, HttpDownloader::resumableBytes(local));
+
+    EXPECT(http.download(remote, local, ins_camera::DownloadProgressCallBack(), resumed_from, checksum,
+                         checksum_ms, error));
+    EXPECT_EQ(1024 * 1024, resumed_from);
+    EXPECT_EQ(fileChecksum(camera_dir + "/VID_20250101_120000_00_001.insv"), checksum);
+    EXPECT_EQ(checksum, fileChecksum(local));
+    EXPECT(!fileExists(HttpDownloader::partPath(local)));
+    EXPECT(!fileExists(HttpDownloader::statePath(local)));
+    // the file once plus one byte per probe: nothing before the checkpoint was fetched twice
+    EXPECT_EQ(size + 2, server.bytes_sent);
+}
+
+TEST(httpDownloadResumesParallelRanges) {
+    const std::string camera_dir = scratchPath("camera");
+    mkdir(camera_dir.c_str(), 0755);
+    const int64_t size = 3 * HTTP_CHUNK_SIZE + 12345;
+    writePatternFile(camera_dir + "/VID_20250101_120000_00_002.insv", size);
+    HttpStandIn server(camera_dir);
+    // one range connection drops, the others stop where they are
+    server.dropAt(HTTP_CHUNK_SIZE / 2);
+
+    HttpDownloader http(server.baseUrl(), 4, 5);
+    const std::string remote = "/DCIM/Camera01/VID_20250101_120000_00_002.insv";
+    const std::string local = scratchPath("VID_20250101_120000_00_002.insv");
+    int64_t resumed_from = -1;
+    uint32_t checksum = 0;
+    double checksum_ms = 0.0;
+    std::string error;
+    EXPECT(!http.download(remote, local, ins_camera::DownloadProgressCallBack(), resumed_from, checksum,
+                          checksum_ms, error));
+    const int64_t committed = HttpDownloader::resumableBytes(local);
+    EXPECT(committed >= HTTP_CHUNK_SIZE / 2);
+
+    EXPECT(http.download(remote, local, ins_camera::DownloadProgressCallBack(), resumed_from, checksum,
+                         checksum_ms, error));
+    EXPECT_EQ(committed, resumed_from);
+    EXPECT_EQ(fileChecksum(camera_dir + "/VID_20250101_120000_00_002.insv"), checksum);
+    EXPECT_EQ(checksum, fileChecksum(local));
+}
+
+TEST(httpDownloadReassemblesParallelRanges) {
+    const std::string camera_dir = makeCameraDir();
+    const int64_t size = 3 * HTTP_CHUNK_SIZE + 12345;
+    writePatternFile(camera_dir + "/VID_20250101_120020_00_003.insv", size);
+    HttpStandIn server(camera_dir);
+    HttpDownloader http(server.baseUrl(), 4, 5);
+
+    const std::string local = scratchPath("VID_20250101_120020_00_003.insv");
+    int64_t resumed_from = -1;
+    uint32_t checksum = 0;
+    double checksum_ms = 0.0;
+    std::string error;
+    int64_t last_progress = 0;
+    EXPECT(http.download("/DCIM/Camera01/VID_20250101_120020_00_003.insv", local,
+                         [&](int64_t current, int64_t) { last_progress = current; },
+                         resumed_from, checksum, checksum_ms, error));
+    EXPECT_EQ("", error);
+    // the 0-0 probe and one range per chunk, the last one short
+    EXPECT_EQ(5, server.requests);
+    EXPECT_EQ(5, server.range_requests);
+    EXPECT_EQ(size, getFileSize(local));
+    EXPECT_EQ(size, last_progress);
+    EXPECT_EQ(fileChecksum(camera_dir + "/VID_20250101_120020_00_003.insv"), checksum);
+    EXPECT_EQ(checksum, fileChecksum(local));
+
+    // a file below HTTP_CHUNK_SIZE is a single range
+    const std::string photo = scratchPath("IMG_20250101_120000_00_001.insp");
+    EXPECT(http.download("/DCIM/Camera01/IMG_20250101_120000_00_001.insp", photo,
+                         ins_camera::DownloadProgressCallBack(), resumed_from, checksum, checksum_ms, error));
+    EXPECT_EQ(7, server.requests);
+    EXPECT_EQ(fileChecksum(fixtureDir() + "/IMG_20250101_120000_00_001.insp"), checksum);
+}
+
+TEST(httpDownloadWithoutRangeSupportUsesOneConnection) {
+    const std::string camera_dir = makeCameraDir();
+    const int64_t size = 2 * HTTP_CHUNK_SIZE + 777;
+    writePatternFile(camera_dir + "/VID_20250101_120020_00_003.insv", size);
+    HttpStandIn server(camera_dir);
+    server.setRanges(false);
+    HttpDownloader http(server.baseUrl(), 4, 5);
+
+    const std::string remote = "/DCIM/Camera01/VID_20250101_120020_00_003.insv";
+    const std::string local = scratchPath("VID_20250101_120020_00_003.insv");
+    int64_t resumed_from = -1;
+    uint32_t checksum = 0;
+    double checksum_ms = 0.0;
+    std::string error;
+    EXPECT(http.download(remote, local, ins_camera::DownloadProgressCallBack(), resumed_from, checksum,
+                         checksum_ms, error));
+    // the probe (answered with the whole file, abandoned after the headers) and one plain GET
+    EXPECT_EQ(2, server.requests);
+    EXPECT_EQ(0, server.range_requests);
+    EXPECT_EQ(fileChecksum(camera_dir + "/VID_20250101_120020_00_003.insv"), checksum);
+    EXPECT_EQ(checksum, fileChecksum(local));
+    EXPECT(!fileExists(HttpDownloader::statePath(local)));
+
+    // without ranges there is nothing to resume from, so an interrupted transfer leaves nothing behind
+    const std::string again = scratchPath("again.insv");
+    server.dropAt(HTTP_CHUNK_SIZE);
+    EXPECT(!http.download(remote, again, ins_camera::DownloadProgressCallBack(), resumed_from, checksum,
+                          checksum_ms, error));
+    EXPECT_EQ("connection closed early", error);
+    EXPECT(!fileExists(HttpDownloader::partPath(again)));
+    EXPECT(!fileExists(HttpDownloader::statePath(again)));
+}
+
+TEST(zeroLengthFileFallsBackToSdk) {
+    const std::string camera_dir = makeCameraDir();
+    fake_camera::reset(camera_dir);
+    HttpStandIn server(camera_dir);
+    PhaseTracer tracer;
+    TransferEngine engine(tracer);
+    engine.attach(std::make_shared<ins_camera::Camera>(ins_camera::DeviceConnectionInfo()), server.baseUrl());
+
+    // the 0-0 probe can't be satisfied for an empty file: 416, and the SDK takes over
+    const std::string local = scratchPath("VID_20250101_120010_00_002.insv");
+    DownloadResult result = engine.transfer("/DCIM/Camera01/VID_20250101_120010_00_002.insv", local, false);
+    EXPECT(result.success);
+    EXPECT_EQ(1, server.requests);
+    EXPECT_EQ("HTTP download failed (HTTP status 416), used camera SDK instead", result.warning);
+    EXPECT_EQ(1, fake_camera::control().downloads);
+    EXPECT_EQ(0, getFileSize(local));
+    EXPECT_EQ(0, result.retries);
+    engine.detach();
+}
+
+// ---- stalled downloads ----
+
+// a transfer engine on the fake camera with a 1 s stall timeout, SDK downloads only until serveHttp()
+struct EngineFixture {
+    PhaseTracer tracer;
+    TransferEngine engine;
+    std::string camera_dir;
+    std::shared_ptr<ins_camera::Camera> camera;
+
+    EngineFixture()
+        : engine(tracer), camera_dir(makeCameraDir()),
+          camera(std::make_shared<ins_camera::Camera>(ins_camera::DeviceConnectionInfo())) {
+        fake_camera::reset(camera_dir);
+        engine.attach(camera, "");
+        engine.setHttpConnections(0);
+        engine.setStallTimeout(1);
+    }
+
+    ~EngineFixture() {
+        engine.detach();
+    }
+
+    // the camera's file server is at base_url
+    void serveHttp(const std::string& base_url) {
+        engine.attach(camera, base_url);
+        engine.setHttpConnections(4);
+    }
+};
+
+TEST(stalledSdkDownloadIsCancelledAndRetried) {
+    EngineFixture fixture;
+    writePatternFile(fixture.camera_dir + "/VID_20250101_120020_00_003.insv", 1024 * 1024);
+    fake_camera::control().hang_downloads = 1;
+
+    const std::string local = scratchPath("VID_20250101_120020_00_003.insv");
+    DownloadResult result = fixture.engine.download("/DCIM/Camera01/VID_20250101_120020_00_003.insv", local, true);
+    EXPECT(result.success);
+    // the watchdog gave up on the silent download, the retry loop backed off and went again
+    EXPECT_EQ(1, fake_camera::control().cancels);
+    EXPECT_EQ(2, fake_camera::control().downloads);
+    EXPECT_EQ(1, result.retries);
+    EXPECT_EQ("needed 1 retry", result.warning);
+    EXPECT(contains(testOutput(), "Download stalled, retrying in 1 s (retry 1/3)"));
+    EXPECT_EQ(fileChecksum(fixture.camera_dir + "/VID_20250101_120020_00_003.insv"), fileChecksum(local));
+    EXPECT(!fileExists(local + ".sdk.part"));
+}
+
+TEST(queuedDownloadCompletesBehindHungOne) {
+    EngineFixture fixture;
+    writePatternFile(fixture.camera_dir + "/VID_20250101_120020_00_003.insv", 1024 * 1024);
+    fake_camera::control().hang_downloads = 1;
+
+    TransferJob hung = { "/DCIM/Camera01/VID_20250101_120020_00_003.insv",
+                         scratchPath("VID_20250101_120020_00_003.insv"), 0 };
+    TransferJob behind = { "/DCIM/Camera01/IMG_20250101_120000_00_001.insp",
+                           scratchPath("IMG_20250101_120000_00_001.insp"), 0 };
+    fixture.engine.enqueue(hung);
+    fixture.engine.enqueue(behind);
+    fixture.engine.waitIdle();
+
+    EXPECT_EQ(1, fake_camera::control().cancels);
+    EXPECT_EQ(3, fake_camera::control().downloads);
+    EXPECT_EQ(fileChecksum(fixture.camera_dir + "/VID_20250101_120020_00_003.insv"), fileChecksum(hung.local_path));
+    EXPECT_EQ(fileChecksum(fixtureDir() + "/IMG_20250101_120000_00_001.insp"), fileChecksum(behind.local_path));
+}
+
+TEST(stalledHttpDownloadResumesAfterBackoff) {
+    EngineFixture fixture;
+    const int64_t size = 3 * 1024 * 1024;
+    writePatternFile(fixture.camera_dir + "/VID_20250101_120020_00_003.insv", size);
+    HttpStandIn server(fixture.camera_dir);
+    fixture.serveHttp(server.baseUrl());
+    // the second stall makes no progress, which ends the immediate resume attempts
+    server.stallAt(1024 * 1024, 2);
+
+    const std::string local = scratchPath("VID_20250101_120020_00_003.insv");
+    DownloadResult result = fixture.engine.download("/DCIM/Camera01/VID_20250101_120020_00_003.insv", local, true);
+    EXPECT(result.success);
+    EXPECT_EQ(1, result.retries);
+    EXPECT_EQ("needed 1 retry", result.warning);
+    EXPECT(contains(testOutput(), "Download stalled, retrying in 1 s (retry 1/3)"));
+    EXPECT(contains(testOutput(), "Resumed partial download at 1.00 MB"));
+    // the SDK would have started over from the first byte
+    EXPECT_EQ(0, fake_camera::control().downloads);
+    EXPECT_EQ(fileChecksum(fixture.camera_dir + "/VID_20250101_120020_00_003.insv"), fileChecksum(local));
+}
+
+TEST(httpFailureWithoutCheckpointFallsBackToSdk) {
+    EngineFixture fixture;
+    writePatternFile(fixture.camera_dir + "/VID_20250101_120020_00_003.insv", 3 * 1024 * 1024);
+    HttpStandIn server(fixture.camera_dir);
+    fixture.serveHttp(server.baseUrl());
+    // without ranges a stalled transfer can't be resumed, so the SDK is as good as another try
+    server.setRanges(false);
+    server.stallAt(1024 * 1024, 1);
+
+    const std::string local = scratchPath("VID_20250101_120020_00_003.insv");
+    DownloadResult result = fixture.engine.download("/DCIM/Camera01/VID_20250101_120020_00_003.insv", local, true);
+    EXPECT(result.success);
+    EXPECT_EQ(0, result.retries);
+    EXPECT_EQ(1, fake_camera::control().downloads);
+    EXPECT(contains(result.warning, "used camera SDK instead"));
+    EXPECT_EQ(fileChecksum(fixture.camera_dir + "/VID_20250101_120020_00_003.insv"), fileChecksum(local));
+}
+
+// ---- copy-storage ----
+
+// a controller for the fake camera on camera_dir, copying into save_dir
+struct ControllerFixture {
+    CameraController controller;
+    std::string camera_dir;
+    std::string save_dir;
+
+    explicit ControllerFixture(const std::string& camera) : camera_dir(camera), save_dir(scratchPath("copies")) {
+        mkdir(save_dir.c_str(), 0755);
+        fake_camera::reset(camera_dir);
+    }
+
+    // http_base_url: the camera's file server, empty for none
+    bool connect(const std::string& http_base_url) {
+        fake_camera::control().http_base_url = http_base_url;
+        return controller.discoverAndConnect();
+    }
+
+    int run(const std::vector<std::string>& args) {
+        std::vector<std::string> command(args);
+        command.push_back(save_dir);
+        return runCommand(controller, command);
+    }
+};
+
+TEST(remoteSizesCountsOnlyAnsweredProbes) {
+    EngineFixture fixture;
+    HttpStandIn server(fixture.camera_dir);
+    std::vector<std::string> urls;
+    urls.push_back("/DCIM/Camera01/IMG_20250101_120000_00_001.insp");
+    urls.push_back("/DCIM/Camera01/VID_20250101_120010_00_002.insv");  // empty: 416
+    urls.push_back("/DCIM/Camera01/IMG_20250101_130000_00_009.insp");  // not there: 404
+    std::map<std::string, int64_t> sizes;
+    EXPECT_EQ(0u, fixture.engine.remoteSizes(urls, sizes));
+
+    fixture.serveHttp(server.baseUrl());
+    EXPECT_EQ(1u, fixture.engine.remoteSizes(urls, sizes));
+    EXPECT_EQ(1u, sizes.size());
+    EXPECT_EQ(24576, sizes[urls[0]]);
+}
+
+TEST(copyStorageWithoutSizesReportsSkippedAdmission) {
+    ControllerFixture fixture(makeCameraDir());
+    EXPECT(fixture.connect(""));
+    EXPECT_EQ(0, fixture.run(words("copy-storage", "--ext", "insp")));
+    EXPECT(contains(testOutput(), "Free-space check skipped, file sizes need the camera's HTTP server"));
+    EXPECT_EQ(1, countFiles(fixture.save_dir, "IMG_"));
+}
+
+TEST(copyStorageProbesOnlyFilteredAndUncopiedFiles) {
+    ControllerFixture fixture(makeCameraDir());
+    writePatternFile(fixture.camera_dir + "/IMG_20250101_120030_00_004.insp", 100 * 1024);
+    writePatternFile(fixture.camera_dir + "/VID_20250101_120040_00_005.insv", 1024 * 1024);
+    writePatternFile(fixture.camera_dir + "/LRV_20250101_120040_01_005.lrv", 50 * 1024);
+    HttpStandIn server(fixture.camera_dir);
+    EXPECT(fixture.connect(server.baseUrl()));
+
+    // --ext drops three of the five files before any size is asked for; the
+    // other probes are the ones each HTTP download makes for itself
+    EXPECT_EQ(0, fixture.run(words("copy-storage", "--ext", "insp")));
+    EXPECT_EQ(2 + 2, server.probes);
+    EXPECT(contains(testOutput(), "Selected 2 of 5 file(s) (ext=insp), 124.00 KB."));
+    EXPECT_EQ(2, countFiles(fixture.save_dir, "IMG_"));
+
+    // the camera still has them (deletes that never happened): the manifest knows
+    // their sizes, so --incremental neither probes nor downloads them again
+    const int probes = server.probes;
+    const std::vector<std::string> photos = words("IMG_20250101_120000_00_001.insp", "IMG_20250101_120030_00_004.insp");
+    for (size_t i = 0; i < photos.size(); i++) {
+        std::ifstream in(fixture.save_dir + "/" + photos[i], std::ios::binary);
+        std::ofstream out(fixture.camera_dir + "/" + photos[i], std::ios::binary);
+        out << in.rdbuf();
+    }
+    EXPECT_EQ(0, fixture.run(words("copy-storage", "--incremental", "--ext", "insp")));
+    EXPECT_EQ(probes, server.probes);
+    EXPECT_EQ(0, fake_camera::control().downloads);
+    EXPECT_EQ(0, countFiles(fixture.camera_dir, "IMG_"));
+}
+
+// a journal entry for a file on the fake camera and its copy in save_dir
+JournalEntry journalEntry(const std::string& serial, const std::string& name, const std::string& save_dir,
+                          int64_t size) {
+    JournalEntry entry;
+    entry.serial_number = serial;
+    entry.remote_path = fake_camera::remotePath(name);
+    entry.local_path = save_dir + "/" + name;
+    entry.size = size;
+    return entry;
+}
+
+TEST(copyJournalReplayDeletesOnlyWhatIsSafelyOnDisk) {
+    const std::string camera_dir = scratchPath("camera");
+    ControllerFixture fixture(camera_dir);
+    EXPECT(fixture.connect(""));
+    const std::string whole = "IMG_20250101_120000_00_001.insp";
+    const std::string truncated = "IMG_20250101_120005_00_002.insp";
+    const std::string deleted = "IMG_20250101_120010_00_003.insp";
+    const int64_t size = 100000;
+    writePatternFile(camera_dir + "/" + whole, size);
+    writePatternFile(camera_dir + "/" + truncated, size);
+    writePatternFile(fixture.save_dir + "/" + whole, size);
+    writePatternFile(fixture.save_dir + "/" + truncated, size / 2);  // the crash came before its sync
+
+    CopyJournal journal(fixture.save_dir + "/");
+    std::vector<JournalEntry> entries;
+    entries.push_back(journalEntry("IXSE0001", whole, fixture.save_dir, size));
+    entries.push_back(journalEntry("IXSE0001", truncated, fixture.save_dir, size));
+    entries.push_back(journalEntry("IXSE0001", deleted, fixture.save_dir, size));
+    entries.push_back(journalEntry("IXSE9999", "IMG_20250101_120015_00_004.insp", fixture.save_dir, size));
+    EXPECT(journal.commitDurable(entries));
+    journal.recordDeleted("IXSE0001", fake_camera::remotePath(deleted));
+    EXPECT_EQ(3, static_cast<int>(journal.pending().size()));
+
+    const std::vector<JournalEntry> others = fixture.controller.replayCopyJournal(journal);
+    // the whole copy lets the camera's file go, the truncated one keeps it
+    EXPECT(!fileExists(camera_dir + "/" + whole));
+    EXPECT(fileExists(camera_dir + "/" + truncated));
+    EXPECT(contains(testOutput(), truncated + " is missing or truncated"));
+    EXPECT(!contains(testOutput(), "Deleted from camera: " + fake_camera::remotePath(deleted)));
+
+    // another camera's entry is handed back and is all that reset() left in the journal
+    EXPECT_EQ(1, static_cast<int>(others.size()));
+    const std::vector<JournalEntry> left = journal.pending();
+    EXPECT_EQ(1, static_cast<int>(left.size()));
+    if (left.size() == 1) {
+        EXPECT_EQ(std::string("IXSE9999"), left[0].serial_number);
+        EXPECT_EQ(fake_camera::remotePath("IMG_20250101_120015_00_004.insp"), left[0].remote_path);
+        EXPECT_EQ(size, left[0].size);
+    }
+
+    // with nothing left for any camera the journal goes away
+    journal.reset(std::vector<JournalEntry>());
+    EXPECT(!fileExists(journal.path()));
+}
+
+// ---- NAL scanning ----
+
+// every (offset, header byte) a whole-buffer scalar scan finds
+std::vector<std::pair<uint64_t, uint8_t> > referenceNals(const std::vector<uint8_t>& data) {
+    std::vector<std::pair<uint64_t, uint8_t> > nals;
+    const uint8_t* begin = data.data();
+    const uint8_t* end = begin + data.size();
+    for (const uint8_t* p = begin; (p = findStartCodeScalar(p, end)) != end; p += 3) {
+        if (p + 3 < end) {
+            nals.push_back(std::make_pair(static_cast<uint64_t>(p - begin), p[3]));
+        }
+    }
+    return nals;
+}
+
+// bytes that are mostly 00, 01 and 03, so start codes and near misses sit at every alignment
+std::vector<uint8_t> startCodeMinefield(size_t size) {
+    std::vector<uint8_t> data(size);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245u + 12345u;
+        const uint32_t roll = (seed >> 16) % 16;
+        data[i] = static_cast<uint8_t>(roll < 8 ? 0 : roll < 11 ? 1 : roll < 13 ? 3 : 0x40 + roll);
+    }
+    return data;
+}
+
+TEST(startCodeFindersAgreeWithScalar) {
+    std::vector<uint8_t> stream;
+    int64_t nals = 0;
+    int64_t keyframes = 0;
+    buildSyntheticBitstream(1 << 20, stream, nals, keyframes);
+    const std::vector<uint8_t> minefield = startCodeMinefield(4096);
+    const std::vector<uint8_t>* inputs[] = { &stream, &minefield };
+    for (size_t n = 0; n < 2; n++) {
+        const uint8_t* data = inputs[n]->data();
+        const size_t size = inputs[n]->size();
+        // every start and length mod 32, so the vector loops meet their tails at every alignment
+        size_t mismatches = 0;
+        for (size_t start = 0; start < 32; start++) {
+            for (size_t length = 0; length < 64 && start + length <= size; length++) {
+                const uint8_t* end = data + start + length;
+                mismatches += findStartCode(data + start, end) != findStartCodeScalar(data + start, end) ? 1 : 0;
+            }
+        }
+        // and all the way through
+        const uint8_t* end = data + size;
+        for (const uint8_t* p = data; p < end; p++) {
+            const uint8_t* expected = findStartCodeScalar(p, end);
+            mismatches += findStartCode(p, end) != expected ? 1 : 0;
+            mismatches += findStartCodeMemchr(p, end) != expected ? 1 : 0;
+            p = expected == end ? end : expected;
+        }
+        EXPECT_EQ(0u, mismatches);
+    }
+    EXPECT_EQ(nals, static_cast<int64_t>(referenceNals(stream).size()));
+}
+
+TEST(annexBScannerFindsStartCodesSplitAcrossPieces) {
+    std::vector<uint8_t> stream;
+    int64_t nals = 0;
+    int64_t keyframes = 0;
+    buildSyntheticBitstream(1 << 20, stream, nals, keyframes);
+    const std::vector<uint8_t> minefield = startCodeMinefield(4096);
+    const std::vector<uint8_t>* inputs[] = { &stream, &minefield };
+    for (size_t n = 0; n < 2; n++) {
+        const std::vector<uint8_t>& data = *inputs[n];
+        const std::vector<std::pair<uint64_t, uint8_t> > expected = referenceNals(data);
+        // pieces of 1 to 7 bytes split start codes every which way
+        AnnexBScanner scanner;
+        std::vector<std::pair<uint64_t, uint8_t> > found;
+        int64_t random_access = 0;
+        for (size_t at = 0, piece = 1; at < data.size(); at += piece, piece = piece % 7 + 1) {
+            scanner.scan(data.data() + at, std::min(piece, data.size() - at), [&](uint64_t offset, uint8_t header) {
+                found.push_back(std::make_pair(offset, header));
+                random_access += isRandomAccessNal(CODEC_H264, header) ? 1 : 0;
+            });
+        }
+        EXPECT(found == expected);
+        if (n == 0) {
+            EXPECT_EQ(nals, static_cast<int64_t>(found.size()));
+            EXPECT_EQ(keyframes, random_access);
+        }
+    }
+}
+
+// ---- gyro log ----
+
+// largest difference on the accelerometer (accel) or gyroscope axes
+double worstAxisError(const ins_camera::GyroData& a, const ins_camera::GyroData& b, bool accel) {
+    if (accel) {
+        return std::max(std::fabs(a.ax - b.ax), std::max(std::fabs(a.ay - b.ay), std::fabs(a.az - b.az)));
+    }
+    return std::max(std::fabs(a.gx - b.gx), std::max(std::fabs(a.gy - b.gy), std::fabs(a.gz - b.gz)));
+}
+
+TEST(gyroBlocksRoundTripWithinRoundingSteps) {
+    const size_t count = 3 * GYRO_BLOCK_SAMPLES + 123;
+    const std::vector<ins_camera::GyroData> samples = buildSyntheticImu(count);
+    std::vector<uint8_t> encoded;
+    size_t blocks = 0;
+    for (size_t at = 0; at < count; at += GYRO_BLOCK_SAMPLES, blocks++) {
+        encodeGyroBlock(&samples[at], std::min<size_t>(GYRO_BLOCK_SAMPLES, count - at), GYRO_ACCEL_STEP, GYRO_RATE_STEP,
+                        encoded);
+    }
+    std::vector<ins_camera::GyroData> decoded;
+    const uint8_t* end = encoded.data() + encoded.size();
+    size_t decoded_blocks = 0;
+    for (const uint8_t* block = encoded.data(); block < end;
+         block += GYRO_BLOCK_HEADER_BYTES + getLittle<uint32_t>(block + 8), decoded_blocks++) {
+        if (!decodeGyroBlock(block, end, GYRO_ACCEL_STEP, GYRO_RATE_STEP, decoded)) {
+            fail(__FILE__, __LINE__, "block " + std::to_string(decoded_blocks) + " did not decode");
+            break;
+        }
+    }
+    EXPECT_EQ(blocks, decoded_blocks);
+    EXPECT_EQ(count, decoded.size());
+
+    // timestamps are exact, the axes within half a quantization step
+    double worst_accel = 0;
+    double worst_rate = 0;
+    size_t wrong_timestamps = 0;
+    for (size_t i = 0; i < std::min(count, decoded.size()); i++) {
+        wrong_timestamps += decoded[i].timestamp != samples[i].timestamp ? 1 : 0;
+        worst_accel = std::max(worst_accel, worstAxisError(decoded[i], samples[i], true));
+        worst_rate = std::max(worst_rate, worstAxisError(decoded[i], samples[i], false));
+    }
+    EXPECT_EQ(0u, wrong_timestamps);
+    EXPECT(worst_accel <= GYRO_ACCEL_STEP * 0.5001);
+    EXPECT(worst_rate <= GYRO_RATE_STEP * 0.5001);
+
+    // a block cut short is refused and adds nothing
+    std::vector<ins_camera::GyroData> partial;
+    EXPECT(!decodeGyroBlock(encoded.data(), encoded.data() + GYRO_BLOCK_HEADER_BYTES + 10, GYRO_ACCEL_STEP,
+                            GYRO_RATE_STEP, partial));
+    EXPECT(partial.empty());
+}
+
+TEST(gyroLogReaderQueriesWithAndWithoutIndex) {
+    const size_t count = 3 * GYRO_BLOCK_SAMPLES + 123;
+    const std::vector<ins_camera::GyroData> samples = buildSyntheticImu(count);
+    const std::string path = scratchPath("log.gyro");
+    {
+        GyroLogWriter writer;
+        EXPECT(writer.open(path));
+        for (size_t at = 0; at < count; at += 10) {
+            writer.add(&samples[at], std::min<size_t>(10, count - at));  // as OnGyroData delivers them
+        }
+        writer.close();
+        EXPECT(writer.error().empty());
+    }
+    const size_t blocks = (count + GYRO_BLOCK_SAMPLES - 1) / GYRO_BLOCK_SAMPLES;
+    const size_t first = GYRO_BLOCK_SAMPLES - 50;  // a range across a block boundary
+    const size_t last = GYRO_BLOCK_SAMPLES + 1000;
+
+    for (int pass = 0; pass < 3; pass++) {
+        if (pass == 1) {
+            // as if the writer died before close(): no index or footer
+            const int64_t size = getFileSize(path);
+            EXPECT_EQ(0, truncate(path.c_str(), size - static_cast<int64_t>(blocks * GYRO_INDEX_ENTRY_BYTES +
+                                                                            GYRO_FOOTER_BYTES)));
+        } else if (pass == 2) {
+            // and in the middle of writing the last block: it is left out
+            EXPECT_EQ(0, truncate(path.c_str(), getFileSize(path) - 7));
+        }
+        GyroLogReader reader;
+        std::string error;
+        EXPECT(reader.open(path, error));
+        EXPECT_EQ(pass == 0, reader.indexed());
+        EXPECT_EQ(pass == 2 ? blocks - 1 : blocks, reader.blocks().size());
+
+        std::vector<ins_camera::GyroData> found;
+        EXPECT(reader.query(samples[first].timestamp, samples[last].timestamp, found));
+        EXPECT_EQ(last - first + 1, found.size());
+        if (!found.empty()) {
+            EXPECT_EQ(samples[first].timestamp, found.front().timestamp);
+            EXPECT_EQ(samples[last].timestamp, found.back().timestamp);
+            EXPECT(worstAxisError(found.front(), samples[first], true) <= GYRO_ACCEL_STEP * 0.5001);
+        }
+        found.clear();
+        EXPECT(reader.query(samples[count - 1].timestamp, samples[count - 1].timestamp, found));
+        EXPECT_EQ(pass == 2 ? 0u : 1u, found.size());
+    }
+}
+
+// ---- stream recording ----
+
+// passes frames on to a recorder and keeps a copy of what it delivered
+class TeeDelegate : public ins_camera::StreamDelegate {
+private:
+    ins_camera::StreamDelegate& next_;
+
+public:
+    std::string delivered;                 // every frame, back to back
+    std::vector<KeyframeEntry> keyframes;  // where SyntheticStream's SPS-led keyframes start in delivered
+
+    explicit TeeDelegate(ins_camera::StreamDelegate& next) : next_(next) {}
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t type, int stream_index) override {
+        if (size > 4 && data[4] == 0x67) {
+            KeyframeEntry entry;
+            entry.offset = delivered.size();
+            entry.timestamp = timestamp;
+            keyframes.push_back(entry);
+        }
+        delivered.append(reinterpret_cast<const char*>(data), size);
+        next_.OnVideoData(data, size, timestamp, type, stream_index);
+    }
+
+    void OnAudioData(const uint8_t*, size_t, int64_t) override {}
+    void OnGyroData(const std::vector<ins_camera::GyroData>&) override {}
+    void OnExposureData(const ins_camera::ExposureData&) override {}
+};
+
+std::string readBytes(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+TEST(streamRecorderWritesSyntheticFramesUnchanged) {
+    const std::string base = scratchPath("LIVE");
+    StreamRecorder recorder(DEFAULT_STREAM_BUFFER_BYTES, base, CODEC_H264);
+    TeeDelegate tee(recorder);
+    recorder.start();
+    SyntheticStream stream(10000000, 30, 10);
+    const int64_t frames = stream.run(tee, 1.0, 4.0);
+    recorder.stop();
+
+    EXPECT(recorder.writeError().empty());
+    EXPECT_EQ(frames, recorder.frames());
+    EXPECT_EQ(0, recorder.droppedFrames());
+    EXPECT(readBytes(base + "_0.h264") == tee.delivered);
+
+    // the keyframe index: an 8 byte header, then the offset and timestamp of every keyframe
+    const std::string index = readBytes(base + "_0.h264.idx");
+    EXPECT(index.size() >= 8 && index.compare(0, 4, "CCKI") == 0);
+    EXPECT_EQ(static_cast<int64_t>(tee.keyframes.size()),
+              static_cast<int64_t>((index.size() - 8) / sizeof(KeyframeEntry)));
+    EXPECT(!tee.keyframes.empty());
+    for (size_t i = 0; i < tee.keyframes.size() && 8 + (i + 1) * sizeof(KeyframeEntry) <= index.size(); i++) {
+        KeyframeEntry entry;
+        memcpy(&entry, index.data() + 8 + i * sizeof(KeyframeEntry), sizeof(entry));
+        EXPECT_EQ(tee.keyframes[i].offset, entry.offset);
+        EXPECT_EQ(tee.keyframes[i].timestamp, entry.timestamp);
+    }
+}
+
+TEST(streamRecorderCountsDropsInUndersizedRing) {
+    const std::string base = scratchPath("LIVE");
+    // 64 KB holds less than the writer lets pile up before it writes
+    StreamRecorder recorder(64u << 10, base, CODEC_H264);
+    recorder.start();
+    SyntheticStream stream(10000000, 30, 10);
+    const int64_t frames = stream.run(recorder, 1.0, 4.0);
+    recorder.stop();
+
+    EXPECT(recorder.droppedFrames() > 0);
+    EXPECT_EQ(frames, recorder.frames() + recorder.droppedFrames());
+    // what was kept is on disk in full
+    EXPECT_EQ(recorder.bytes(), getFileSize(base + "_0.h264"));
+    std::ostringstream stats;
+    recorder.printStats(stats);
+    EXPECT(contains(stats.str(), std::to_string(recorder.droppedFrames()) + " dropped"));
+}
+
+TEST(streamRecorderTakesGyroFromAnotherThread) {
+    const std::string base = scratchPath("LIVE");
+    StreamRecorder recorder(DEFAULT_STREAM_BUFFER_BYTES, base, CODEC_H264);
+    recorder.start();
+    std::atomic<bool> video_done(false);
+    std::thread video([&] {
+        SyntheticStream stream(10000000, 30, 30);
+        stream.run(recorder, 1.0, 20.0);
+        video_done = true;
+    });
+    // samples from before stream 0's first frame are dropped by design, so start once its file is open
+    EXPECT(waitFor([&] { return fileExists(base + "_0.h264"); }));
+    int64_t delivered = 0;
+    std::vector<ins_camera::GyroData> batch(10);
+    while (!video_done) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            batch[i].timestamp = delivered + static_cast<int64_t>(i);
+            batch[i].ax = 0.5;
+            batch[i].gz = -0.25;
+        }
+        recorder.OnGyroData(batch);
+        delivered += static_cast<int64_t>(batch.size());
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    video.join();
+    recorder.stop();
+
+    EXPECT(recorder.writeError().empty());
+    EXPECT_EQ(0, recorder.droppedFrames());
+    EXPECT_EQ(recorder.bytes(), getFileSize(base + "_0.h264"));
+    GyroLogReader reader;
+    std::string error;
+    EXPECT(reader.open(base + ".gyro", error));
+    std::vector<ins_camera::GyroData> samples;
+    EXPECT(reader.query(0, delivered, samples));
+    EXPECT_EQ(delivered, static_cast<int64_t>(samples.size()));
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (samples[i].timestamp != static_cast<int64_t>(i) || samples[i].ax != 0.5 || samples[i].gz != -0.25) {
+            EXPECT_EQ(static_cast<int64_t>(i), samples[i].timestamp);
+            break;
+        }
+    }
+}
+
+// the one file in directory whose name ends with suffix, empty if none or several
+std::string findFile(const std::string& directory, const std::string& suffix) {
+    std::string found;
+    int count = 0;
+    DIR* dir = opendir(directory.c_str());
+    while (dirent* entry = dir ? readdir(dir) : nullptr) {
+        const std::string name = entry->d_name;
+        if (name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            found = directory + "/" + name;
+            count++;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return count == 1 ? found : std::string();
+}
+
+TEST(dashcamTakesAudioAndGyroFromOtherThreads) {
+    const std::string directory = scratchPath("events");
+    mkdir(directory.c_str(), 0755);
+    DashcamRecorder recorder(directory + "/", CODEC_H264, 1, 1, 64LL << 20);
+    recorder.start();
+    std::atomic<bool> done(false);
+    std::thread video([&] {
+        SyntheticStream stream(2000000, 30, 5);
+        stream.run(recorder, 3.0, 1.0);
+        done = true;
+    });
+    std::thread audio([&] {
+        const std::vector<uint8_t> packet(100, 0xA5);
+        for (int64_t timestamp = 0; !done; timestamp++) {
+            recorder.OnAudioData(packet.data(), packet.size(), timestamp);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    std::thread gyro([&] {
+        std::vector<ins_camera::GyroData> batch(10);
+        for (int64_t timestamp = 0; !done; timestamp += 10) {
+            for (size_t i = 0; i < batch.size(); i++) {
+                batch[i].timestamp = timestamp + static_cast<int64_t>(i);
+                batch[i].ax = 0.5;
+            }
+            recorder.OnGyroData(batch);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    recorder.trigger("test");
+    video.join();
+    audio.join();
+    gyro.join();
+    recorder.stop();
+
+    // records from the three producers arrive whole and unmixed
+    const std::string audio_path = findFile(directory, "_audio.raw");
+    std::ifstream in(audio_path, std::ios::binary);
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT(!bytes.empty());
+    EXPECT_EQ(0, static_cast<int>(bytes.size() % 100));
+    EXPECT(bytes.find_first_not_of(static_cast<char>(0xA5)) == std::string::npos);
+
+    GyroLogReader reader;
+    std::string error;
+    EXPECT(reader.open(findFile(directory, ".gyro"), error));
+    std::vector<ins_camera::GyroData> samples;
+    EXPECT(reader.query(0, INT64_MAX, samples));
+    EXPECT(!samples.empty());
+    for (size_t i = 1; i < samples.size(); i++) {
+        if (samples[i].ax != 0.5 || samples[i].timestamp <= samples[i - 1].timestamp) {
+            EXPECT(samples[i].ax == 0.5 && samples[i].timestamp > samples[i - 1].timestamp);
+            break;
+        }
+    }
+
+    std::ifstream capture(findFile(directory, "_0.h264"), std::ios::binary);
+    char head[5] = {};
+    EXPECT(capture.read(head, sizeof(head)));
+    EXPECT(memcmp(head, "\0\0\0\1\x67", 5) == 0);
+}
+
+// ---- stream segments ----
+
+TEST(segmentIndexListsSegmentsAndMarksTheEnd) {
+    const std::string path = scratchPath("LIVE_0.segments");
+    std::deque<StreamSegment> segments;
+    StreamSegment segment;
+    segment.name = "LIVE_0_00003.h264";
+    segment.sequence = 3;
+    segment.seconds = 6.25;
+    segments.push_back(segment);
+    segment.name = "LIVE_0_00004.h264";
+    segment.sequence = 4;
+    segment.seconds = 5.5;
+    segments.push_back(segment);
+
+    EXPECT(writeSegmentIndex(path, segments, false));
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    EXPECT_EQ(std::string("# camera_control segments 1\n# sequence seconds file\n"
+                          "3 6.250 LIVE_0_00003.h264\n4 5.500 LIVE_0_00004.h264\n"), text.str());
+    EXPECT(!contains(text.str(), "#EXT"));
+
+    segments.pop_front();
+    EXPECT(writeSegmentIndex(path, segments, true));
+    std::ifstream ended(path);
+    text.str("");
+    text << ended.rdbuf();
+    EXPECT(contains(text.str(), "\n4 5.500 LIVE_0_00004.h264\n# ended\n"));
+    EXPECT(!contains(text.str(), "00003"));
+    EXPECT(!fileExists(path + ".tmp"));
+}
+
+}  // namespace
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    char base_template[] = "/tmp/camera_control_test.XXXXXX";
+    const char* base = mkdtemp(base_template);
+    if (!base) {
+        std::cerr << "Error: cannot create scratch directory: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    // keep the listing cache and manifest out of the user's home
+    setenv("CAMERA_CONTROL_CACHE_DIR", (std::string(base) + "/cache").c_str(), 1);
+
+    const std::string source = __FILE__;
+    const size_t slash = source.rfind('/');
+    g_fixture_dir = absolutePath(slash == std::string::npos ? "." : source.substr(0, slash)) + "/fixtures/DCIM/Camera01";
+    char start_dir[4096];
+    if (!getcwd(start_dir, sizeof(start_dir))) {
+        std::cerr << "Error: cannot get working directory: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < testCases().size(); i++) {
+        const TestCase& test = testCases()[i];
+        g_scratch = std::string(base) + "/" + test.name;
+        mkdir(g_scratch.c_str(), 0755);
+        g_failures.clear();
+        g_output.str("");
+
+        std::streambuf* old_out = std::cout.rdbuf(g_output.rdbuf());
+        std::streambuf* old_err = std::cerr.rdbuf(g_output.rdbuf());
+        const auto start = std::chrono::steady_clock::now();
+        test.run();
+        const double ms = elapsedMs(start);
+        std::cout.rdbuf(old_out);
+        std::cerr.rdbuf(old_err);
+        if (chdir(start_dir) != 0) {
+            fail(__FILE__, __LINE__, std::string("cannot return to ") + start_dir);
+        }
+
+        if (g_failures.empty()) {
+            std::cout << "[  OK  ] " << test.name << " (" << std::fixed << std::setprecision(0) << ms << " ms)" << std::endl;
+            continue;
+        }
+        failed++;
+        std::cout << "[ FAIL ] " << test.name << std::endl;
+        for (size_t f = 0; f < g_failures.size(); f++) {
+            std::cout << "  " << g_failures[f] << std::endl;
+        }
+        std::cout << "  output:" << std::endl << g_output.str() << std::endl;
+    }
+    removeTree(base);
+
+    std::cout << testCases().size() - failed << "/" << testCases().size() << " tests passed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+// fake libCameraSDK for the tests, see fake_camera.h
+#include "fake_camera.h"
+
+#include <camera/camera.h>
+#include <camera/device_discovery.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fake_camera {
+
+namespace {
+
+const char* const CAMERA_DIR = "/DCIM/Camera01/";
+
+std::atomic<bool> g_cancel(false);
+std::atomic<int> g_captures(0);
+
+std::string localPath(const std::string& remote_path) {
+    return control().root + "/" + remote_path.substr(remote_path.rfind('/') + 1);
+}
+
+// writes a capture into root the way the camera would, with recognisable content
+std::string createFile(const std::string& name, int64_t size) {
+    std::ofstream out(control().root + "/" + name, std::ios::binary | std::ios::trunc);
+    for (int64_t i = 0; i < size; i++) {
+        out.put(static_cast<char>(i * 7 + name.size()));
+    }
+    return remotePath(name);
+}
+
+std::string captureName(const char* prefix, const char* lens, const char* extension) {
+    char name[64];
+    const int n = g_captures++;
+    snprintf(name, sizeof(name), "%s_20250101_1200%02d_%s_%03d.%s", prefix, n % 60, lens, n, extension);
+    return name;
+}
+
+}  // namespace
+
+Control& control() {
+    static Control instance;
+    return instance;
+}
+
+void reset(const std::string& root) {
+    Control& c = control();
+    c.root = root;
+    c.serial = "IXSE0001";
+    c.http_base_url.clear();
+    c.connected = true;
+    c.hang_downloads = 0;
+    c.discoveries = 0;
+    c.opens = 0;
+    c.downloads = 0;
+    c.cancels = 0;
+    c.streams = 0;
+    mkdir(root.c_str(), 0755);
+}
+
+std::string remotePath(const std::string& name) {
+    return CAMERA_DIR + name;
+}
+
+}  // namespace fake_camera
+
+namespace ins_camera {
+
+using fake_camera::control;
+
+void SetLogPath(const std::string&) {}
+void SetLogLevel(LogLevel) {}
+
+MediaUrl::MediaUrl(const std::vector<std::string>& uris, const std::vector<std::string>& lrv_uris)
+    : uris_(uris), lrv_uris_(lrv_uris) {}
+bool MediaUrl::Empty() const { return uris_.empty(); }
+bool MediaUrl::IsSingleOrigin() const { return uris_.size() == 1; }
+bool MediaUrl::IsSingleLRV() const { return lrv_uris_.size() == 1; }
+std::string MediaUrl::GetSingleOrigin() const { return uris_.empty() ? "" : uris_[0]; }
+std::string MediaUrl::GetSingleLRV() const { return lrv_uris_.empty() ? "" : lrv_uris_[0]; }
+const std::vector<std::string>& MediaUrl::OriginUrls() const { return uris_; }
+const std::vector<std::string>& MediaUrl::LRVUrls() const { return lrv_uris_; }
+
+std::vector<DeviceDescriptor> DeviceDiscovery::GetAvailableDevices() {
+    control().discoveries++;
+    DeviceDescriptor device;
+    device.camera_type = CameraType::Insta360X4;
+    device.serial_number = control().serial;
+    device.camera_name = "Insta360 X4";
+    device.fw_version = "1.0";
+    device.info.connection_type = ConnectionType::USB;
+    device.info.native_connection_info = nullptr;
+    return std::vector<DeviceDescriptor>(1, device);
+}
+
+void DeviceDiscovery::FreeDeviceDescriptors(std::vector<DeviceDescriptor>) {}
+
+Camera::Camera(const DeviceConnectionInfo&) {}
+
+bool Camera::Open() const {
+    control().opens++;
+    control().connected = true;
+    return true;
+}
+
+void Camera::Close() const {}
+
+bool Camera::IsConnected() {
+    return control().connected;
+}
+
+void Camera::SetTimeout(int) {}
+
+MediaUrl Camera::TakePhoto() const {
+    return MediaUrl(std::vector<std::string>(1, fake_camera::createFile(fake_camera::captureName("IMG", "00", "insp"), 300000)));
+}
+
+bool Camera::StartRecording() {
+    return true;
+}
+
+MediaUrl Camera::StopRecording() {
+    std::vector<std::string> origins;
+    origins.push_back(fake_camera::createFile(fake_camera::captureName("VID", "00", "insv"), 2000000));
+    origins.push_back(fake_camera::createFile(fake_camera::captureName("VID", "10", "insv"), 2000000));
+    std::vector<std::string> lrvs(1, fake_camera::createFile(fake_camera::captureName("LRV", "01", "lrv"), 100000));
+    return MediaUrl(origins, lrvs);
+}
+
+// copies the file in 64 KB steps with a progress callback per step, like the SDK
+bool Camera::DownloadCameraFile(const std::string& remote_path, const std::string& local_path,
+                                DownloadProgressCallBack callback) const {
+    control().downloads++;
+    fake_camera::g_cancel = false;
+    std::ifstream in(fake_camera::localPath(remote_path), std::ios::binary);
+    std::ofstream out(local_path, std::ios::binary | std::ios::trunc);
+    if (!in || !out) {
+        return false;
+    }
+    in.seekg(0, std::ios::end);
+    const int64_t total = in.tellg();
+    in.seekg(0);
+
+    int left = control().hang_downloads;
+    while (left > 0 && !control().hang_downloads.compare_exchange_weak(left, left - 1)) {
+    }
+    const bool hang = left > 0;
+
+    char buffer[65536];
+    int64_t current = 0;
+    while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+        out.write(buffer, in.gcount());
+        current += in.gcount();
+        if (callback) {
+            callback(current, total);
+        }
+        if (hang && current >= total / 2) {
+            // no more callbacks, like a camera that went quiet, until someone gives up on us
+            while (!fake_camera::g_cancel) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        if (fake_camera::g_cancel) {
+            return false;
+        }
+    }
+    return static_cast<bool>(out.flush());
+}
+
+void Camera::CancelDownload() {
+    control().cancels++;
+    fake_camera::g_cancel = true;
+}
+
+bool Camera::DeleteCameraFile(const std::string& remote_path) const {
+    return unlink(fake_camera::localPath(remote_path).c_str()) == 0;
+}
+
+std::vector<std::string> Camera::GetCameraFilesList() const {
+    std::vector<std::string> files;
+    DIR* dir = opendir(control().root.c_str());
+    if (!dir) {
+        return files;
+    }
+    while (dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            files.push_back(fake_camera::remotePath(name));
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+bool Camera::GetCameraFilesCount(int& count) const {
+    count = static_cast<int>(GetCameraFilesList().size());
+    return true;
+}
+
+std::string Camera::GetHttpBaseUrl() const {
+    return control().http_base_url;
+}
+
+bool Camera::SyncLocalTimeToCamera(uint64_t) {
+    return true;
+}
+
+// local wall clock as if it were UTC, which is how the camera keeps time
+int64_t Camera::GetCameraMediaTime() const {
+    const time_t now = time(nullptr);
+    std::tm local{};
+    localtime_r(&now, &local);
+    const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() % 1000;
+    return static_cast<int64_t>(timegm(&local)) * 1000 + ms;
+}
+
+bool Camera::GetBatteryStatus(BatteryStatus& status) {
+    status.power_type = BATTERY;
+    status.battery_level = 80;
+    status.battery_scale = 100;
+    return true;
+}
+
+bool Camera::GetStorageState(StorageStatus& status) {
+    status.state = STOR_CS_PASS;
+    status.free_space = 1ULL << 34;
+    status.total_space = 1ULL << 36;
+    return true;
+}
+
+bool Camera::SetVideoSubMode(SubVideoMode) { return true; }
+bool Camera::SetPhotoSubMode(SubPhotoMode) { return true; }
+bool Camera::ShutdownCamera() const { return true; }
+
+void Camera::SetCaptureStoppedNotification(CaptureStoppedCallBack) {}
+void Camera::SetBatteryLowNotification(BatteryLowCallBack) {}
+void Camera::SetStorageFullNotification(StorageFullCallBack) {}
+void Camera::SetTemperatureHighNotification(TemperatureHighCallBack) {}
+
+// the fake camera has no sensor: live streaming starts but never delivers data
+bool Camera::StartLiveStreaming(const LiveStreamParam&) {
+    control().streams++;
+    return true;
+}
+bool Camera::StopLiveStreaming() { return true; }
+void Camera::SetStreamDelegate(std::shared_ptr<StreamDelegate>&) {}
+VideoEncodeType Camera::GetVideoEncodeType() const { return VideoEncodeType::H264; }
+
+}  // namespace ins_camera
@@ -0,0 +1,37 @@
+// test double for libCameraSDK, linked into the tests instead of the real library.
+// the camera is a directory of files listed as /DCIM/Camera01/<name>; tests steer
+// it and read back what the code under test did through control().
+#ifndef CAMERA_CONTROL_FAKE_CAMERA_H
+#define CAMERA_CONTROL_FAKE_CAMERA_H
+
+#include <atomic>
+#include <string>
+
+namespace fake_camera {
+
+struct Control {
+    std::string root;           // directory holding the camera's files
+    std::string serial;         // serial number reported by discovery
+    std::string http_base_url;  // what Camera::GetHttpBaseUrl() returns, empty = no HTTP server
+    std::atomic<bool> connected;      // Camera::IsConnected(), set again by Open()
+    std::atomic<int> hang_downloads;  // this many DownloadCameraFile() calls stop half way until CancelDownload()
+
+    // what the code under test did
+    std::atomic<int> discoveries;
+    std::atomic<int> opens;
+    std::atomic<int> downloads;
+    std::atomic<int> cancels;
+    std::atomic<int> streams;  // StartLiveStreaming() calls
+};
+
+Control& control();
+
+// a connected camera serving root (created if missing), no HTTP server, counters at zero
+void reset(const std::string& root);
+
+// camera path of a file in root, as GetCameraFilesList() reports it
+std::string remotePath(const std::string& name);
+
+}  // namespace fake_camera
+
+#endif
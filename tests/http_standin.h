@@ -0,0 +1,244 @@
+// stand-in for the camera's built-in file server: serves the files in a directory as
+// /DCIM/Camera01/<name> on a loopback port, with or without Range support, and can
+// cut responses short at a file offset to simulate a dropped or stalled WiFi link.
+#ifndef CAMERA_CONTROL_HTTP_STANDIN_H
+#define CAMERA_CONTROL_HTTP_STANDIN_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HttpStandIn {
+private:
+    std::string root_;
+    int listen_fd_;
+    int port_;
+    std::atomic<bool> stop_;
+    std::thread acceptor_;
+    std::mutex mutex_;
+    std::vector<std::thread> connections_;
+    std::map<std::string, int> cuts_;  // responses cut so far, per path
+
+    std::atomic<bool> ranges_;
+    std::atomic<long long> cut_at_;  // file offset, -1 = never cut
+    std::atomic<int> cut_times_;     // responses per path that get cut
+    std::atomic<bool> stall_;        // cut by going quiet instead of closing the connection
+
+    static bool sendAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool sendText(int fd, const std::string& text) {
+        return sendAll(fd, text.data(), text.size());
+    }
+
+    // reads the request head; the client never sends a body
+    static bool readHead(int fd, std::string& head) {
+        char buffer[1024];
+        while (head.find("\r\n\r\n") == std::string::npos) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                return false;
+            }
+            head.append(buffer, static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    // true if path hasn't had all its cuts yet, counting this one
+    bool claimCut(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cuts_[path] >= cut_times_) {
+            return false;
+        }
+        cuts_[path]++;
+        return true;
+    }
+
+    // sends nothing more until the client gives up on the connection
+    void holdUntilClosed(int fd) {
+        char buffer[256];
+        while (!stop_) {
+            pollfd entry = { fd, POLLIN, 0 };
+            if (poll(&entry, 1, 50) > 0 && recv(fd, buffer, sizeof(buffer), 0) <= 0) {
+                break;
+            }
+        }
+    }
+
+    void serve(int fd) {
+        std::string head;
+        if (!readHead(fd, head)) {
+            close(fd);
+            return;
+        }
+        requests++;
+        const size_t path_start = head.find(' ') + 1;
+        const std::string path = head.substr(path_start, head.find(' ', path_start) - path_start);
+        const std::string prefix = "/DCIM/Camera01/";
+        const std::string file = root_ + "/" + (path.compare(0, prefix.size(), prefix) == 0 ? path.substr(prefix.size()) : "");
+
+        struct stat info;
+        FILE* in = path.size() > prefix.size() && stat(file.c_str(), &info) == 0 ? fopen(file.c_str(), "rb") : nullptr;
+        if (!in) {
+            sendText(fd, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            close(fd);
+            return;
+        }
+        const long long size = info.st_size;
+        long long start = 0;
+        long long end = size - 1;
+        std::string status = "200 OK";
+        std::string extra;
+        const size_t range = head.find("\r\nRange: bytes=");
+        if (range != std::string::npos && ranges_) {
+            range_requests++;
+            const char* spec = head.c_str() + range + 15;
+            start = atoll(spec);
+            const char* dash = strchr(spec, '-');
+            if (dash && dash[1] >= '0' && dash[1] <= '9') {
+                end = std::min(end, atoll(dash + 1));
+            }
+            if (start >= size || start > end) {
+                sendText(fd, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + std::to_string(size) +
+                             "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                fclose(in);
+                close(fd);
+                return;
+            }
+            status = "206 Partial Content";
+            extra = "Content-Range: bytes " + std::to_string(start) + "-" + std::to_string(end) + "/" +
+                    std::to_string(size) + "\r\n";
+        }
+        const long long length = end - start + 1;
+        sendText(fd, "HTTP/1.1 " + status + "\r\n" + extra + "Content-Length: " + std::to_string(length) +
+                     "\r\nConnection: close\r\n\r\n");
+
+        // the client's 0-0 size probe is never cut, even when it gets the whole file
+        const bool probe = head.find("\r\nRange: bytes=0-0\r\n") != std::string::npos;
+        probes += probe ? 1 : 0;
+        long long cut = probe ? -1 : cut_at_.load();
+        fseek(in, static_cast<long>(start), SEEK_SET);
+        char buffer[65536];
+        long long sent = 0;
+        while (sent < length && !stop_) {
+            long long want = std::min<long long>(sizeof(buffer), length - sent);
+            const long long offset = start + sent;
+            if (cut >= offset && offset + want > cut) {
+                if (offset < cut) {
+                    want = cut - offset;
+                } else if (claimCut(path)) {
+                    if (stall_) {
+                        holdUntilClosed(fd);
+                    }
+                    break;
+                } else {
+                    cut = -1;  // other connections already had this path's cuts
+                }
+            }
+            const size_t n = fread(buffer, 1, static_cast<size_t>(want), in);
+            if (n == 0 || !sendAll(fd, buffer, n)) {
+                break;
+            }
+            sent += static_cast<long long>(n);
+            bytes_sent += static_cast<long long>(n);
+        }
+        fclose(in);
+        close(fd);
+    }
+
+    void acceptLoop() {
+        while (!stop_) {
+            pollfd entry = { listen_fd_, POLLIN, 0 };
+            if (poll(&entry, 1, 50) <= 0) {
+                continue;
+            }
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            connections_.push_back(std::thread(&HttpStandIn::serve, this, fd));
+        }
+    }
+
+public:
+    // what clients asked for
+    std::atomic<int> requests;
+    std::atomic<int> range_requests;  // requests answered as ranges
+    std::atomic<int> probes;          // 0-0 size probes among the requests
+    std::atomic<long long> bytes_sent;
+
+    explicit HttpStandIn(const std::string& root)
+        : root_(root), listen_fd_(-1), port_(0), stop_(false), ranges_(true), cut_at_(-1), cut_times_(0),
+          stall_(false), requests(0), range_requests(0), probes(0), bytes_sent(0) {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && listen(listen_fd_, 16) == 0 &&
+            getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &length) == 0) {
+            port_ = ntohs(addr.sin_port);
+        }
+        acceptor_ = std::thread(&HttpStandIn::acceptLoop, this);
+    }
+
+    ~HttpStandIn() {
+        stop_ = true;
+        acceptor_.join();
+        for (size_t i = 0; i < connections_.size(); i++) {
+            connections_[i].join();
+        }
+        close(listen_fd_);
+    }
+
+    // what Camera::GetHttpBaseUrl() would return for this server
+    std::string baseUrl() const {
+        return "http://127.0.0.1:" + std::to_string(port_);
+    }
+
+    // false: ignore Range headers and always send the whole file with 200, like a basic server
+    void setRanges(bool ranges) {
+        ranges_ = ranges;
+    }
+
+    // the first response for a path that reaches file offset at closes the connection there
+    void dropAt(long long at) {
+        stall_ = false;
+        cut_times_ = 1;
+        cut_at_ = at;
+    }
+
+    // the first times responses for a path that reach file offset at stop sending there and
+    // keep the connection open until the client gives up
+    void stallAt(long long at, int times) {
+        stall_ = true;
+        cut_times_ = times;
+        cut_at_ = at;
+    }
+};
+
+#endif